@@ -0,0 +1,44 @@
+/*
+ * activations.hpp: Activation function policies
+ * Passed as template arguments down to populate_spa so the per element call inlines
+ * (c) Mohammad Hasanzadeh Mofrad, 2020
+ * (e) m.hasanzadeh.mofrad@gmail.com
+ */
+
+#ifndef ACTIVATIONS_HPP
+#define ACTIVATIONS_HPP
+
+#include <math.h>
+
+enum ACTIVATION_TYPE {_NOOP_, _RELU_, _CAPPED_RELU_, _LEAKY_RELU_, _SIGMOID_};
+const char* ACTIVATION_TYPES[] = {"_NOOP_", "_RELU_", "_CAPPED_RELU_", "_LEAKY_RELU_", "_SIGMOID_"};
+
+template<typename Weight>
+struct Noop {
+    static inline Weight apply(const Weight x) { return(x); }
+};
+
+template<typename Weight>
+struct ReLU {
+    static inline Weight apply(const Weight x) { return((x < 0) ? 0 : x); }
+};
+
+/* ReLU thresholded at YMAX, as in the Sparse DNN Graph Challenge */
+template<typename Weight>
+struct Capped_ReLU {
+    static constexpr Weight YMAX = 32;
+    static inline Weight apply(const Weight x) { return((x < 0) ? 0 : (x > YMAX) ? YMAX : x); }
+};
+
+template<typename Weight>
+struct Leaky_ReLU {
+    static constexpr Weight SLOPE = 0.01;
+    static inline Weight apply(const Weight x) { return((x < 0) ? (SLOPE * x) : x); }
+};
+
+template<typename Weight>
+struct Sigmoid {
+    static inline Weight apply(const Weight x) { return(1 / (1 + exp(-x))); }
+};
+
+#endif
@@ -11,14 +11,18 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cstring> 
+#include <algorithm>
 
 template<typename Data_Type>
 struct Data_Block {
     public:
         Data_Block();
         Data_Block(const uint64_t nitems_, const int32_t socket_id_ = 1);
+        Data_Block(Data_Type* ptr_, const uint64_t nitems_);
+        Data_Block(const int fd, const uint64_t offset, const uint64_t nitems_);
         ~Data_Block();
         void allocate();
+        void allocate_huge();
         void deallocate();
         void reallocate(const uint64_t nitems_);
         void clear(const uint64_t start = 0, const uint64_t end = 0);
@@ -26,6 +30,10 @@ struct Data_Block {
         uint64_t nitems;
         uint64_t nbytes;
         int32_t socket_id;
+        bool huge = false; /* Mapped by allocate_huge */
+        bool shared = false; /* A view into memory owned elsewhere (an MPI shared window), never remapped or freed here */
+        bool mapped = false; /* A read only mapping of a file (a model bundle), starting head bytes into its first page */
+        uint64_t head = 0;
         Data_Type* ptr;
 };
 
@@ -34,6 +42,22 @@ Data_Block<Data_Type>::Data_Block(const uint64_t nitems_, const int32_t socket_i
     allocate();
 }
 
+template<typename Data_Type>
+Data_Block<Data_Type>::Data_Block(Data_Type* ptr_, const uint64_t nitems_) : nitems(nitems_), nbytes(nitems_ * sizeof(Data_Type)), socket_id(Env::rank_socket_id), shared(true), ptr(ptr_) {}
+
+/* Zero copy items of an open file, the pages come from the page cache and are never written */
+template<typename Data_Type>
+Data_Block<Data_Type>::Data_Block(const int fd, const uint64_t offset, const uint64_t nitems_) : nitems(nitems_), nbytes(nitems_ * sizeof(Data_Type)), socket_id(Env::rank_socket_id), mapped(true), head(offset % Env::PAGE_SIZE), ptr(nullptr) {
+    if(nbytes) {
+        char* region = (char*) mmap(nullptr, head + nbytes, PROT_READ, MAP_PRIVATE, fd, offset - head);
+        if(region == (void*) -1) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot mmap file\n");
+            std::exit(Env::finalize()); 
+        }
+        ptr = (Data_Type*) (region + head);
+    }
+}
+
 template<typename Data_Type>
 Data_Block<Data_Type>::Data_Block() : nitems(0), nbytes(0), ptr(nullptr) {}
 
@@ -45,9 +69,14 @@ Data_Block<Data_Type>::~Data_Block() {
 template<typename Data_Type>
 void Data_Block<Data_Type>::allocate() {
     if(nbytes) {
+        if((Env::page_policy != Env::PAGE_POLICY::_BASE_PAGES_) and (nbytes >= Env::HUGE_PAGE_SIZE)) {
+            allocate_huge();
+            return;
+        }
+        huge = false;
         nbytes += (nbytes % Env::PAGE_SIZE) ? (Env::PAGE_SIZE - (nbytes % Env::PAGE_SIZE)) : 0;
         if(Env::NUMA_ALLOC) {
-            if((ptr = (Data_Type*) numa_alloc_onnode(nbytes, socket_id)) == nullptr) {
+            if((ptr = (Data_Type*) ((socket_id == Env::INTERLEAVED) ? numa_alloc_interleaved(nbytes) : numa_alloc_onnode(nbytes, socket_id))) == nullptr) {
                 Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot numa_alloc memory\n");
                 std::exit(Env::finalize()); 
             }
@@ -58,14 +87,61 @@ void Data_Block<Data_Type>::allocate() {
                 std::exit(Env::finalize()); 
             }
         }
-        memset(ptr, 0,  nbytes); 
+        // Anonymous pages come zeroed, they are touched by whoever writes them first
+    }
+}
+
+/* Blocks of a huge page or more are rounded to the huge page size. _HUGETLB_PAGES_ maps them from 
+   the hugetlbfs pool and, when the pool is empty, falls back to transparent huge pages: the block is 
+   mapped with one extra huge page, trimmed to a huge page boundary and madvised. If THP is disabled
+   the madvise fails quietly and the block stays on base pages; Env::get_huge_page_bytes tells. */
+template<typename Data_Type>
+void Data_Block<Data_Type>::allocate_huge() {
+    huge = true;
+    nbytes += (nbytes % Env::HUGE_PAGE_SIZE) ? (Env::HUGE_PAGE_SIZE - (nbytes % Env::HUGE_PAGE_SIZE)) : 0;
+    ptr = (Data_Type*) -1;
+    if(Env::page_policy == Env::PAGE_POLICY::_HUGETLB_PAGES_) {
+        ptr = (Data_Type*) mmap(nullptr, nbytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    }
+    if(ptr == (void*) -1) {
+        uint64_t mapped_nbytes = nbytes + Env::HUGE_PAGE_SIZE;
+        char* mapped = (char*) mmap(nullptr, mapped_nbytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if(mapped == (void*) -1) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot mmap memory\n");
+            std::exit(Env::finalize()); 
+        }
+        uint64_t head = (Env::HUGE_PAGE_SIZE - ((uintptr_t) mapped % Env::HUGE_PAGE_SIZE)) % Env::HUGE_PAGE_SIZE;
+        if(head) munmap(mapped, head);
+        if(mapped_nbytes - head - nbytes) munmap(mapped + head + nbytes, mapped_nbytes - head - nbytes);
+        ptr = (Data_Type*) (mapped + head);
+        madvise(ptr, nbytes, MADV_HUGEPAGE);
+    }
+    if(Env::NUMA_ALLOC) {
+        if(socket_id == Env::INTERLEAVED) numa_interleave_memory(ptr, nbytes, numa_all_nodes_ptr);
+        else numa_tonode_memory(ptr, nbytes, socket_id);
     }
 }
 
 template<typename Data_Type>
 void Data_Block<Data_Type>::deallocate() {
-    if(ptr and nbytes) {
-        if(Env::NUMA_ALLOC) {
+    if(shared) {
+        ptr = nullptr;
+    }
+    else if(mapped) {
+        if(ptr and ((munmap(((char*) ptr) - head, head + nbytes)) == -1)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot unmap file\n");
+            std::exit(Env::finalize()); 
+        }
+        ptr = nullptr;
+    }
+    else if(ptr and nbytes) {
+        if(huge) {
+            if((munmap(ptr, nbytes)) == -1) {
+                Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot unmap memory\n");
+                std::exit(Env::finalize()); 
+            }
+        }
+        else if(Env::NUMA_ALLOC) {
             numa_free(ptr, nbytes);
         }
         else {
@@ -78,35 +154,56 @@ void Data_Block<Data_Type>::deallocate() {
     }
 }
 
+/* nbytes is the capacity and nitems the items in use: the block only remaps when it outgrows its 
+   capacity, then at least doubles it, and never shrinks, so a layer loop settles after a few layers.
+   The items are kept, the grown pages come zeroed, and items reused below the capacity are not cleared. */
 template<typename Data_Type>
 void Data_Block<Data_Type>::reallocate(const uint64_t nitems_) {
-    if(nbytes) {
+    if(shared or mapped) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot reallocate a %s block\n", (shared) ? "shared" : "file-backed");
+        std::exit(Env::finalize()); 
+    }
+    else if(nbytes) {
         uint64_t old_nbytes = nbytes;
         uint64_t new_nbytes = nitems_ * sizeof(Data_Type);
-        new_nbytes += (new_nbytes % Env::PAGE_SIZE) ? (Env::PAGE_SIZE - (new_nbytes % Env::PAGE_SIZE)) : 0;
-
-        if((old_nbytes != new_nbytes) and new_nbytes) {
-            if(Env::NUMA_ALLOC) {
-                if((ptr = (Data_Type*) numa_realloc(ptr, old_nbytes, new_nbytes)) == (void*) 0) { 
-                    Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot numa realloc memory\n");
-                    std::exit(Env::finalize()); 
+        if(new_nbytes > old_nbytes) {
+            new_nbytes = std::max(new_nbytes, 2 * old_nbytes);
+            if(huge or ((Env::page_policy != Env::PAGE_POLICY::_BASE_PAGES_) and (new_nbytes >= Env::HUGE_PAGE_SIZE))) {
+                // mremap keeps neither the hugetlbfs backing nor the huge page alignment, so move it by hand
+                Data_Type* old_ptr = ptr;
+                bool old_huge = huge;
+                nbytes = new_nbytes;
+                allocate_huge();
+                memcpy(ptr, old_ptr, old_nbytes);
+                if(old_huge or not Env::NUMA_ALLOC) {
+                    if((munmap(old_ptr, old_nbytes)) == -1) {
+                        Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot unmap memory\n");
+                        std::exit(Env::finalize()); 
+                    }
+                }
+                else {
+                    numa_free(old_ptr, old_nbytes);
                 }
             }
             else {
-                if((ptr = (Data_Type*) mremap(ptr, old_nbytes, new_nbytes, MREMAP_MAYMOVE)) == (void*) -1) { 
-                    Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot mremap memory\n");
-                    std::exit(Env::finalize()); 
+                new_nbytes += (new_nbytes % Env::PAGE_SIZE) ? (Env::PAGE_SIZE - (new_nbytes % Env::PAGE_SIZE)) : 0;
+                if(Env::NUMA_ALLOC) {
+                    if((ptr = (Data_Type*) numa_realloc(ptr, old_nbytes, new_nbytes)) == (void*) 0) { 
+                        Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot numa realloc memory\n");
+                        std::exit(Env::finalize()); 
+                    }
                 }
+                else {
+                    if((ptr = (Data_Type*) mremap(ptr, old_nbytes, new_nbytes, MREMAP_MAYMOVE)) == (void*) -1) { 
+                        Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot mremap memory\n");
+                        std::exit(Env::finalize()); 
+                    }
+                }
+                nbytes = new_nbytes;
             }
-            if(new_nbytes > old_nbytes) {
-                memset(ptr + nitems, 0, new_nbytes - old_nbytes); // If grow, zeros the added memory
-            }
-            nitems = nitems_;
-            nbytes = new_nbytes;
-        }
-        else {
-            nitems = nitems_;
+            Env::nremaps++;
         }
+        nitems = nitems_;
     }
     else {
         nitems = nitems_;
@@ -117,13 +214,9 @@ void Data_Block<Data_Type>::reallocate(const uint64_t nitems_) {
 
 template<typename Data_Type>
 void Data_Block<Data_Type>::clear(const uint64_t start, const uint64_t end) {
-    if(start or end) {
-        uint64_t nb = (end - start) * sizeof(Data_Type);
-        memset(ptr+start, 0,  nb);   
-    }
-    else {
-        memset(ptr, 0,  nbytes);        
-    }
+    uint64_t nb = (start or end) ? (end - start) * sizeof(Data_Type) : nitems * sizeof(Data_Type);
+    memset(ptr+start, 0,  nb);
+    Env::nmemset_bytes += nb;
 }
 
 template<typename Data_Type>
@@ -133,7 +226,7 @@ void Data_Block<Data_Type>::copy(Data_Type* data, const uint64_t start, const ui
         memcpy(ptr+start, data+start,  nb);   
     }
     else {
-        memcpy(ptr, data,  nbytes);          
+        memcpy(ptr, data,  nitems * sizeof(Data_Type));          
     }
 }
 
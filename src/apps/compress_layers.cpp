@@ -0,0 +1,96 @@
+/*
+ * compress_layers.cpp: Radix-Net layer converter (binary triples --> pre-compressed CSC/CSR tiles)
+ * The layers are padded and hashed as Net does, so run it with the OMP_NUM_THREADS of the inference runs
+ * (c) Mohammad Hasanzadeh Mofrad, 2020
+ * (e) m.hasanzadeh.mofrad@gmail.com
+ */
+
+// make clean && make && mpirun.mpich -np 4 bin/./compress_layers -m 1024 -n 1024 -l 120 -c 0 data/radixnet/bin/DNN -f 3 -h 3 [-b data/radixnet/bin/n1024-l120.bundle]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <memory>
+
+#include "env.hpp"
+#include "log.hpp"
+#include "triple.hpp"
+#include "io.hpp"
+#include "tiling.hpp"
+#include "hashers.hpp"
+
+using WGT = float;
+
+int main(int argc, char **argv) {
+    Logging::enabled = true;
+    int status = Env::init();
+    if(status) {
+        Logging::print(Logging::LOG_LEVEL::FATAL, "Failure to initialize MPI environment\n");
+        std::exit(Env::finalize());
+    }
+
+    if((argc != 14) and (argc != 16)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "USAGE = %s -m <input_nfeatures> -n <nneurons> -l <nmax_layers> -c <ncategories> <path_to_dnn> -f <compression_type> -h <hashing_type> [-b <bundle_file>]\n", argv[0]);
+        std::exit(Env::finalize());
+    }
+
+    uint32_t input_nfeatures = atoi(argv[2]);
+	uint32_t nneurons = atoi(argv[4]);
+	uint32_t nmax_layers = atoi(argv[6]);
+	uint32_t ncategories = atoi(argv[8]);
+	std::string layer_file_prefix = ((std::string) argv[9]) + "/neuron" + std::to_string(nneurons) + "/n" + std::to_string(nneurons);
+	std::string category_file = ((std::string) argv[9]) + "/neuron" + std::to_string(nneurons) + "-l" + std::to_string(nmax_layers) + "-categories.bin";
+	COMPRESSED_FORMAT compression_type = (COMPRESSED_FORMAT) atoi(argv[11]);
+	HASHING_TYPE hashing_type = (HASHING_TYPE) atoi(argv[13]);
+	std::string bundle_file = (argc == 16) ? ((std::string) argv[15]) : "";
+	INPUT_TYPE input_type = INPUT_TYPE::_BINARY_;
+
+	if((compression_type != COMPRESSED_FORMAT::_CSC_) and (compression_type != COMPRESSED_FORMAT::_CSR_)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Only %s and %s layers can be stored\n", COMPRESSED_FORMATS[COMPRESSED_FORMAT::_CSR_], COMPRESSED_FORMATS[COMPRESSED_FORMAT::_CSC_]);
+        std::exit(Env::finalize());
+    }
+	if(hashing_type > HASHING_TYPE::_BOTH_) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Incorrect hashing type\n");
+        std::exit(Env::finalize());
+    }
+    Logging::print(Logging::LOG_LEVEL::INFO, "Compressing %d layers to %s with %s hashing, MPI ranks = %d, Threads per rank = %d\n", nmax_layers, COMPRESSED_FORMATS[compression_type], HASHING_TYPES[hashing_type], Env::nranks, Env::nthreads);
+
+	/* Same padding as the Net constructor */
+	input_nfeatures+=2;
+	input_nfeatures += (input_nfeatures % Env::nthreads) ? (Env::nthreads - (input_nfeatures % Env::nthreads)) : 0;
+	nneurons+=2;
+	nneurons += (nneurons % Env::nthreads) ? (Env::nthreads - (nneurons % Env::nthreads)) : 0;
+
+	uint32_t layer_nrows = 0, layer_ncols = 0;
+	for(uint32_t i = Env::rank; i < nmax_layers; i += Env::nranks) {
+		if(i == 0) { layer_nrows = input_nfeatures; layer_ncols = nneurons; }
+		else if(i < nmax_layers-1) { layer_nrows = nneurons; layer_ncols = nneurons; }
+		else { layer_nrows = nneurons; layer_ncols = ncategories ? ncategories : nneurons; }
+		std::string layer_file = layer_file_prefix + "-l" + std::to_string(i+1) + ".bin";
+		std::string compressed_file = IO::compressed_file(layer_file, compression_type);
+		std::shared_ptr<struct TwoDHasher> hasher = std::make_shared<struct TwoDHasher>(hashing_type, false, layer_nrows, layer_ncols, 1, 1);
+
+		Logging::enabled = false;
+		Tiling<WGT> layer(1, 1, 1, 1, layer_nrows, layer_ncols, layer_file, input_type, TILING_TYPE::_1D_COL_, compression_type, hasher);
+		layer.tiles[0][0].store(compressed_file, hashing_type);
+		Logging::enabled = true;
+		Logging::print(Logging::LOG_LEVEL::INFO, "Stored %s (%lu nonzeros)\n", compressed_file.c_str(), layer.nnzs);
+	}
+
+	/* One file with all the stored layers and the categories (Radix-Net biases are constant) */
+	Env::barrier();
+	if(not bundle_file.empty() and (Env::rank == 0)) {
+		std::vector<std::tuple<BUNDLE_ENTRY, uint32_t, std::string>> files;
+		for(uint32_t i = 0; i < nmax_layers; i++) {
+			files.push_back(std::make_tuple(BUNDLE_ENTRY::_LAYER_ENTRY_, i, IO::compressed_file(layer_file_prefix + "-l" + std::to_string(i+1) + ".bin", compression_type)));
+		}
+		files.push_back(std::make_tuple(BUNDLE_ENTRY::_CATEGORY_ENTRY_, 0, category_file));
+		IO::write_bundle(bundle_file, files);
+		Logging::print(Logging::LOG_LEVEL::INFO, "Stored %s (%lu entries)\n", bundle_file.c_str(), files.size());
+	}
+
+    return(Env::finalize());
+}
@@ -24,8 +24,6 @@
 #include "allocator.hpp"
 
 using WGT = float;
-WGT noop(WGT w) {return w;}
-WGT relu(WGT w) {return (w < 0) ? 0 : w;}
 
 
 int main(int argc, char **argv) {
@@ -107,7 +105,7 @@ int main(int argc, char **argv) {
 			   nneurons, nmax_layers, layer_files, 
 			   bias_value, bias_type, bias_files, 
 			   ncategories, category_type, category_file, 
-			   noop, relu, "sigmoid",
+			   ACTIVATION_TYPE::_RELU_, "sigmoid",
 			   input_type, parallelism_type, compression_type, hashing_type);
     
     return(Env::finalize());
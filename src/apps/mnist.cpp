@@ -5,7 +5,7 @@
  * (e) m.hasanzadeh.mofrad@gmail.com
  */
  
-// make clean && make && time mpirun.mpich -np 1 bin/./mnist -m 60000 784 -n 1024 -l 120 -c 10 data/sparse_mnist/bin/ data/sparse_mnist/bin/ -p 0
+// make clean && make && time mpirun.mpich -np 1 bin/./mnist -m 60000 784 -n 1024 -l 120 -c 10 data/sparse_mnist/bin/ data/sparse_mnist/bin/ -p 0 [-w 8] [--compression dcsc] [--row_compaction 1]
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,8 +24,6 @@
 #include "allocator.hpp"
 
 using WGT = float;
-WGT noop(WGT w) {return w;}
-WGT relu(WGT w) {return (w < 0) ? 0 : w;}
 
 int main(int argc, char **argv) {
     Logging::enabled = true;
@@ -35,8 +33,8 @@ int main(int argc, char **argv) {
         std::exit(Env::finalize());   
     }
 
-    if(argc != 14) {
-        Logging::print(Logging::LOG_LEVEL::FATAL, "USAGE = %s -m <input_ninstances input_nfeatures> -n <nneurons> -l <nmax_layers> -c <ncategories> <path_to_input> <path_to_dnn> -p <parallelism_type>\n", argv[0]);
+    if((argc < 14) or (argc % 2)) {
+        Logging::print(Logging::LOG_LEVEL::FATAL, "USAGE = %s -m <input_ninstances input_nfeatures> -n <nneurons> -l <nmax_layers> -c <ncategories> <path_to_input> <path_to_dnn> -p <parallelism_type> [-w <layer_window>] [--<net_option> <value> ...]\n", argv[0]);
         std::exit(Env::finalize());     
     }
     
@@ -101,13 +99,23 @@ int main(int argc, char **argv) {
 	
     COMPRESSED_FORMAT compression_type = COMPRESSED_FORMAT::_CSC_;
     HASHING_TYPE hashing_type = HASHING_TYPE::_NO_;
+    std::vector<std::pair<std::string, std::string>> options; // Net knobs, see Net::set_option
+    for(int i = 14; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if(flag == "-w") options.push_back(std::make_pair((std::string) "layer_window", (std::string) argv[i+1])); // Out-of-core, layers kept resident
+        else if(flag.substr(0, 2) == "--") options.push_back(std::make_pair(flag.substr(2), (std::string) argv[i+1]));
+        else {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Unknown argument %s\n", argv[i]);
+            std::exit(Env::finalize());
+        }
+    }
 
     Net<WGT> N(input_ninstances, input_nfeatures, feature_file,
 			   nneurons, nmax_layers, layer_files, 
 			   bias_value, bias_type, bias_files, 
 			   ncategories, category_type, category_file, 
-			   noop, relu, "softmax",
-			   input_type, parallelism_type, compression_type, hashing_type);
+			   ACTIVATION_TYPE::_RELU_, "softmax",
+			   input_type, parallelism_type, compression_type, hashing_type, "", options);
     
     return(Env::finalize());
 }
@@ -13,6 +13,7 @@
 #include <mpi.h>
 #include <omp.h>
 #include <thread>
+#include <atomic>
 #include <sys/sysinfo.h>
 //#include <numa.h>
 #include </ihome/rmelhem/moh18/numactl/libnuma/usr/local/include/numa.h> 
@@ -27,6 +28,11 @@ namespace Env {
     int ncores_per_socket = 0;
     int nmachines = 0;;
     int nranks_per_machine = 0;
+    int machine_id = 0; /* Index of this rank's machine, set by get_num_machines */
+    MPI_Comm machine_communicator; /* Ranks on this machine, split by machine_id */
+    int machine_rank = 0;
+    int machine_nranks = 1;
+    std::vector<MPI_Win> shared_windows; /* MPI-3 shared memory windows of the machine, freed in finalize */
     std::vector<uint32_t> nthreads_per_socket;
     int rank_core_id = 0;
     int rank_socket_id = 0;
@@ -39,6 +45,11 @@ namespace Env {
     const uint64_t L2_CACHE_SIZE = sysconf(_SC_LEVEL2_CACHE_SIZE);
     const uint64_t L3_CACHE_SIZE = sysconf(_SC_LEVEL3_CACHE_SIZE);
     bool NUMA_ALLOC = true; 
+    const int32_t INTERLEAVED = -1; /* Data_Block socket_id spreading its pages over all sockets */
+    enum PAGE_POLICY {_BASE_PAGES_, _HUGETLB_PAGES_, _THP_PAGES_};
+    const char* PAGE_POLICIES[] = {"_BASE_PAGES_", "_HUGETLB_PAGES_", "_THP_PAGES_"};
+    PAGE_POLICY page_policy = _BASE_PAGES_; /* Data_Blocks of a huge page or more come from hugetlbfs (falling back to THP) or are madvised THP */
+    uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024; /* Read from /proc/meminfo in init */
     int32_t ALL_DONE = 0;
 
     std::vector<uint32_t> thread_rowgroup;
@@ -61,6 +72,8 @@ namespace Env {
     std::vector<double> memory_allocation_time;
     std::vector<double> execution_time;
     std::vector<double> hybrid_probe_time;
+    thread_local uint64_t nremaps = 0; /* Data_Block remaps by the calling thread, */
+    thread_local uint64_t nmemset_bytes = 0; /* and bytes it cleared, see Accumulator::count_blocks */
     
     pthread_barrier_t thread_barrier;
     std::vector<pthread_barrier_t> thread_barriers;
@@ -92,6 +105,8 @@ namespace Env {
     template<typename Type>
     void stats(const std::vector<Type> vec, Type& sum, Type& mean, Type& std_dev, Type& min, Type& max);
     int get_nsockets();
+    uint64_t get_huge_page_size();
+    void get_huge_page_bytes(uint64_t& anon_huge_bytes, uint64_t& hugetlb_bytes);
     bool numa_configure();
     bool set_thread_affinity(const int32_t tid);
     int32_t get_socket_id(const int32_t tid);
@@ -115,6 +130,7 @@ namespace Env {
         uint64_t idx_nnz; /* Current index of thread pointing to where the new data will be inserted */
         uint64_t off_nnz; /* Thread Offset from the beginning of the compressed format data */ 
         uint64_t dis_nnz; /* The part that a thread may skip cuasing some internal fragmentation */
+        uint32_t nnz_vecs; /* Nonempty columns (rows) a thread stitched into a doubly compressed format */
     };
 
     struct counter_struct {
@@ -213,6 +229,21 @@ int Env::init() {
         Env::NUMA_ALLOC = false;
     }
     
+    uint64_t huge_page_size = Env::get_huge_page_size();
+    if(huge_page_size) {
+        Env::HUGE_PAGE_SIZE = huge_page_size;
+    }
+    
+    /* DNN_PAGE_POLICY=base|hugetlb|thp selects where the Data_Blocks come from, before any is allocated */
+    const char* page_policy_name = getenv("DNN_PAGE_POLICY");
+    if(page_policy_name) {
+        const std::string policy = page_policy_name;
+        if(policy == "base") Env::page_policy = PAGE_POLICY::_BASE_PAGES_;
+        else if(policy == "hugetlb") Env::page_policy = PAGE_POLICY::_HUGETLB_PAGES_;
+        else if(policy == "thp") Env::page_policy = PAGE_POLICY::_THP_PAGES_;
+        else if(Env::rank == 0) printf("WARN[rank=%d] Unknown DNN_PAGE_POLICY=%s (base, hugetlb or thp), using %s.\n", Env::rank, page_policy_name, PAGE_POLICIES[Env::page_policy]);
+    }
+    
     //thread_rowgroup.resize(Env::nthreads);
     //threads_rowgroups.resize(Env::nthreads);
     processed_rowgroups_per_thread.resize(Env::nthreads);
@@ -298,6 +329,9 @@ int Env::init() {
     
     Env::nmachines = Env::get_num_machines();
     Env::nranks_per_machine = Env::nranks / Env::nmachines; 
+    MPI_Comm_split(MPI_COMM_WORLD, Env::machine_id, Env::rank, &Env::machine_communicator);
+    MPI_Comm_rank(Env::machine_communicator, &Env::machine_rank);
+    MPI_Comm_size(Env::machine_communicator, &Env::machine_nranks);
     
     
     data_counters.resize(Env::nthreads);
@@ -343,6 +377,7 @@ int Env::get_num_machines() {
     sort(machines.begin(), machines.end());
     machines.erase(unique(machines.begin(), machines.end()), machines.end()); 
     num_machines = machines.size();
+    Env::machine_id = std::distance(machines.begin(), std::find(machines.begin(), machines.end(), machines_all[Env::rank]));
 
     return(num_machines);
 }
@@ -368,6 +403,49 @@ int Env::get_nsockets() {
     return(nsockets);
 }
 
+uint64_t Env::get_huge_page_size() {
+    FILE* fid = fopen("/proc/meminfo", "r");
+    if(not fid) {
+        return(0);
+    }
+    
+    char line[256];
+    uint64_t kbytes = 0;
+    while(fgets(line, sizeof(line), fid)) {
+        if(sscanf(line, "Hugepagesize: %lu kB", &kbytes) == 1) {
+            break;
+        }
+    }
+    fclose(fid);
+    return(kbytes * 1024);
+}
+
+/* Bytes of this process backed by transparent huge pages and by hugetlbfs pages. 
+   smaps_rollup already sums the mappings, older kernels only have the per mapping smaps. */
+void Env::get_huge_page_bytes(uint64_t& anon_huge_bytes, uint64_t& hugetlb_bytes) {
+    anon_huge_bytes = 0;
+    hugetlb_bytes = 0;
+    FILE* fid = fopen("/proc/self/smaps_rollup", "r");
+    if(not fid) {
+        fid = fopen("/proc/self/smaps", "r");
+        if(not fid) {
+            return;
+        }
+    }
+    
+    char line[256];
+    uint64_t kbytes = 0;
+    while(fgets(line, sizeof(line), fid)) {
+        if(sscanf(line, "AnonHugePages: %lu kB", &kbytes) == 1) {
+            anon_huge_bytes += kbytes * 1024;
+        }
+        else if((sscanf(line, "Shared_Hugetlb: %lu kB", &kbytes) == 1) or (sscanf(line, "Private_Hugetlb: %lu kB", &kbytes) == 1)) {
+            hugetlb_bytes += kbytes * 1024;
+        }
+    }
+    fclose(fid);
+}
+
 int32_t Env::get_socket_id(const int32_t tid) {
     return(Env::threads_core_id[tid % Env::num_unique_cores]/Env::ncores_per_socket);
 }
@@ -498,6 +576,16 @@ void Env::barrier() {
 }
 
 int Env::finalize() {
+    /* Errors hit by several threads at once (e.g. the layer loaders) finalize only once.
+       A repeated call of the finalizing thread returns its status, any other thread exits here */
+    static std::atomic_flag finalizing = ATOMIC_FLAG_INIT;
+    static pthread_t finalizer;
+    static int status = 0;
+    if(finalizing.test_and_set()) {
+        if(pthread_equal(finalizer, pthread_self())) return(status);
+        pthread_exit(nullptr);
+    }
+    finalizer = pthread_self();
     //destroy_mpi_asynch_shared_mem(&Env::window);
     
     for(int32_t i = 0; i < Env::nthreads; i++) {
@@ -510,10 +598,16 @@ int Env::finalize() {
     
     destroy_mpi_asynch_shared_mem<int32_t>(&Env::idle_ranks, &Env::ranks_window);
     
+    for(MPI_Win& window: Env::shared_windows) {
+        MPI_Win_free(&window);
+    }
+    MPI_Comm_free(&Env::machine_communicator);
+    
     MPI_Barrier(MPI_COMM_WORLD);
 
     int ret = MPI_Finalize();
-    return((ret == MPI_SUCCESS) ? 0 : 1);
+    status = (ret == MPI_SUCCESS) ? 0 : 1;
+    return(status);
 }
 
 uint64_t Env::adjust_nnz(const int32_t leader_tid, const int32_t tid) {
@@ -19,6 +19,8 @@ class ReversibleHasher {
         virtual ~ReversibleHasher() {}
         virtual long hash(long v) const = 0;
         virtual long unhash(long v) const = 0;
+        // Hash n values laid stride bytes apart in place, e.g. the rows of an array of triples
+        virtual void hash(uint32_t* v, const uint64_t n, const uint64_t stride) const = 0;
 };
 
 class NullHasher : public ReversibleHasher {
@@ -26,6 +28,7 @@ class NullHasher : public ReversibleHasher {
         NullHasher() {}
         long   hash(long v) const {return v;}
         long unhash(long v) const {return v;}
+        void hash(uint32_t* v, const uint64_t n, const uint64_t stride) const {}
 };
 
 class SimpleBucketHasher : public ReversibleHasher {
@@ -58,13 +61,22 @@ class SimpleBucketHasher : public ReversibleHasher {
             long row = v % height;
             return col + row * nparts;
         }
+        
+        void hash(uint32_t* v, const uint64_t n, const uint64_t stride) const
+        {
+            char* p = (char*) v;
+            for(uint64_t i = 0; i < n; i++, p += stride) {
+                uint32_t& x = *((uint32_t*) p);
+                if(x < max_range) x = (x / nparts) + (x % nparts) * height;
+            }
+        }
 };
 
 
 struct TwoDHasher {
     public:
         TwoDHasher(HASHING_TYPE hashing_type, bool is_input, long nrows, long ncols, long nbuckets_rows, long nbuckets_cols) {
-            
+            TwoDHasher::hashing_type = hashing_type;
             if(hashing_type == HASHING_TYPE::_NO_) {
                 hasher_r = std::move(std::make_unique<NullHasher>());
                 hasher_c = std::move(std::make_unique<NullHasher>());
@@ -96,6 +108,7 @@ struct TwoDHasher {
         };
         
         ~TwoDHasher(){}
+        HASHING_TYPE hashing_type;
         std::unique_ptr<ReversibleHasher> hasher_r = nullptr;
         std::unique_ptr<ReversibleHasher> hasher_c = nullptr;
 };
@@ -10,6 +10,9 @@
 #include <fstream>
 #include <sstream>
 #include <tuple>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "env.hpp"
 #include "log.hpp"
@@ -18,76 +21,99 @@
 enum INPUT_TYPE {_TEXT_, _BINARY_};
 enum VALUE_TYPE {_CONSTANT_, _NONZERO_INSTANCES_ONLY_, _INSTANCE_AND_VALUE_PAIRS_};
 
+/* A model bundle holds the layers (as stored tiles, see Tile::store), bias files and category file of 
+   a network behind an index, so a run opens one file instead of one or two per layer.
+   Layout: header, nentries entries, then the payloads each at a BUNDLE_ALIGNMENT offset.
+   Bias and category payloads are the binary files as they are, they are hashed when read. */
+enum BUNDLE_ENTRY {_LAYER_ENTRY_, _BIAS_ENTRY_, _CATEGORY_ENTRY_};
+const char* BUNDLE_ENTRIES[] = {"_LAYER_ENTRY_", "_BIAS_ENTRY_", "_CATEGORY_ENTRY_"};
+struct Bundle_Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nentries;
+};
+struct Bundle_Entry {
+    uint32_t type;
+    uint32_t index;
+    uint64_t offset;
+    uint64_t nbytes;
+};
+const char BUNDLE_MAGIC[8] = "SPDNNBN";
+const uint32_t BUNDLE_VERSION = 1;
+const uint64_t BUNDLE_ALIGNMENT = 64;
+
 namespace IO {
+    uint64_t get_file_size(const std::string input_file);
+    std::string compressed_file(const std::string input_file, const COMPRESSED_FORMAT compression_type);
 	template<typename Weight>
-    uint64_t get_nnzs(const std::string input_file, const INPUT_TYPE input_type, const std::shared_ptr<struct TwoDHasher> hasher, const uint32_t nrows);
+    const struct Triple<Weight>* map_file(const std::string input_file, uint64_t& file_size);
 	template<typename Weight>
     std::vector<struct Triple<Weight>> read_file_ijw(const std::string input_file, const INPUT_TYPE input_type, std::shared_ptr<struct TwoDHasher> hasher, bool one_rank, const uint32_t nrows, const uint32_t ncols);
 	template<typename Weight>
     uint32_t read_file_iv(const std::string input_file, const INPUT_TYPE input_type, const std::shared_ptr<struct TwoDHasher> hasher, const bool dimension, const VALUE_TYPE value_type, std::vector<Weight>& values, const uint32_t nrows);
+    int open_bundle(const std::string bundle_file, std::vector<struct Bundle_Entry>& entries);
+    struct Bundle_Entry bundle_entry(const std::vector<struct Bundle_Entry>& entries, const BUNDLE_ENTRY type, const uint32_t index);
+    void write_bundle(const std::string bundle_file, const std::vector<std::tuple<BUNDLE_ENTRY, uint32_t, std::string>>& files);
+	template<typename Weight>
+    uint32_t read_bundle_iv(const int fd, const struct Bundle_Entry& entry, const std::shared_ptr<struct TwoDHasher> hasher, const bool dimension, const VALUE_TYPE value_type, std::vector<Weight>& values, const uint32_t nrows);
+}
+
+uint64_t IO::get_file_size(const std::string input_file) {
+    struct stat st;
+    if(stat(input_file.c_str(), &st)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
+        std::exit(Env::finalize());
+    }
+    return(st.st_size);
+}
+
+/* The pre-compressed tile next to a triples file, e.g. n1024-l1.bin -> n1024-l1.csc (empty for formats that are not stored) */
+std::string IO::compressed_file(const std::string input_file, const COMPRESSED_FORMAT compression_type) {
+    std::string extension;
+    if(compression_type == COMPRESSED_FORMAT::_CSC_) extension = ".csc";
+    else if(compression_type == COMPRESSED_FORMAT::_CSR_) extension = ".csr";
+    else return("");
+    size_t dot = input_file.find_last_of('.');
+    size_t slash = input_file.find_last_of('/');
+    if((dot == std::string::npos) or ((slash != std::string::npos) and (dot < slash))) return(input_file + extension);
+    return(input_file.substr(0, dot) + extension);
 }
 
+/* Map a binary file of triples read only, the readers walk it once front to back */
 template<typename Weight>
-uint64_t IO::get_nnzs(const std::string input_file, const INPUT_TYPE input_type, const std::shared_ptr<struct TwoDHasher> hasher, const uint32_t nrows) {
-	Logging::print(Logging::LOG_LEVEL::INFO, "Get nnzs: Start counting nnzs from file %s\n", input_file.c_str());
-	uint64_t ninput_nnzs = 0;
+const struct Triple<Weight>* IO::map_file(const std::string input_file, uint64_t& file_size) {
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if(fd == -1) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
+        std::exit(Env::finalize());
+    }
     
-	if(input_type == INPUT_TYPE::_TEXT_) {
-		std::ifstream fin(input_file.c_str(), std::ios_base::in);
-		if(not fin.is_open()) {
-			Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
-			std::exit(Env::finalize());
-		}
-		
-		struct Triple<Weight> triple;
-		std::string line;
-		std::istringstream iss;
-		while (std::getline(fin, line)) {
-			iss.clear();
-			iss.str(line);
-			iss >> triple.row >> triple.col >> triple.weight;
-			triple.row = hasher->hasher_r->hash(triple.row);
-			ninput_nnzs += (triple.row < nrows) ? 1 : 0;
-		}
-		fin.close();
-	}
-	else if(input_type == INPUT_TYPE::_BINARY_) {
-		std::ifstream fin(input_file.c_str(), std::ios_base::binary);
-		if(not fin.is_open()) {
-			Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
-			std::exit(Env::finalize());
-		}
-		
-		uint64_t file_size, offset = 0;
-		fin.seekg (0, std::ios_base::end);
-		file_size = (uint64_t) fin.tellg();
-		fin.seekg(0, std::ios_base::beg);
-		
-		if(file_size % sizeof(struct Triple<Weight>)) {
-			Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s\n", input_file.c_str());
-			std::exit(Env::finalize());
-		}
-		
-		struct Triple<Weight> triple;
-		while(offset < file_size) {
-			fin.read(reinterpret_cast<char*>(&triple), sizeof(struct Triple<Weight>));
-			offset += sizeof(struct Triple<Weight>);
-			triple.row = hasher->hasher_r->hash(triple.row);
-			ninput_nnzs += (triple.row < nrows) ? 1 : 0;
-		}
-		fin.close();
-	}
-    Logging::print(Logging::LOG_LEVEL::INFO, "Get nnzs: Done counting nnzs from file %s, nnzs=%lu\n", input_file.c_str(), ninput_nnzs);
-    Env::barrier();
+    file_size = get_file_size(input_file);
+    if(file_size % sizeof(struct Triple<Weight>)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s\n", input_file.c_str());
+        std::exit(Env::finalize());
+    }
     
-	return ninput_nnzs;
+    void* data = nullptr;
+    if(file_size) {
+        if((data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Cannot mmap %s\n", input_file.c_str());
+            std::exit(Env::finalize());
+        }
+        madvise(data, file_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return((const struct Triple<Weight>*) data);
 }
 
 template<typename Weight>
 std::vector<struct Triple<Weight>> IO::read_file_ijw(const std::string input_file, const INPUT_TYPE input_type, std::shared_ptr<struct TwoDHasher> hasher, bool one_rank, const uint32_t nrows,  const uint32_t ncols) {
     Logging::print(Logging::LOG_LEVEL::INFO, "Read file: Start reading the input file %s\n", input_file.c_str());
+	double start_time = Env::tic();
 	std::vector<struct Triple<Weight>> triples;
-	std::vector<std::vector<struct Triple<Weight>>> triples1(Env::nthreads);
+	const int32_t nthreads = (omp_in_parallel()) ? 1 : std::min(Env::nthreads, omp_get_max_threads()); // Layers loaded concurrently or in the background read alone
+	std::vector<std::vector<struct Triple<Weight>>> triples1(nthreads);
+	uint64_t nbytes = 0; /* Of this rank's share */
 	if(input_type == INPUT_TYPE::_TEXT_) {
 		std::ifstream fin(input_file.c_str(), std::ios_base::in);
 		if(not fin.is_open()) {
@@ -123,15 +149,14 @@ std::vector<struct Triple<Weight>> IO::read_file_ijw(const std::string input_fil
 			fin.seekg(0, std::ios_base::beg);
 		}
 		
-		#pragma omp parallel
+		#pragma omp parallel num_threads(nthreads) reduction(+:nbytes)
 		{
-			int nthreads = Env::nthreads; 
 			int tid = omp_get_thread_num();
 			
 			uint64_t share_t = share / nthreads; 
 			uint64_t start_line_t = curr_line + (tid * share_t);
-			uint64_t end_line_t = (tid != Env::nthreads - 1) ? curr_line + ((tid + 1) * share_t) : end_line;
-			share_t = (tid == Env::nthreads - 1) ? end_line_t - start_line_t : share_t;
+			uint64_t end_line_t = (tid != nthreads - 1) ? curr_line + ((tid + 1) * share_t) : end_line;
+			share_t = (tid == nthreads - 1) ? end_line_t - start_line_t : share_t;
 			uint64_t curr_line_t = 0;
 			std::string line_t;
 			std::ifstream fin_t(input_file.c_str());
@@ -151,6 +176,7 @@ std::vector<struct Triple<Weight>> IO::read_file_ijw(const std::string input_fil
 			std::istringstream iss_t;
 			while (curr_line_t < end_line_t) {
 				std::getline(fin_t, line_t);
+				nbytes += line_t.size() + 1;
 				iss_t.clear();
 				iss_t.str(line_t);
 				iss_t >> triple.row >> triple.col >> triple.weight;
@@ -167,78 +193,62 @@ std::vector<struct Triple<Weight>> IO::read_file_ijw(const std::string input_fil
 			fin_t.close();
 		}
 		fin.close();
+		for(auto& triple1: triples1) triples.insert(triples.end(), triple1.begin(), triple1.end());
 	}
 	else if(input_type == INPUT_TYPE::_BINARY_) {
-		std::ifstream fin(input_file.c_str(), std::ios_base::binary);
-		if(not fin.is_open()) {
-			Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
-			std::exit(Env::finalize());
-		}
-		
-		uint64_t file_size, offset = 0;
-		fin.seekg (0, std::ios_base::end);
-		file_size = (uint64_t) fin.tellg();
-		fin.clear();
-		fin.close();
-		
-		if(file_size % sizeof(struct Triple<Weight>)) {
-			Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s\n", input_file.c_str());
-			std::exit(Env::finalize());
-		}
-		
+		uint64_t file_size = 0;
+		const struct Triple<Weight>* file_triples = map_file<Weight>(input_file, file_size);
 		uint64_t nTriples = file_size / sizeof(struct Triple<Weight>);
 		Logging::print(Logging::LOG_LEVEL::INFO, "Read file: File size is %lu bytes with %lu triples\n", file_size, nTriples);
 		
-		uint64_t share = (nTriples / Env::nranks) * sizeof(struct Triple<Weight>);
-		
-		uint64_t start_offset = Env::rank * share;
-		uint64_t end_offset = (Env::rank != Env::nranks - 1) ? ((Env::rank + 1) * share) : file_size;
-		share = (Env::rank == Env::nranks - 1) ? end_offset - start_offset : share;
-		uint64_t share_tripels = share/sizeof(struct Triple<Weight>);
-
+		uint64_t share = nTriples / Env::nranks;
+		uint64_t start = Env::rank * share;
+		uint64_t end = (Env::rank != Env::nranks - 1) ? ((Env::rank + 1) * share) : nTriples;
 		if(one_rank) {
-			share = file_size;
-			start_offset = 0;
-			end_offset = file_size;
-			share_tripels = share/sizeof(struct Triple<Weight>);
+			start = 0;
+			end = nTriples;
 		}
+		share = end - start;
+		nbytes = share * sizeof(struct Triple<Weight>);
 		
-		#pragma omp parallel
+		/* Every thread copies its range of the mapped file straight into its part of triples,
+		   hashes it in bulk and squeezes out the rows beyond nrows, then the parts are closed up */
+		triples.resize(share);
+		std::vector<uint64_t> starts_t(nthreads + 1);
+		for(int32_t t = 0; t < nthreads; t++) starts_t[t] = t * (share / nthreads);
+		starts_t[nthreads] = share;
+		std::vector<uint64_t> nkept_t(nthreads);
+		#pragma omp parallel num_threads(nthreads)
 		{
-			int nthreads = Env::nthreads; 
 			int tid = omp_get_thread_num();
-			uint64_t nTriples_t = share / sizeof(struct Triple<Weight>);
-			uint64_t share_t = (nTriples_t / nthreads) * sizeof(struct Triple<Weight>); 
-			uint64_t start_offset_t = start_offset + (tid * share_t);
-			uint64_t end_offset_t = (tid != Env::nthreads - 1) ? start_offset + ((tid + 1) * share_t) : end_offset;
-			share_t = (tid == Env::nthreads - 1) ? end_offset_t - start_offset_t : share_t;
-			uint64_t offset_t = start_offset_t;
-
-			std::ifstream fin_t(input_file.c_str(), std::ios_base::binary);
-			if(not fin_t.is_open()) {
-				Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", input_file.c_str());
-				std::exit(Env::finalize());
+			const uint64_t n = starts_t[tid + 1] - starts_t[tid];
+			struct Triple<Weight>* triples_t = triples.data() + starts_t[tid];
+			if(n) {
+				memcpy(triples_t, file_triples + start + starts_t[tid], n * sizeof(struct Triple<Weight>));
+				hasher->hasher_r->hash(&triples_t->row, n, sizeof(struct Triple<Weight>));
+				hasher->hasher_c->hash(&triples_t->col, n, sizeof(struct Triple<Weight>));
 			}
-			fin_t.seekg(offset_t, std::ios_base::beg);
-			
-			struct Triple<Weight> triple;
-			while(offset_t < end_offset_t) {
-				fin_t.read(reinterpret_cast<char*>(&triple), sizeof(struct Triple<Weight>));
-				triple.row = hasher->hasher_r->hash(triple.row);
-				triple.col = hasher->hasher_c->hash(triple.col);
-				if(triple.col >= ncols) {
+			uint64_t k = 0;
+			for(uint64_t i = 0; i < n; i++) {
+				if(triples_t[i].col >= ncols) {
 					Logging::print(Logging::LOG_LEVEL::ERROR, "Incorret file dimensions [%dx%d]\n", nrows, ncols); 
 					std::exit(Env::finalize());
 				}
-				if(triple.row < nrows) triples1[tid].push_back(triple);
-				offset_t += sizeof(struct Triple<Weight>);
+				if(triples_t[i].row < nrows) triples_t[k++] = triples_t[i];
 			}
-			fin_t.close();
+			nkept_t[tid] = k;
+		}
+		uint64_t nkept = nkept_t[0];
+		for(int32_t t = 1; t < nthreads; t++) {
+			if(nkept != starts_t[t]) memmove(triples.data() + nkept, triples.data() + starts_t[t], nkept_t[t] * sizeof(struct Triple<Weight>));
+			nkept += nkept_t[t];
 		}
+		triples.resize(nkept);
+		if(file_size) munmap((void*) file_triples, file_size);
 	}
-    for(auto& triple1: triples1) triples.insert(triples.end(), triple1.begin(), triple1.end());
-	Logging::print(Logging::LOG_LEVEL::INFO, "Read file: Done reading the input file %s\n", input_file.c_str());
-	Env::barrier(); 
+	double read_time = Env::toc(start_time);
+	Logging::print(Logging::LOG_LEVEL::INFO, "Read file: Done reading the input file %s (%.1f MB at %.1f MB/s)\n", input_file.c_str(), nbytes / 1e6, (nbytes / 1e6) / read_time);
+	if(not one_rank) Env::barrier(); 
 	
     return(triples);
 }
@@ -354,4 +364,117 @@ uint32_t IO::read_file_iv(const std::string input_file, const INPUT_TYPE input_t
     Env::barrier();
     return(ninstances);	
 }  
+
+/* Open a bundle and read its index, the file stays open for the file-backed blocks to map */
+int IO::open_bundle(const std::string bundle_file, std::vector<struct Bundle_Entry>& entries) {
+    Logging::print(Logging::LOG_LEVEL::INFO, "Read bundle: Opening %s\n", bundle_file.c_str());
+    int fd = open(bundle_file.c_str(), O_RDONLY);
+    if(fd == -1) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", bundle_file.c_str());
+        std::exit(Env::finalize());
+    }
+    
+    struct Bundle_Header header = {};
+    if((pread(fd, &header, sizeof(struct Bundle_Header), 0) != sizeof(struct Bundle_Header)) or memcmp(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) or (header.version != BUNDLE_VERSION)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "%s is not a model bundle\n", bundle_file.c_str());
+        std::exit(Env::finalize());
+    }
+    entries.resize(header.nentries);
+    uint64_t nbytes = header.nentries * sizeof(struct Bundle_Entry);
+    if(pread(fd, entries.data(), nbytes, sizeof(struct Bundle_Header)) != (ssize_t) nbytes) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s\n", bundle_file.c_str());
+        std::exit(Env::finalize());
+    }
+    uint64_t file_size = get_file_size(bundle_file);
+    for(auto& entry: entries) {
+        if((entry.type > BUNDLE_ENTRY::_CATEGORY_ENTRY_) or ((entry.offset + entry.nbytes) > file_size)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s\n", bundle_file.c_str());
+            std::exit(Env::finalize());
+        }
+    }
+    Logging::print(Logging::LOG_LEVEL::INFO, "Read bundle: %lu entries, %.1f MB\n", entries.size(), file_size / 1e6);
+    return(fd);
+}
+
+struct Bundle_Entry IO::bundle_entry(const std::vector<struct Bundle_Entry>& entries, const BUNDLE_ENTRY type, const uint32_t index) {
+    for(auto& entry: entries) {
+        if((entry.type == type) and (entry.index == index)) return(entry);
+    }
+    Logging::print(Logging::LOG_LEVEL::ERROR, "Bundle has no %s %d\n", BUNDLE_ENTRIES[type], index);
+    std::exit(Env::finalize());
+}
+
+/* Concatenate (type, index, file) into a bundle, layers are the files written by Tile::store */
+void IO::write_bundle(const std::string bundle_file, const std::vector<std::tuple<BUNDLE_ENTRY, uint32_t, std::string>>& files) {
+    struct Bundle_Header header = {};
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.version = BUNDLE_VERSION;
+    header.nentries = files.size();
+    
+    std::vector<struct Bundle_Entry> entries(files.size());
+    uint64_t offset = sizeof(struct Bundle_Header) + (files.size() * sizeof(struct Bundle_Entry));
+    for(uint32_t i = 0; i < files.size(); i++) {
+        offset += (offset % BUNDLE_ALIGNMENT) ? (BUNDLE_ALIGNMENT - (offset % BUNDLE_ALIGNMENT)) : 0;
+        entries[i].type = std::get<0>(files[i]);
+        entries[i].index = std::get<1>(files[i]);
+        entries[i].offset = offset;
+        entries[i].nbytes = get_file_size(std::get<2>(files[i]));
+        offset += entries[i].nbytes;
+    }
+    
+    std::ofstream fout(bundle_file.c_str(), std::ios_base::binary);
+    if(not fout.is_open()) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", bundle_file.c_str());
+        std::exit(Env::finalize());
+    }
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(struct Bundle_Header));
+    fout.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(struct Bundle_Entry));
+    for(uint32_t i = 0; i < files.size(); i++) {
+        std::ifstream fin(std::get<2>(files[i]).c_str(), std::ios_base::binary);
+        if(not fin.is_open()) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", std::get<2>(files[i]).c_str());
+            std::exit(Env::finalize());
+        }
+        while((uint64_t) fout.tellp() < entries[i].offset) fout.put(0);
+        if(entries[i].nbytes) fout << fin.rdbuf();
+        if((uint64_t) fout.tellp() != (entries[i].offset + entries[i].nbytes)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Writing %s\n", bundle_file.c_str());
+            std::exit(Env::finalize());
+        }
+    }
+    fout.close();
+    if(fout.fail()) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Writing %s\n", bundle_file.c_str());
+        std::exit(Env::finalize());
+    }
+}
+
+/* read_file_iv over the binary file held by a bundle entry, read in place from a file-backed block */
+template<typename Weight>
+uint32_t IO::read_bundle_iv(const int fd, const struct Bundle_Entry& entry, const std::shared_ptr<struct TwoDHasher> hasher, const bool dimension, const VALUE_TYPE value_type, std::vector<Weight>& values, const uint32_t nrows) {
+    values.resize(nrows);
+    uint32_t ninstances = 0;
+    uint32_t instance = 0;
+    Weight value = 0;
+    const uint64_t item_size = (value_type == VALUE_TYPE::_NONZERO_INSTANCES_ONLY_) ? sizeof(uint32_t) : (sizeof(uint32_t) + sizeof(Weight));
+    if(entry.nbytes % item_size) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Reading %s %d\n", BUNDLE_ENTRIES[entry.type], entry.index);
+        std::exit(Env::finalize());
+    }
+    
+    struct Data_Block<char> data(fd, entry.offset, entry.nbytes);
+    for(uint64_t offset = 0; offset < entry.nbytes; offset += item_size) {
+        memcpy(&instance, data.ptr + offset, sizeof(uint32_t));
+        if(dimension) { instance = hasher->hasher_r->hash(instance); }
+        else { instance = hasher->hasher_c->hash(instance); }
+        if(value_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) memcpy(&value, data.ptr + offset + sizeof(uint32_t), sizeof(Weight));
+        if(instance < nrows) {
+            values[instance] = (value_type == VALUE_TYPE::_NONZERO_INSTANCES_ONLY_) ? 1 : value;
+            ninstances++;
+        }
+    }
+    if(value_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) ninstances=std::max(ninstances, nrows); // Take account of zero
+    Logging::print(Logging::LOG_LEVEL::INFO, "Read bundle: Total number of instances %d\n", ninstances);
+    return(ninstances);
+}
 #endif
\ No newline at end of file
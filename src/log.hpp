@@ -13,6 +13,7 @@
 
 namespace Logging {
     bool enabled = false;
+    thread_local bool muted = false; /* Silences the calling thread only, e.g. the streaming layer loader */
     const bool print_at_rank_zero = true;
     enum LOG_LEVEL {VOID, TRACE, DEBUG, INFO, WARN, ERROR, FATAL};
     const char* LOG_LEVELS[] = {"VOID", "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
@@ -20,7 +21,7 @@ namespace Logging {
 }
 
 void Logging::print(const int log_level, const char* format, ...) {
-    if(enabled) {
+    if(enabled and not muted) {
         if((print_at_rank_zero and !Env::rank) or 
            (not print_at_rank_zero) or
            (print_at_rank_zero and !strncmp(Logging::LOG_LEVELS[log_level], LOG_LEVELS[ERROR], 4))) {
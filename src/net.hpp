@@ -11,6 +11,7 @@
 #include "tiling.hpp"
 #include "spops.hpp"
 #include <deque>
+#include <atomic>
 #include "hashers.hpp"
 
 /* Input x layers */
@@ -20,6 +21,10 @@ const char* PARALLELISM_TYPES[] = {"_DATA_X_MODEL_", "_DATA_X_DATA_", "_HYBRID_X
 enum SCHEDULING_TYPE {_EARLIEST_FIRST_, _SLOWER_FIRST_, _FASTER_FIRST_, _NONE_};
 const char* SCHEDULING_TYPES[] = {"_EARLIEST_FIRST_", "_SLOWER_FIRST_", "_FASTER_FIRST_", "_NONE_"};
 
+/* Phases of the Net constructor timed for printStartupTimes */
+enum STARTUP_PHASE {_INPUT_PHASE_, _CATEGORY_PHASE_, _LAYER_PHASE_, _BIAS_PHASE_, _SETUP_PHASE_, _NPHASES_};
+const char* STARTUP_PHASES[] = {"input", "categories", "layers", "biases", "setup"};
+
 template<typename Weight>
 class Net {
     public:
@@ -30,20 +35,25 @@ class Net {
 			const uint32_t nneurons_, const uint32_t nmax_layers_, const  std::vector<std::string> layer_files,
             const Weight bias_value, const VALUE_TYPE bias_type, const std::vector<std::string> bias_files,
 			const uint32_t ncategories, const VALUE_TYPE category_type_, const  std::string category_file, 
-			Weight(*noop_function_)(Weight),
-			Weight(*activation_function_)(Weight),
+			const ACTIVATION_TYPE activation_type_,
 			const std::string classifier_,
 			const INPUT_TYPE input_type = INPUT_TYPE::_BINARY_,
             const PARALLELISM_TYPE parallelism_type_  = PARALLELISM_TYPE::_HYBRID_X_HYBRID_,
             const COMPRESSED_FORMAT compression_type_ = COMPRESSED_FORMAT::_CSR_,
-            const HASHING_TYPE hashing_type_ = HASHING_TYPE::_BOTH_);
+            const HASHING_TYPE hashing_type_ = HASHING_TYPE::_BOTH_,
+            const std::string bundle_file = "",
+            const std::vector<std::pair<std::string, std::string>> options = {});
 
         std::unique_ptr<struct Tiling<Weight>> input_features = nullptr;
         std::vector<uint32_t> true_categories;
         std::vector<std::unique_ptr<struct Tiling<Weight>>> layers;
         
         std::vector<std::shared_ptr<struct Data_Block<Weight>>> bias_vectors;
-        std::vector<std::shared_ptr<struct Data_Block<Weight>>> spa_vectors;
+        std::vector<std::shared_ptr<struct Accumulator<Weight>>> accumulators;
+        std::vector<std::shared_ptr<struct Compressed_Format<Weight>>> output_segments;
+        std::vector<std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>> layer_replicas; /* [socket][layer], empty unless socket_replicas fit */
+        std::vector<std::vector<uint32_t>> row_maps; /* Tile rows of the live rows of each rowgroup once compacted */
+        std::vector<std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>> row_blocks; /* Per thread scratch of the temporal blocking */
         
         std::unique_ptr<struct Tiling<Weight>> output = nullptr;
 		
@@ -55,8 +65,8 @@ class Net {
         uint32_t ncategories = 0;
 		VALUE_TYPE category_type = VALUE_TYPE::_NONZERO_INSTANCES_ONLY_;
 		
-		Weight (*noop_function)(Weight);
-		Weight (*activation_function)(Weight);
+		ACTIVATION_TYPE activation_type = ACTIVATION_TYPE::_RELU_;
+		void (Net<Weight>::*inference_function)(const int32_t tid) = nullptr; /* inferenceReLU instantiated for activation_type */
 		std::string classifier;
 		
 		uint32_t predicted_nistances;
@@ -68,8 +78,25 @@ class Net {
         bool numa_queues = true;
         uint32_t schduling_threshold = 4;
         
-        COMPRESSED_FORMAT compression_type = COMPRESSED_FORMAT::_CSC_;
-        //bool dual_spmat = false;
+        COMPRESSED_FORMAT compression_type = COMPRESSED_FORMAT::_CSC_; /* Layers and the orientation of the kernels */
+        COMPRESSED_FORMAT activation_compression_type = COMPRESSED_FORMAT::_CSC_; /* Input features and outputs, may be doubly compressed */
+        bool fused_spmm = false; /* Single-pass SpMM instead of spmm_symb + spmm_real */
+        bool layer_stats = false; /* Print the accumulator, block, direction and live row counters per layer, not only their totals */
+        bool row_compaction = false; /* Drop the dead (all zero) instances of a rowgroup after every layer, they never come back */
+        bool row_strips = false; /* Split the activation into L2 sized row strips inside the CSC kernels when it does not fit */
+        uint32_t strip_nrows = 0; /* Rows of a strip, 0 derives them from Env::L2_CACHE_SIZE */
+        bool dense_activations = false; /* Let data_x_data switch a rowgroup between CSC and dense as its density crosses the thresholds below */
+        float dense_threshold = .3; /* Go dense above this nnz/(nrows*ncols) */
+        float sparse_threshold = .2; /* and back to CSC below this one */
+        uint32_t temporal_layers = 0; /* Push L2 sized row blocks of a rowgroup through this many layers at a time in data_x_data, 0 or 1 disables */
+        bool dual_spmat = false; /* Keep a CSR copy of the CSC layers, so the CSC kernels can pull when few neurons are active */
+        bool shared_layers = false; /* One copy of the CSC layers per machine in an MPI shared window, loaded by its first rank */
+        bool socket_replicas = false; /* Copy the CSC layers onto every socket so threads read their weights locally, */
+        double replica_budget = .5; /* if all copies take at most this fraction of each socket's free memory, else interleave the layers */
+        uint32_t layer_loaders = 0; /* Threads reading and compressing layers concurrently, 0 uses all Env::nthreads and 1 loads them in order */
+        bool streaming_layers = false; /* Load the layers in order on a background thread while the inference starts, threads only wait on layers not loaded yet */
+        uint32_t layer_window = 0; /* Out-of-core: stream the layers keeping at most this many resident, evicting the ones every thread is done with, */
+                                   /* 0 keeps them all. Needs rowgroups advancing layer by layer (data_x_model or data_x_data) */
         float recruiting_ratio = .3;
         
         HASHING_TYPE hashing_type = HASHING_TYPE::_BOTH_; 
@@ -81,15 +108,53 @@ class Net {
         void printTimesExcel();
 
         void printTimesExcel1();
+        void printAccumulators();
+        void printHugePages();
+        void printStartupTimes();
+        void set_option(const std::string name, const std::string value);
+        std::vector<double> startup_times = std::vector<double>(STARTUP_PHASE::_NPHASES_);
+        void printStreamingTimes();
+        std::atomic<uint32_t> nlayers_ready{0}; /* Layers [0, nlayers_ready) are loaded, all of them unless streaming_layers */
+        double streaming_time = 0; /* Time of the background loader, */
+        std::vector<double> layer_wait_times; /* and per thread time blocked on it */
+        std::vector<uint32_t> layer_waits; /* Per thread layers it had to wait for */
+        void wait_layer(const uint32_t l, const int32_t tid);
+        std::vector<std::atomic<uint32_t>> layers_done; /* Per thread layers finished, the window slides past the slowest thread */
+        uint32_t nlayers_evicted = 0;
+        uint32_t peak_resident_layers = 0;
+        uint64_t resident_bytes = 0;
+        uint64_t peak_resident_bytes = 0;
+        double window_stall_time = 0; /* Loader time waiting for room in the window */
+        uint32_t evict_layers();
+        inline void release_layers(const uint32_t nlayers, const int32_t tid) {
+            if(layer_window) layers_done[tid].store(nlayers, std::memory_order_release);
+        }
+        void replicate_layers();
+        void share_layers();
+        inline std::shared_ptr<struct Compressed_Format<Weight>>& layer_spmat(const uint32_t l, const int32_t tid) {
+            if(nlayers_ready.load(std::memory_order_acquire) <= l) wait_layer(l, tid);
+            return((layer_replicas.empty()) ? layers[l]->tiles[0][0].spmat : layer_replicas[Env::threads_socket_id[tid]][l]);
+        }
         void execute();
+        template<typename Activation>
         void inferenceReLU(const int32_t tid);
         
+        template<typename Activation>
         void data_x_model(const int32_t tid);
+        template<typename Activation>
         void data_x_data(const int32_t tid);
+        void switch_activation(std::shared_ptr<struct Compressed_Format<Weight>>& spmat, const bool to_csc);
+        template<typename Activation>
+        uint32_t data_x_data_blocked(const uint32_t leader_rowgroup, const uint32_t first_layer, const int32_t tid);
+        template<typename Activation>
         void hybrid_x_hybrid(const int32_t tid);
+        template<typename Activation>
         void manager_x_worker(const int32_t tid);
+        template<typename Activation>
         void work_x_stealing(const int32_t tid);
+        template<typename Activation>
         uint32_t hybrid_x_data(std::deque<int32_t>& leader_owned_threads, const int32_t my_rowgroup, const int32_t tid);
+		template<typename Activation>
 		void hybrid_x_model(std::deque<int32_t>& leader_owned_threads, const uint32_t leader_rowgroup, const uint32_t leader_start_layer, const uint32_t leader_current_layer, const int32_t leader_tid, const int32_t tid);
         bool add_to_idle_threads(std::deque<int32_t>& leader_owned_threads, const int32_t tid);
         bool add_to_my_follower_threads(std::deque<int32_t>& leader_owned_threads, const uint32_t leader_rowgroup, const uint32_t leader_start_layer, const uint32_t leader_current_layer, const uint32_t nrows, const uint32_t ncols, const int32_t leader, const int32_t tid);
@@ -103,14 +168,17 @@ Net<Weight>::Net(const uint32_t input_ninstanses_, const uint32_t input_nfeature
 				 const uint32_t nneurons_, const uint32_t nmax_layers_, const std::vector<std::string> layer_files,
 				 const Weight bias_value, const VALUE_TYPE bias_type, const std::vector<std::string> bias_files,
 				 const uint32_t ncategories_, const VALUE_TYPE category_type_, const std::string category_file, 
-				Weight(*noop_function_)(Weight), Weight(*activation_function_)(Weight), const std::string classifier_,
+				 const ACTIVATION_TYPE activation_type_, const std::string classifier_,
 				 const INPUT_TYPE input_type, const PARALLELISM_TYPE parallelism_type_, 
-				 const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type_)
+				 const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type_, const std::string bundle_file,
+				 const std::vector<std::pair<std::string, std::string>> options)
 				     : input_ninstanses(input_ninstanses_), input_nfeatures(input_nfeatures_), 
 					   nneurons(nneurons_), nmax_layers(nmax_layers_), ncategories(ncategories_), category_type(category_type_),
-					   noop_function(noop_function_), activation_function(activation_function_), classifier(classifier_),
-					   parallelism_type(parallelism_type_), compression_type(compression_type_), hashing_type(hashing_type_) {
+					   activation_type(activation_type_), classifier(classifier_),
+					   parallelism_type(parallelism_type_), compression_type(compression_type_), activation_compression_type(compression_type_), hashing_type(hashing_type_) {
     auto start = std::chrono::high_resolution_clock::now();
+    double phase_time = Env::tic();
+    for(auto& option: options) set_option(option.first, option.second);
 	input_ninstanses+=2;
 	input_ninstanses += (input_ninstanses % Env::nthreads) ? (Env::nthreads - (input_ninstanses % Env::nthreads)) : 0; 
 	input_nfeatures+=2;
@@ -118,87 +186,235 @@ Net<Weight>::Net(const uint32_t input_ninstanses_, const uint32_t input_nfeature
 	nneurons+=2;
 	nneurons += (nneurons % Env::nthreads) ? (Env::nthreads - (nneurons % Env::nthreads)) : 0; 
 	scheduling_type = (parallelism_type != PARALLELISM_TYPE::_HYBRID_X_HYBRID_) ? SCHEDULING_TYPE::_NONE_ : scheduling_type;
+	/* Doubly compressed formats only hold the activations, layers stay in the matching CSC or CSR */
+	if(activation_compression_type == COMPRESSED_FORMAT::_DCSC_) compression_type = COMPRESSED_FORMAT::_CSC_;
+	else if(activation_compression_type == COMPRESSED_FORMAT::_DCSR_) compression_type = COMPRESSED_FORMAT::_CSR_;
     hashers.push_back(std::move(std::make_shared<struct TwoDHasher>(hashing_type, true, input_ninstanses, input_nfeatures, 1, 1)));
-    input_nnzs = IO::get_nnzs<Weight>(feature_file, input_type, hashers[0], input_ninstanses);
 	 
 	
     if(parallelism_type == PARALLELISM_TYPE::_DATA_X_MODEL_) {
         input_features = std::move(std::make_unique<Tiling<Weight>>(Env::nranks, Env::nranks, 1, Env::nranks, 
-                                                                   input_nnzs, input_ninstanses, input_nfeatures, 
+                                                                   input_ninstanses, input_nfeatures, 
                                                                    feature_file, input_type, 
-                                                                   TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                                   TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
     }
     else if((parallelism_type == PARALLELISM_TYPE::_MANAGER_X_WORKER_) or (parallelism_type == PARALLELISM_TYPE::_WORK_X_STEALING_)) {
         input_features = std::move(std::make_unique<Tiling<Weight>>(Env::nranks * Env::nthreads * split_factor, Env::nranks * Env::nthreads * split_factor, 1, Env::nranks,
                                                                    Env::nthreads, Env::nranks * Env::nthreads, 
-                                                                   input_nnzs, input_ninstanses, input_nfeatures, 
+                                                                   input_ninstanses, input_nfeatures, 
                                                                    feature_file, input_type, 
-                                                                   TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                                   TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
        Env::threads_rowgroups = input_features->set_threads_indices();
        Env::rank_rowgroups = input_features->set_rank_indices();  
     }
     else {
         input_features = std::move(std::make_unique<Tiling<Weight>>(Env::nranks * Env::nthreads, Env::nranks * Env::nthreads, 1, Env::nranks,
                                                                    Env::nthreads, Env::nranks * Env::nthreads, 
-                                                                   input_nnzs, input_ninstanses, input_nfeatures, 
+                                                                   input_ninstanses, input_nfeatures, 
                                                                    feature_file, input_type, 
-                                                                   TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                                   TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
         Env::thread_rowgroup = input_features->set_thread_index();                                                           
     }
 	
+    input_nnzs = input_features->nnzs;
     input_ninstanses = input_features->nrows;
 	input_nfeatures = input_features->ncols;
+    startup_times[STARTUP_PHASE::_INPUT_PHASE_] = Env::toc(phase_time);
+    phase_time = Env::tic();
+    /* A model bundle replaces the layer, bias and category files, its layers stay in the file mapping */
+    std::vector<struct Bundle_Entry> bundle_entries;
+    const int bundle_fd = (bundle_file.empty()) ? -1 : IO::open_bundle(bundle_file, bundle_entries);
     Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Processing the category files for %d neurons and %d layers.\n", nneurons, nmax_layers); 
-	predicted_nistances = IO::read_file_iv<uint32_t>(category_file, input_type, hashers[0], true, category_type, true_categories, input_features->nrows);
+	if(bundle_fd != -1) predicted_nistances = IO::read_bundle_iv<uint32_t>(bundle_fd, IO::bundle_entry(bundle_entries, BUNDLE_ENTRY::_CATEGORY_ENTRY_, 0), hashers[0], true, category_type, true_categories, input_features->nrows);
+	else predicted_nistances = IO::read_file_iv<uint32_t>(category_file, input_type, hashers[0], true, category_type, true_categories, input_features->nrows);
 
     Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Processing %d layer files (silent).\n", nmax_layers); 
     //nmax_layers = 2;
 	layers.resize(nmax_layers);
 	bias_vectors.resize(nmax_layers);
     //if((parallelism_type != PARALLELISM_TYPE::_HYBRID_X_HYBRID_) and (dual_spmat == true)) dual_spmat = false;
-	uint64_t layer_nnzs = 0;
-	uint32_t layer_nrows = 0, layer_ncols = 0;
+	std::vector<uint32_t> layers_nrows(nmax_layers), layers_ncols(nmax_layers);
+    if(shared_layers and ((compression_type != COMPRESSED_FORMAT::_CSC_) or (Env::machine_nranks == 1))) {
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Shared layers need CSC layers and more than one rank per machine, every rank loads its own.\n"); 
+        shared_layers = false;
+    }
+    const bool layer_loader = (not shared_layers) or (Env::machine_rank == 0);
+    /* The layer sources are looked up here, on the main thread, as the loader threads below cannot exit */
+    std::vector<struct Bundle_Entry> layer_entries(nmax_layers);
     for(uint32_t i = 0; i < nmax_layers; i++) {
-		if(i == 0) { layer_nrows = input_nfeatures; layer_ncols = nneurons; }
-		else if(i < nmax_layers-1) { layer_nrows = nneurons; layer_ncols = nneurons; }
-		else { layer_nrows = nneurons; layer_ncols = ncategories ? ncategories : nneurons; }
-		std::string layer_file = layer_files[i];
-		hashers.push_back(std::move(std::make_shared<struct TwoDHasher>(hashing_type, false, layer_nrows, layer_ncols, 1, 1)));
-		layer_nnzs = IO::get_nnzs<Weight>(layer_file, input_type, hashers[i+1], layer_nrows);
-		layers[i] = std::move(std::make_unique<Tiling<Weight>>(1, 1, 1, 1, 
-															   layer_nnzs, layer_nrows, layer_ncols, 
-															   layer_file, input_type, 
-															   TILING_TYPE::_1D_COL_, compression_type, hashers[i+1]));
+		if(i == 0) { layers_nrows[i] = input_nfeatures; layers_ncols[i] = nneurons; }
+		else if(i < nmax_layers-1) { layers_nrows[i] = nneurons; layers_ncols[i] = nneurons; }
+		else { layers_nrows[i] = nneurons; layers_ncols[i] = ncategories ? ncategories : nneurons; }
+		hashers.push_back(std::move(std::make_shared<struct TwoDHasher>(hashing_type, false, layers_nrows[i], layers_ncols[i], 1, 1)));
+		if(layer_loader and (bundle_fd != -1)) layer_entries[i] = IO::bundle_entry(bundle_entries, BUNDLE_ENTRY::_LAYER_ENTRY_, i);
+		else if(layer_loader and access(IO::compressed_file(layer_files[i], compression_type).c_str(), R_OK)) IO::get_file_size(layer_files[i]);
+    }
+    startup_times[STARTUP_PHASE::_CATEGORY_PHASE_] = Env::toc(phase_time);
+    phase_time = Env::tic();
+    
+    if(layer_window and (parallelism_type != PARALLELISM_TYPE::_DATA_X_MODEL_) and (parallelism_type != PARALLELISM_TYPE::_DATA_X_DATA_)) {
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: A layer window needs rowgroups advancing layer by layer (%s or %s), keeping all the layers.\n", PARALLELISM_TYPES[PARALLELISM_TYPE::_DATA_X_MODEL_], PARALLELISM_TYPES[PARALLELISM_TYPE::_DATA_X_DATA_]); 
+        layer_window = 0;
+    }
+    if(layer_window and (layer_window < temporal_layers)) {
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Widening the layer window from %d to the %d temporal layers.\n", layer_window, temporal_layers); 
+        layer_window = temporal_layers;
+    }
+    if(layer_window) streaming_layers = true;
+    if(streaming_layers and (shared_layers or dual_spmat or socket_replicas)) {
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Shared, dual or replicated layers are built from all the layers, loading them before the inference.\n"); 
+        streaming_layers = false;
+        layer_window = 0;
+    }
+    
+    /* Layers are read and compressed concurrently by a pool of threads, each layer by one thread. Layer
+       tilings make no MPI calls and their readers run single threaded inside the pool, and every block is 
+       bound to its socket when allocated, so the placement does not depend on the thread loading it. */
+    const int32_t nloaders = (streaming_layers) ? 1 : std::max(1, std::min((int32_t) nmax_layers, (layer_loaders) ? std::min((int32_t) layer_loaders, Env::nthreads) : Env::nthreads));
+    uint32_t failed_layer = nmax_layers; /* First layer that did not load, reported by the main thread */
+    auto load_layer = [&] (const uint32_t i) {
+		if(layer_loader and (bundle_fd != -1)) {
+			layers[i] = std::move(std::make_unique<Tiling<Weight>>());
+			layers[i]->tiles.resize(1, std::vector<struct Tile<Weight>>(1));
+			struct Tile<Weight>& tile = layers[i]->tiles[0][0];
+			tile.rank = Env::rank;
+			tile.height = layers_nrows[i];
+			tile.width = layers_ncols[i];
+			if(not tile.load(bundle_fd, layer_entries[i].offset, layer_entries[i].nbytes, compression_type, hashing_type, Env::rank_socket_id, true)) return(false);
+		}
+		else if(layer_loader) {
+			layers[i] = std::move(std::make_unique<Tiling<Weight>>(1, 1, 1, 1, 
+																   layers_nrows[i], layers_ncols[i], 
+																   layer_files[i], input_type, 
+																   TILING_TYPE::_1D_COL_, compression_type, hashers[i+1]));
+		}
+		else {
+			layers[i] = std::move(std::make_unique<Tiling<Weight>>());
+			layers[i]->tiles.resize(1, std::vector<struct Tile<Weight>>(1)); // The matrix comes from share_layers
+		}
+		return(true);
+    };
+    auto layer_error = [&] () {
+        Logging::enabled = true;
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Neural network: Layer %d of %s is not a %s layer of %d x %d with %s hashing\n", failed_layer, bundle_file.c_str(), COMPRESSED_FORMATS[compression_type], layers_nrows[failed_layer], layers_ncols[failed_layer], HASHING_TYPES[hashing_type]);
+        std::exit(Env::finalize());
+    };
+    std::thread streamer;
+    uint32_t pattern_layers = 0;
+    uint32_t stale_layers = 0; /* Stored tiles that did not match, warned about once logging is back on */
+    Logging::enabled = false;
+    if(streaming_layers) {
+        /* Or by one background thread publishing them in order, so the constructor and the inference
+           go on and a thread only blocks (in layer_spmat) when it reaches a layer not published yet.
+           With a layer window it reads ahead only while the window has room, evicting the layers
+           behind the slowest thread to make some. */
+        layer_wait_times.resize(Env::nthreads);
+        layer_waits.resize(Env::nthreads);
+        if(layer_window) {
+            layers_done = std::vector<std::atomic<uint32_t>>(Env::nthreads);
+            for(auto& nlayers: layers_done) nlayers.store(0);
+        }
+        streamer = std::thread([&] () {
+            Logging::muted = true;
+            omp_set_num_threads(1); // Leave the cores to the inference threads
+            double streaming_start = Env::tic();
+            for(uint32_t i = 0; i < nmax_layers; i++) {
+                if(layer_window) {
+                    double stall_start = Env::tic();
+                    while(i >= evict_layers() + layer_window) std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    window_stall_time += Env::toc(stall_start);
+                }
+                if(not load_layer(i)) {
+                    /* The inference threads run to the end on empty layers from here on and the
+                       main thread reports the failure once it joined them */
+                    failed_layer = i;
+                    for(uint32_t j = i; j < nmax_layers; j++) {
+                        layers[j] = std::move(std::make_unique<Tiling<Weight>>());
+                        layers[j]->tiles.resize(1, std::vector<struct Tile<Weight>>(1));
+                        if(compression_type == COMPRESSED_FORMAT::_CSC_) layers[j]->tiles[0][0].spmat = std::make_shared<struct CSC<Weight>>(0, layers_nrows[j], layers_ncols[j], Env::rank_socket_id);
+                        else layers[j]->tiles[0][0].spmat = std::make_shared<struct CSR<Weight>>(0, layers_nrows[j], layers_ncols[j], Env::rank_socket_id);
+                    }
+                    nlayers_ready.store(nmax_layers, std::memory_order_release);
+                    break;
+                }
+                pattern_layers += layers[i]->tiles[0][0].spmat->pattern;
+                stale_layers += layers[i]->stale_tile;
+                if(layer_window) {
+                    resident_bytes += layers[i]->tiles[0][0].spmat->nbytes();
+                    peak_resident_bytes = std::max(peak_resident_bytes, resident_bytes);
+                    peak_resident_layers = std::max(peak_resident_layers, i + 1 - nlayers_evicted);
+                }
+                nlayers_ready.store(i + 1, std::memory_order_release);
+            }
+            streaming_time = Env::toc(streaming_start) - window_stall_time;
+        });
+    }
+    else {
+        #pragma omp parallel for schedule(dynamic) num_threads(nloaders)
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            if(not load_layer(i)) {
+                #pragma omp critical
+                failed_layer = std::min(failed_layer, i);
+            }
+        }
+        if(failed_layer < nmax_layers) layer_error();
+        nlayers_ready.store(nmax_layers, std::memory_order_release);
+        for(uint32_t i = 0; i < nmax_layers; i++) stale_layers += layers[i]->stale_tile;
+    }
+    startup_times[STARTUP_PHASE::_LAYER_PHASE_] = Env::toc(phase_time);
+    phase_time = Env::tic();
+    
+    for(uint32_t i = 0; i < nmax_layers; i++) {
+		const uint32_t layer_ncols = layers_ncols[i];
 		bias_vectors[i] = std::move(std::make_shared<struct Data_Block<Weight>>(layer_ncols, Env::rank_socket_id));
 		if(bias_type == VALUE_TYPE::_CONSTANT_) {				
 			Weight* b_A = bias_vectors[i]->ptr;
 			for(uint32_t j = 0; j < layer_ncols; j++) b_A[j] = bias_value;
 		}
 		else if(bias_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) {
-			std::string bias_file = bias_files[i];
 			std::vector<Weight> bias_values;
-			uint32_t c = IO::read_file_iv<Weight>(bias_file, input_type, hashers[i+1], false, bias_type, bias_values, layer_ncols);
+			if(bundle_fd != -1) IO::read_bundle_iv<Weight>(bundle_fd, IO::bundle_entry(bundle_entries, BUNDLE_ENTRY::_BIAS_ENTRY_, i), hashers[i+1], false, bias_type, bias_values, layer_ncols);
+			else IO::read_file_iv<Weight>(bias_files[i], input_type, hashers[i+1], false, bias_type, bias_values, layer_ncols);
 			Weight* b_A = bias_vectors[i]->ptr;
 			for(uint32_t j = 0; j < layer_ncols; j++) b_A[j] = bias_values[j];
 		}
-        Logging::enabled = false; 
         if(i%10==0 and Env::rank == 0) printf("|"); 
     }
     Logging::enabled = true;
     Logging::print(Logging::LOG_LEVEL::VOID, "\n"); 
-    Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Done reading %d layer files.\n", nmax_layers); 
+    if(streaming_layers) Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Streaming %d layer files in the background.\n", nmax_layers); 
+    else Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Done reading %d layer files (%d loader threads).\n", nmax_layers, nloaders); 
+    if(stale_layers) Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: %d/%d stored %s layers do not match the padded layers (stored with another OMP_NUM_THREADS?), their triples were compressed instead.\n", stale_layers, nmax_layers, COMPRESSED_FORMATS[compression_type]); 
+    startup_times[STARTUP_PHASE::_BIAS_PHASE_] = Env::toc(phase_time);
+    phase_time = Env::tic();
+    if((bundle_fd != -1) and not streaming_layers) close(bundle_fd); // The file-backed blocks keep their mappings
+    if(shared_layers) share_layers();
+    if(dual_spmat and (compression_type == COMPRESSED_FORMAT::_CSC_) and (activation_compression_type == COMPRESSED_FORMAT::_CSC_)) {
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = layers[i]->tiles[0][0].spmat;
+            B_SPMAT->dual = std::make_shared<struct CSR<Weight>>(B_SPMAT, Env::rank_socket_id);
+        }
+        Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Layers are stored in both CSC and CSR (push/pull kernels).\n"); 
+    }
+    if(socket_replicas and (compression_type == COMPRESSED_FORMAT::_CSC_) and not shared_layers) replicate_layers();
+    if(not streaming_layers) {
+        for(uint32_t i = 0; i < nmax_layers; i++) pattern_layers += layers[i]->tiles[0][0].spmat->pattern;
+        Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: %d/%d layers have uniform weights and are stored as patterns.\n", pattern_layers, nmax_layers); 
+    }
     Env::barrier();
 
-	spa_vectors.resize(Env::nthreads);
+	accumulators.resize(Env::nthreads);
 	for(int32_t i = 0; i < Env::nthreads; i++) {
 		if(compression_type == COMPRESSED_FORMAT::_CSC_) {
 			uint32_t max_height = input_features->get_tile_info_max("height");
-			spa_vectors[i] = std::move(std::make_shared<struct Data_Block<Weight>>(max_height, Env::threads_socket_id[i]));    
+			accumulators[i] = std::move(std::make_shared<struct Accumulator<Weight>>(max_height, nmax_layers, Env::threads_socket_id[i]));    
+			accumulators[i]->strips = row_strips;
+			accumulators[i]->strip_nrows = strip_nrows;
 		}
 		else if(compression_type == COMPRESSED_FORMAT::_CSR_) {
 			uint32_t max_width = input_features->get_tile_info_max("width");
 			max_width = (nneurons > max_width) ? nneurons : max_width;
-			spa_vectors[i] = std::move(std::make_shared<struct Data_Block<Weight>>(max_width, Env::threads_socket_id[i]));    
+			accumulators[i] = std::move(std::make_shared<struct Accumulator<Weight>>(max_width, nmax_layers, Env::threads_socket_id[i]));    
 		}
 		else {
 			Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
@@ -206,33 +422,87 @@ Net<Weight>::Net(const uint32_t input_ninstanses_, const uint32_t input_nfeature
 		}
 	}
 	
+	/* Per-thread output segments of the fused SpMM, stitched into the shared C in model parallel layers.
+	   Doubly compressed activations always use them as their columns (rows) can only be appended. */
+	bool doubly_compressed = (activation_compression_type == COMPRESSED_FORMAT::_DCSC_) or (activation_compression_type == COMPRESSED_FORMAT::_DCSR_);
+	if((fused_spmm or doubly_compressed) and ((parallelism_type == PARALLELISM_TYPE::_DATA_X_MODEL_) or (parallelism_type == PARALLELISM_TYPE::_HYBRID_X_HYBRID_))) {
+		output_segments.resize(Env::nthreads);
+		for(int32_t i = 0; i < Env::nthreads; i++) {
+			if(activation_compression_type == COMPRESSED_FORMAT::_CSC_) {
+				output_segments[i] = std::move(std::make_shared<struct CSC<Weight>>(0, 0, 0, Env::threads_socket_id[i]));
+			}
+			else if(activation_compression_type == COMPRESSED_FORMAT::_CSR_) {
+				output_segments[i] = std::move(std::make_shared<struct CSR<Weight>>(0, 0, 0, Env::threads_socket_id[i]));
+			}
+			else if(activation_compression_type == COMPRESSED_FORMAT::_DCSC_) {
+				output_segments[i] = std::move(std::make_shared<struct DCSC<Weight>>(0, 0, 0, Env::threads_socket_id[i]));
+			}
+			else if(activation_compression_type == COMPRESSED_FORMAT::_DCSR_) {
+				output_segments[i] = std::move(std::make_shared<struct DCSR<Weight>>(0, 0, 0, Env::threads_socket_id[i]));
+			}
+		}
+	}
+	
+	if(dense_activations and ((activation_compression_type != COMPRESSED_FORMAT::_CSC_) or (compression_type != COMPRESSED_FORMAT::_CSC_))) {
+		Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Dense activations need CSC activations and layers, keeping %s.\n", COMPRESSED_FORMATS[activation_compression_type]);
+		dense_activations = false;
+	}
+	
+	/* Temporal blocking keeps a block in singly compressed scratch matrices of the kernels' orientation */
+	if((temporal_layers > 1) and (parallelism_type == PARALLELISM_TYPE::_DATA_X_DATA_) and (activation_compression_type == compression_type)) {
+		row_blocks.resize(Env::nthreads);
+	}
+	
     if(parallelism_type == PARALLELISM_TYPE::_DATA_X_MODEL_) {
         output = std::move(std::make_unique<Tiling<Weight>>(Env::nranks, Env::nranks, 1, Env::nranks, 
                                                             0, input_ninstanses, nneurons, 
-                                                            TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                            TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
     }
     else if((parallelism_type == PARALLELISM_TYPE::_MANAGER_X_WORKER_) or (parallelism_type == PARALLELISM_TYPE::_WORK_X_STEALING_)) {
         output = std::move(std::make_unique<Tiling<Weight>>(Env::nranks * Env::nthreads * split_factor, Env::nranks * Env::nthreads * split_factor, 1, Env::nranks, 
                                                             Env::nthreads, Env::nranks * Env::nthreads, 
                                                             0, input_ninstanses, nneurons, 
-                                                            TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                            TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
     }
     else {
         output = std::move(std::make_unique<Tiling<Weight>>(Env::nranks * Env::nthreads, Env::nranks * Env::nthreads, 1, Env::nranks, 
                                                             Env::nthreads, Env::nranks * Env::nthreads, 
                                                             0, input_ninstanses, nneurons, 
-                                                            TILING_TYPE::_1D_ROW_, compression_type, hashers[0]));
+                                                            TILING_TYPE::_1D_ROW_, activation_compression_type, hashers[0]));
     }
     output->set_tile_info(input_features->tiles);
+    if(row_compaction) row_maps.resize(input_features->nrowgrps);
+
+    /* The only dispatch on the activation, everything below inferenceReLU is instantiated for it */
+    switch(activation_type) {
+        case ACTIVATION_TYPE::_NOOP_:        inference_function = &Net<Weight>::inferenceReLU<Noop<Weight>>;        break;
+        case ACTIVATION_TYPE::_RELU_:        inference_function = &Net<Weight>::inferenceReLU<ReLU<Weight>>;        break;
+        case ACTIVATION_TYPE::_CAPPED_RELU_: inference_function = &Net<Weight>::inferenceReLU<Capped_ReLU<Weight>>; break;
+        case ACTIVATION_TYPE::_LEAKY_RELU_:  inference_function = &Net<Weight>::inferenceReLU<Leaky_ReLU<Weight>>;  break;
+        case ACTIVATION_TYPE::_SIGMOID_:     inference_function = &Net<Weight>::inferenceReLU<Sigmoid<Weight>>;     break;
+        default:
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Activation not implemented\n");
+            std::exit(Env::finalize());
+    }
 
-    Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Running the inferenceReLU method [Compression=%s|Parallelism=%s|Scheduling=%s|Hashing=%s].\n", 
-                   COMPRESSED_FORMATS[compression_type], PARALLELISM_TYPES[parallelism_type], SCHEDULING_TYPES[scheduling_type], HASHING_TYPES[hashing_type]); 
+    Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Running the inferenceReLU method [Compression=%s/%s|Parallelism=%s|Scheduling=%s|Hashing=%s|SIMD=%s|Activation=%s].\n", 
+                   COMPRESSED_FORMATS[compression_type], COMPRESSED_FORMATS[activation_compression_type], PARALLELISM_TYPES[parallelism_type], SCHEDULING_TYPES[scheduling_type], HASHING_TYPES[hashing_type], SIMD_TYPES[simd_type], ACTIVATION_TYPES[activation_type]); 
     auto finish = std::chrono::high_resolution_clock::now();
     Env::io_time = (double)(std::chrono::duration_cast< std::chrono::nanoseconds>(finish-start).count())/1e9;
+    startup_times[STARTUP_PHASE::_SETUP_PHASE_] = Env::toc(phase_time);
+    printStartupTimes();
     Env::barrier();
     Env::global_time = Env::tic();
     	
     execute();
+    
+    if(streaming_layers) {
+        streamer.join();
+        if(failed_layer < nmax_layers) layer_error();
+        if(bundle_fd != -1) close(bundle_fd);
+        if(stale_layers) Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: %d/%d stored %s layers do not match the padded layers (stored with another OMP_NUM_THREADS?), their triples were compressed instead.\n", stale_layers, nmax_layers, COMPRESSED_FORMATS[compression_type]); 
+        Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: %d/%d layers have uniform weights and are stored as patterns.\n", pattern_layers, nmax_layers); 
+    }
 
     finish = std::chrono::high_resolution_clock::now();
     Env::end_to_end_time = (double)(std::chrono::duration_cast< std::chrono::nanoseconds>(finish-start).count())/1e9;
@@ -242,6 +512,9 @@ Net<Weight>::Net(const uint32_t input_ninstanses_, const uint32_t input_nfeature
 		printTimesExcel();
 	else 
 		printTimesExcel1();
+	printAccumulators();
+	printHugePages();
+	if(streaming_layers) printStreamingTimes();
 }
 
 void stats(const std::vector<double> vec, double& sum, double& mean, double& std_dev, double& min, double& max) {
@@ -520,6 +793,12 @@ void Net<Weight>::printTimesExcel() {
     double sum = 0.0, mean = 0.0, std_dev = 0.0, min = 0.0, max = 0.0;
     stats(Env::execution_time, sum, mean, std_dev, min, max);
     Logging::print(Logging::LOG_LEVEL::VOID, "exec time: %.3f %.3f %.3f %3f %3f\n", min, max, sum, mean, std_dev);
+    /* Per-layer SpMM cost. With fused_spmm the symbolic part is zero and real is the single pass,
+       compare it with symb + real of a --fused_spmm 0 run */
+    stats(Env::spmm_symb_time, sum, mean, std_dev, min, max);
+    Logging::print(Logging::LOG_LEVEL::VOID, "symb time: %.3f %.3f %.3f %3f %3f [%.3f ms/layer]\n", min, max, sum, mean, std_dev, (max*1e3)/nmax_layers);
+    stats(Env::spmm_real_time, sum, mean, std_dev, min, max);
+    Logging::print(Logging::LOG_LEVEL::VOID, "real time: %.3f %.3f %.3f %3f %3f [%.3f ms/layer]\n", min, max, sum, mean, std_dev, (max*1e3)/nmax_layers);
     
     //annotate2();
     
@@ -601,6 +880,300 @@ void Net<Weight>::printTimesExcel() {
 
 
 
+/* Number of output columns (rows for CSR) each accumulator computed, summed over threads, ranks and layers.
+   With layer_stats the counters are also printed per layer */
+template<typename Weight>
+void Net<Weight>::printAccumulators() {
+    std::vector<uint64_t> counts(nmax_layers * ACCUMULATOR_TYPE::_NUM_ACC_);
+    for(auto& accumulator: accumulators) {
+        for(uint32_t l = 0; l < nmax_layers; l++) {
+            for(uint32_t a = 0; a < ACCUMULATOR_TYPE::_NUM_ACC_; a++) {
+                counts[(l * ACCUMULATOR_TYPE::_NUM_ACC_) + a] += accumulator->counters[l][a];
+            }
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), counts.size(), MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    
+    Logging::print(Logging::LOG_LEVEL::VOID, "Accumulators: layer %s %s %s\n", ACCUMULATOR_TYPES[ACCUMULATOR_TYPE::_DENSE_ACC_], ACCUMULATOR_TYPES[ACCUMULATOR_TYPE::_HASH_ACC_], ACCUMULATOR_TYPES[ACCUMULATOR_TYPE::_SORT_ACC_]);
+    std::vector<uint64_t> total_counts(ACCUMULATOR_TYPE::_NUM_ACC_);
+    for(uint32_t l = 0; l < nmax_layers; l++) {
+        uint64_t* c = &counts[l * ACCUMULATOR_TYPE::_NUM_ACC_];
+        for(uint32_t a = 0; a < ACCUMULATOR_TYPE::_NUM_ACC_; a++) total_counts[a] += c[a];
+        if(layer_stats) Logging::print(Logging::LOG_LEVEL::VOID, "Accumulators: %d %lu %lu %lu\n", l, c[ACCUMULATOR_TYPE::_DENSE_ACC_], c[ACCUMULATOR_TYPE::_HASH_ACC_], c[ACCUMULATOR_TYPE::_SORT_ACC_]);
+    }
+    Logging::print(Logging::LOG_LEVEL::VOID, "Accumulators: total %lu %lu %lu\n", total_counts[ACCUMULATOR_TYPE::_DENSE_ACC_], total_counts[ACCUMULATOR_TYPE::_HASH_ACC_], total_counts[ACCUMULATOR_TYPE::_SORT_ACC_]);
+    
+    std::vector<uint64_t> blocks(nmax_layers * 2);
+    for(auto& accumulator: accumulators) {
+        for(uint32_t l = 0; l < nmax_layers; l++) {
+            blocks[(l * 2)] += accumulator->remaps[l];
+            blocks[(l * 2) + 1] += accumulator->memsets[l];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, blocks.data(), blocks.size(), MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    Logging::print(Logging::LOG_LEVEL::VOID, "Blocks: layer remaps memset_bytes\n");
+    uint64_t total_remaps = 0, total_memsets = 0;
+    for(uint32_t l = 0; l < nmax_layers; l++) {
+        total_remaps += blocks[(l * 2)];
+        total_memsets += blocks[(l * 2) + 1];
+        if(layer_stats) Logging::print(Logging::LOG_LEVEL::VOID, "Blocks: %d %lu %lu\n", l, blocks[(l * 2)], blocks[(l * 2) + 1]);
+    }
+    Logging::print(Logging::LOG_LEVEL::VOID, "Blocks: total %lu %lu\n", total_remaps, total_memsets);
+    
+    if(dual_spmat) {
+        std::vector<uint64_t> directions(nmax_layers * DIRECTION_TYPE::_NUM_DIR_);
+        for(auto& accumulator: accumulators) {
+            for(uint32_t l = 0; l < nmax_layers; l++) {
+                for(uint32_t d = 0; d < DIRECTION_TYPE::_NUM_DIR_; d++) {
+                    directions[(l * DIRECTION_TYPE::_NUM_DIR_) + d] += accumulator->directions[l][d];
+                }
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, directions.data(), directions.size(), MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+        Logging::print(Logging::LOG_LEVEL::VOID, "Directions: layer %s %s\n", DIRECTION_TYPES[DIRECTION_TYPE::_PUSH_], DIRECTION_TYPES[DIRECTION_TYPE::_PULL_]);
+        std::vector<uint64_t> total_directions(DIRECTION_TYPE::_NUM_DIR_);
+        for(uint32_t l = 0; l < nmax_layers; l++) {
+            uint64_t* d = &directions[l * DIRECTION_TYPE::_NUM_DIR_];
+            for(uint32_t k = 0; k < DIRECTION_TYPE::_NUM_DIR_; k++) total_directions[k] += d[k];
+            if(layer_stats) Logging::print(Logging::LOG_LEVEL::VOID, "Directions: %d %lu %lu\n", l, d[DIRECTION_TYPE::_PUSH_], d[DIRECTION_TYPE::_PULL_]);
+        }
+        Logging::print(Logging::LOG_LEVEL::VOID, "Directions: total %lu %lu\n", total_directions[DIRECTION_TYPE::_PUSH_], total_directions[DIRECTION_TYPE::_PULL_]);
+    }
+    
+    if(row_compaction) {
+        std::vector<uint64_t> live_rows(nmax_layers);
+        for(auto& accumulator: accumulators) {
+            for(uint32_t l = 0; l < nmax_layers; l++) live_rows[l] += accumulator->live_rows[l];
+        }
+        MPI_Allreduce(MPI_IN_PLACE, live_rows.data(), live_rows.size(), MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+        Logging::print(Logging::LOG_LEVEL::VOID, "Live rows: layer rows (of %d)\n", input_ninstanses);
+        uint64_t total_live_rows = 0;
+        for(uint32_t l = 0; l < nmax_layers; l++) {
+            total_live_rows += live_rows[l];
+            if(layer_stats) Logging::print(Logging::LOG_LEVEL::VOID, "Live rows: %d %lu\n", l, live_rows[l]);
+        }
+        Logging::print(Logging::LOG_LEVEL::VOID, "Live rows: total %lu (of %lu), last %lu\n", total_live_rows, (uint64_t) input_ninstanses * nmax_layers, live_rows[nmax_layers - 1]);
+    }
+}
+
+/* The first rank of every machine loaded the CSC layers. They are copied into one MPI-3 shared window
+   of the machine, which every rank of it reads in place, and the loader drops its private copy. */
+template<typename Weight>
+void Net<Weight>::share_layers() {
+    const bool loader = (Env::machine_rank == 0);
+    const uint32_t nfields = 4;
+    std::vector<uint64_t> dims(nmax_layers * nfields);
+    std::vector<Weight> pattern_values(nmax_layers);
+    if(loader) {
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(layers[i]->tiles[0][0].spmat);
+            dims[(i * nfields)]     = B_CSC->nnz;
+            dims[(i * nfields) + 1] = B_CSC->nrows;
+            dims[(i * nfields) + 2] = B_CSC->ncols;
+            dims[(i * nfields) + 3] = B_CSC->pattern;
+            pattern_values[i] = B_CSC->pattern_value;
+        }
+    }
+    MPI_Bcast(dims.data(), dims.size(), MPI_UNSIGNED_LONG, 0, Env::machine_communicator);
+    MPI_Bcast(pattern_values.data(), pattern_values.size(), MPI_Types::get_mpi_data_type<Weight>(), 0, Env::machine_communicator);
+    
+    // JA, IA and A of every layer, each starting on a cache line
+    const uint64_t line = 64;
+    std::vector<uint64_t> offsets(nmax_layers * 3);
+    uint64_t window_nbytes = 0;
+    for(uint32_t i = 0; i < nmax_layers; i++) {
+        const uint64_t* d = &dims[i * nfields];
+        const uint64_t nbytes[3] = {(d[2] + 1) * sizeof(uint32_t), d[0] * sizeof(uint32_t), (d[3]) ? 0 : d[0] * sizeof(Weight)};
+        for(uint32_t k = 0; k < 3; k++) {
+            offsets[(i * 3) + k] = window_nbytes;
+            window_nbytes += nbytes[k] + ((nbytes[k] % line) ? (line - (nbytes[k] % line)) : 0);
+        }
+    }
+    
+    MPI_Win window;
+    char* base = nullptr;
+    MPI_Win_allocate_shared((loader) ? window_nbytes : 0, 1, MPI_INFO_NULL, Env::machine_communicator, &base, &window);
+    if(not loader) {
+        MPI_Aint size = 0;
+        int disp_unit = 0;
+        MPI_Win_shared_query(window, 0, &size, &disp_unit, &base);
+    }
+    Env::shared_windows.push_back(window);
+    
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    if(loader) {
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(layers[i]->tiles[0][0].spmat);
+            memcpy(base + offsets[(i * 3)], B_CSC->JA_blk->ptr, (B_CSC->ncols + 1) * sizeof(uint32_t));
+            memcpy(base + offsets[(i * 3) + 1], B_CSC->IA_blk->ptr, B_CSC->nnz * sizeof(uint32_t));
+            if(not B_CSC->pattern) memcpy(base + offsets[(i * 3) + 2], B_CSC->A_blk->ptr, B_CSC->nnz * sizeof(Weight));
+        }
+    }
+    MPI_Win_sync(window);
+    MPI_Barrier(Env::machine_communicator);
+    MPI_Win_sync(window);
+    MPI_Win_unlock_all(window);
+    
+    for(uint32_t i = 0; i < nmax_layers; i++) {
+        const uint64_t* d = &dims[i * nfields];
+        std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = std::make_shared<struct CSC<Weight>>(d[0], d[1], d[2], (uint32_t*) (base + offsets[(i * 3)]), (uint32_t*) (base + offsets[(i * 3) + 1]), 
+                                                                                                          (d[3]) ? nullptr : (Weight*) (base + offsets[(i * 3) + 2]));
+        B_SPMAT->pattern = d[3];
+        B_SPMAT->pattern_value = pattern_values[i];
+        layers[i]->tiles[0][0].spmat = B_SPMAT;
+    }
+    Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Layers are shared by %d ranks per machine (%lu bytes).\n", Env::machine_nranks, window_nbytes); 
+}
+
+/* Each rank keeps one copy of every CSC layer per socket, the home copy is the layer itself. 
+   When the copies of all ranks on the machine would take more than replica_budget of the free
+   memory of a socket, the layers are moved to interleaved pages instead so no socket serves all reads. */
+template<typename Weight>
+void Net<Weight>::replicate_layers() {
+    /* Every rank joins the reduction, a rank that cannot replicate votes 0 for all of them */
+    int32_t numa = (Env::NUMA_ALLOC and (Env::nsockets > 1));
+    int32_t fit = numa;
+    uint64_t layers_nbytes = 0;
+    if(numa) {
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(layers[i]->tiles[0][0].spmat);
+            layers_nbytes += B_CSC->JA_blk->nbytes + B_CSC->IA_blk->nbytes + B_CSC->A_blk->nbytes;
+        }
+        layers_nbytes *= Env::nranks_per_machine;
+        
+        for(int32_t s = 0; s < Env::nsockets; s++) {
+            long long free_nbytes = 0;
+            numa_node_size64(s, &free_nbytes);
+            if(layers_nbytes > replica_budget * free_nbytes) fit = 0;
+        }
+    }
+    int32_t votes[2] = {numa, fit};
+    MPI_Allreduce(MPI_IN_PLACE, votes, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    numa = votes[0];
+    fit = votes[1];
+    
+    if(not numa) {
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Layer replicas need NUMA and more than one socket on every rank, keeping one copy.\n"); 
+    }
+    else if(fit) {
+        layer_replicas.resize(Env::nsockets);
+        for(int32_t s = 0; s < Env::nsockets; s++) {
+            layer_replicas[s].resize(nmax_layers);
+            for(uint32_t i = 0; i < nmax_layers; i++) {
+                std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = layers[i]->tiles[0][0].spmat;
+                const int32_t home_socket_id = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT)->IA_blk->socket_id;
+                layer_replicas[s][i] = (s == home_socket_id) ? B_SPMAT : std::make_shared<struct CSC<Weight>>(B_SPMAT, s);
+            }
+        }
+        Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Layers are replicated on %d sockets (%lu bytes per socket).\n", Env::nsockets, layers_nbytes); 
+    }
+    else {
+        for(uint32_t i = 0; i < nmax_layers; i++) {
+            std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = layers[i]->tiles[0][0].spmat;
+            B_SPMAT = std::make_shared<struct CSC<Weight>>(B_SPMAT, Env::INTERLEAVED);
+        }
+        Logging::print(Logging::LOG_LEVEL::WARN, "Neural network: Layer replicas do not fit (%lu bytes per socket), layers are interleaved.\n", layers_nbytes); 
+    }
+}
+
+/* Read while the layers and activations are still mapped */
+template<typename Weight>
+void Net<Weight>::printHugePages() {
+    uint64_t bytes[2];
+    Env::get_huge_page_bytes(bytes[0], bytes[1]);
+    MPI_Allreduce(MPI_IN_PLACE, bytes, 2, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+    Logging::print(Logging::LOG_LEVEL::VOID, "Huge pages: policy=%s page_size=%lu thp_bytes=%lu hugetlb_bytes=%lu\n", Env::PAGE_POLICIES[Env::page_policy], Env::HUGE_PAGE_SIZE, bytes[0], bytes[1]);
+}
+
+/* Load time hidden behind the inference: the slowest background loader minus the longest a thread blocked on it */
+template<typename Weight>
+void Net<Weight>::printStreamingTimes() {
+    double times[2] = {streaming_time, *std::max_element(layer_wait_times.begin(), layer_wait_times.end())};
+    MPI_Allreduce(MPI_IN_PLACE, times, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    const double hidden = std::max(0.0, times[0] - times[1]);
+    Logging::print(Logging::LOG_LEVEL::VOID, "Streaming layers: load=%.3f waited=%.3f hidden=%.3f (%.1f%%)\n", times[0], times[1], hidden, (times[0] > 0) ? (100 * hidden / times[0]) : 0.0);
+    if(layer_window) {
+        /* Slowest rank: layers waited for (not prefetched in time), evictions and resident peaks, window stalls */
+        double stats[5] = {(double) *std::max_element(layer_waits.begin(), layer_waits.end()), (double) nlayers_evicted, 
+                           (double) peak_resident_layers, (double) peak_resident_bytes, window_stall_time};
+        MPI_Allreduce(MPI_IN_PLACE, stats, 5, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        Logging::print(Logging::LOG_LEVEL::VOID, "Layer window: window=%d prefetched=%d/%d evicted=%d peak_resident=%d layers (%.1f MB) loader_stalled=%.3f\n", 
+                       layer_window, nmax_layers - (uint32_t) stats[0], nmax_layers, (uint32_t) stats[1], (uint32_t) stats[2], stats[3]/1e6, stats[4]);
+    }
+}
+
+/* Spins until the background loader has published layer l */
+template<typename Weight>
+void Net<Weight>::wait_layer(const uint32_t l, const int32_t tid) {
+    double wait_time = Env::tic();
+    while(nlayers_ready.load(std::memory_order_acquire) <= l) std::this_thread::yield();
+    layer_wait_times[tid] += Env::toc(wait_time);
+    layer_waits[tid]++;
+}
+
+/* Frees the layers behind the slowest thread, returns how many layers it has finished */
+template<typename Weight>
+uint32_t Net<Weight>::evict_layers() {
+    uint32_t nlayers = nmax_layers;
+    for(auto& nlayers_thread: layers_done) nlayers = std::min(nlayers, nlayers_thread.load(std::memory_order_acquire));
+    for(; nlayers_evicted < nlayers; nlayers_evicted++) {
+        resident_bytes -= layers[nlayers_evicted]->tiles[0][0].spmat->nbytes();
+        layers[nlayers_evicted]->tiles[0][0].spmat = nullptr;
+    }
+    return(nlayers);
+}
+
+/* Knobs set by name (e.g. --row_compaction 1 on the command line), the inference runs in the constructor */
+template<typename Weight>
+void Net<Weight>::set_option(const std::string name, const std::string value) {
+    if(name == "row_compaction") row_compaction = atoi(value.c_str());
+    else if(name == "temporal_layers") temporal_layers = atoi(value.c_str());
+    else if(name == "row_strips") row_strips = atoi(value.c_str());
+    else if(name == "strip_nrows") strip_nrows = atoi(value.c_str()); // Overrides the L2 derived strip height
+    else if(name == "dual_spmat") dual_spmat = atoi(value.c_str());
+    else if(name == "dense_activations") dense_activations = atoi(value.c_str());
+    else if(name == "dense_threshold") dense_threshold = atof(value.c_str());
+    else if(name == "sparse_threshold") sparse_threshold = atof(value.c_str());
+    else if(name == "socket_replicas") socket_replicas = atoi(value.c_str());
+    else if(name == "replica_budget") replica_budget = atof(value.c_str());
+    else if(name == "shared_layers") shared_layers = atoi(value.c_str());
+    else if(name == "layer_loaders") layer_loaders = atoi(value.c_str());
+    else if(name == "streaming_layers") streaming_layers = atoi(value.c_str());
+    else if(name == "layer_window") layer_window = atoi(value.c_str());
+    else if(name == "fused_spmm") fused_spmm = atoi(value.c_str());
+    else if(name == "layer_stats") layer_stats = atoi(value.c_str());
+    else if(name == "compression") { // csc|csr|dcsc|dcsr, overrides the format the app passed in
+        if(value == "csc") activation_compression_type = COMPRESSED_FORMAT::_CSC_;
+        else if(value == "csr") activation_compression_type = COMPRESSED_FORMAT::_CSR_;
+        else if(value == "dcsc") activation_compression_type = COMPRESSED_FORMAT::_DCSC_;
+        else if(value == "dcsr") activation_compression_type = COMPRESSED_FORMAT::_DCSR_;
+        else {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Neural network: Unknown compression %s (csc, csr, dcsc or dcsr)\n", value.c_str());
+            std::exit(Env::finalize());
+        }
+        compression_type = activation_compression_type;
+    }
+    else {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Neural network: Unknown option %s\n", name.c_str());
+        std::exit(Env::finalize());
+    }
+    Logging::print(Logging::LOG_LEVEL::INFO, "Neural network: Option %s = %s\n", name.c_str(), value.c_str());
+}
+
+/* Slowest rank per phase of the constructor */
+template<typename Weight>
+void Net<Weight>::printStartupTimes() {
+    std::vector<double> times = startup_times;
+    MPI_Allreduce(MPI_IN_PLACE, times.data(), times.size(), MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    double total = 0;
+    Logging::print(Logging::LOG_LEVEL::VOID, "Startup time:");
+    for(uint32_t i = 0; i < STARTUP_PHASE::_NPHASES_; i++) {
+        Logging::print(Logging::LOG_LEVEL::VOID, " %s=%.3f", STARTUP_PHASES[i], times[i]);
+        total += times[i];
+    }
+    Logging::print(Logging::LOG_LEVEL::VOID, " total=%.3f\n", total);
+}
+
 template<typename Weight>
 void Net<Weight>::printTimesExcel1() {
     Env::barrier();
@@ -624,6 +1197,11 @@ void Net<Weight>::printTimesExcel1() {
     double memory_time = Env::memory_allocation_time[index];
     double hybrid_time = Env::hybrid_probe_time[index];
     
+    std::tie(sum, mean, std_dev, min, max) =  Env::statistics<double>(spmm_sym_time);
+    Logging::print(Logging::LOG_LEVEL::VOID, "Symb time: %.3f %.3f %.3f [%.3f ms/layer]\n", min, max, sum, (max*1e3)/nmax_layers);
+    std::tie(sum, mean, std_dev, min, max) =  Env::statistics<double>(spmm_time);
+    Logging::print(Logging::LOG_LEVEL::VOID, "Real time: %.3f %.3f %.3f [%.3f ms/layer]\n", min, max, sum, (max*1e3)/nmax_layers);
+    
     /*
     if(exec_time == max) {
         printf("time: %.3f %.3f %.3f %.3f %.3f %.3f\n", exec_time, spmm_sym_time, spmm_time, memory_time, hybrid_time, exec_time-(spmm_sym_time + spmm_time + memory_time + hybrid_time));
@@ -686,7 +1264,7 @@ void Net<Weight>::execute() {
     std::vector<std::thread> threads;
     
     for(int i = 0; i < Env::nthreads; i++) {
-        threads.push_back(std::thread(&Net<Weight>::inferenceReLU, this, i));
+        threads.push_back(std::thread(inference_function, this, i));
     }
     
     for(std::thread& th: threads) {
@@ -695,29 +1273,31 @@ void Net<Weight>::execute() {
 }
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::inferenceReLU(const int32_t tid) {
     if(Env::NUMA_ALLOC) {
         (void)Env::set_thread_affinity(tid);   
     }
     
     if(parallelism_type == PARALLELISM_TYPE::_DATA_X_MODEL_) {
-        data_x_model(tid);
+        data_x_model<Activation>(tid);
     }
     else if(parallelism_type == PARALLELISM_TYPE::_DATA_X_DATA_) {
-        data_x_data(tid);
+        data_x_data<Activation>(tid);
     }
     else if(parallelism_type == PARALLELISM_TYPE::_HYBRID_X_HYBRID_) {
-        hybrid_x_hybrid(tid);
+        hybrid_x_hybrid<Activation>(tid);
     }
     else if(parallelism_type == PARALLELISM_TYPE::_MANAGER_X_WORKER_) {
-        manager_x_worker(tid);
+        manager_x_worker<Activation>(tid);
     }    
     else if(parallelism_type == PARALLELISM_TYPE::_WORK_X_STEALING_) {
-        work_x_stealing(tid);
+        work_x_stealing<Activation>(tid);
     }
 }
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::data_x_model(const int32_t tid) {
 	auto start_t = std::chrono::high_resolution_clock::now();  
 	uint32_t leader_rowgroup = Env::rank;
@@ -732,10 +1312,10 @@ void Net<Weight>::data_x_model(const int32_t tid) {
     struct Tile<Weight>& C_tile = output->tiles[leader_rowgroup][0];
     for (uint32_t l = 0; l < nmax_layers; l++) {	
 		std::shared_ptr<struct Compressed_Format<Weight>>& A_SPMAT = A_tile.spmat;
-		struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];
-        std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = B_tile.spmat;
+        std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = layer_spmat(l, tid);
         std::shared_ptr<struct Compressed_Format<Weight>>& C_SPMAT = C_tile.spmat;
-		std::shared_ptr<struct Data_Block<Weight>>& s_spa = spa_vectors[tid];
+		std::shared_ptr<struct Accumulator<Weight>>& s_acc = accumulators[tid];
+		s_acc->layer = l;
         std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];
 		
 		A_nrows = A_SPMAT->nrows;
@@ -763,20 +1343,33 @@ void Net<Weight>::data_x_model(const int32_t tid) {
 			std::exit(Env::finalize());
 		}
 		bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-        data_x_model_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
+        std::shared_ptr<struct Compressed_Format<Weight>> S_SPMAT = (output_segments.empty()) ? nullptr : output_segments[tid];
+        data_x_model_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, S_SPMAT, s_acc, b_bias,
                             A_nrows, B_ncols, 
                             start, end, 
                             sub_start, sub_end, 
-                            thread_st, last_layer, leader_tid, tid); 
+                            thread_st, last_layer, fused_spmm, leader_tid, tid); 
+        if(row_compaction) {
+            pthread_barrier_wait(&Env::thread_barrier);
+            if(tid == leader_tid) {
+                A_SPMAT->compact_rows(row_maps[leader_rowgroup]);
+                s_acc->live_rows[l] += A_SPMAT->nrows;
+            }
+            pthread_barrier_wait(&Env::thread_barrier);
+        }
+        release_layers(l + 1, tid);
     }
     auto finish_t = std::chrono::high_resolution_clock::now();
     Env::execution_time[tid] = (double)(std::chrono::duration_cast<std::chrono::nanoseconds>(finish_t - start_t).count())/1e9;
 
     const std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = A_tile.spmat;
+    if(tid == leader_tid) C_SPMAT->flatten();
+    if(row_compaction and (tid == leader_tid)) C_SPMAT->restore_rows(row_maps[leader_rowgroup], A_tile.height);
     data_x_model_validate_prediction(C_SPMAT, C_tile.start_row, true_categories, predicted_nistances, category_type,classifier, leader_tid, tid);
 }
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::data_x_data(const int32_t tid) {
 	auto start_t = std::chrono::high_resolution_clock::now();  
     uint32_t leader_rowgroup = Env::thread_rowgroup[tid];
@@ -786,16 +1379,21 @@ void Net<Weight>::data_x_data(const int32_t tid) {
     uint32_t start = 0, end = 0;
     const uint32_t off = 0;
 	uint32_t l = 0;
-    for (l = 0; l < nmax_layers; l++) {
+    while((not row_blocks.empty()) and (l < nmax_layers)) {
+        l = data_x_data_blocked<Activation>(leader_rowgroup, l, tid);
+        release_layers(l, tid);
+    }
+    if(dense_activations) switch_activation(input_features->tiles[leader_rowgroup][0].spmat, false);
+    for (; l < nmax_layers; l++) {
         struct Tile<Weight>& A_tile = (not(l%2)) ? input_features->tiles[leader_rowgroup][0]
                                                  : output->tiles[leader_rowgroup][0];
         std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT = A_tile.spmat;
-        struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];    
-        std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = B_tile.spmat;
+        std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = layer_spmat(l, tid);
         struct Tile<Weight>& C_tile = (not(l%2)) ? output->tiles[leader_rowgroup][0]
                                                  : input_features->tiles[leader_rowgroup][0];
         std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
-		std::shared_ptr<struct Data_Block<Weight>>& s_spa = spa_vectors[tid];
+		std::shared_ptr<struct Accumulator<Weight>>& s_acc = accumulators[tid];
+		s_acc->layer = l;
 		std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];
 
 		A_nrows = A_SPMAT->nrows;
@@ -809,50 +1407,163 @@ void Net<Weight>::data_x_data(const int32_t tid) {
 			std::exit(Env::finalize());
 		}
 		bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-		data_x_data_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
-						   A_nrows, B_ncols, start, end, off, 
-                           thread_st, last_layer, leader_tid, tid);
+        if(A_SPMAT->compression_type == COMPRESSED_FORMAT::_DENSE_) {
+            if(C_SPMAT->compression_type != COMPRESSED_FORMAT::_DENSE_) {
+                C_tile.spmat = std::make_shared<struct Dense<Weight>>(0, 0, Env::threads_socket_id[tid]);
+                C_SPMAT = C_tile.spmat;
+            }
+            data_x_data_dense_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, b_bias, A_nrows, B_ncols, 0, B_ncols, last_layer, tid);
+        }
+        else {
+            if(C_SPMAT->compression_type == COMPRESSED_FORMAT::_DENSE_) {
+                C_tile.spmat = std::make_shared<struct CSC<Weight>>(0, 0, 0, Env::threads_socket_id[tid]);
+                C_SPMAT = C_tile.spmat;
+            }
+            data_x_data_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias,
+                               A_nrows, B_ncols, start, end, off, 
+                               thread_st, last_layer, fused_spmm, leader_tid, tid);
+        }
+        if(dense_activations) {
+            switch_activation(C_tile.spmat, false);
+            C_SPMAT = C_tile.spmat;
+        }
+        if(row_compaction and (C_SPMAT->compression_type != COMPRESSED_FORMAT::_DENSE_)) {
+            C_SPMAT->compact_rows(row_maps[leader_rowgroup]);
+            s_acc->live_rows[l] += C_SPMAT->nrows;
+        }
+        release_layers(l + 1, tid);
     }
     auto finish_t = std::chrono::high_resolution_clock::now();
     Env::execution_time[tid] = (double)(std::chrono::duration_cast< std::chrono::nanoseconds>(finish_t - start_t).count())/1e9;
     
     struct Tile<Weight>& C_tile = (not((l-1)%2)) ? output->tiles[leader_rowgroup][0] 
 											 : input_features->tiles[leader_rowgroup][0];
+    if(C_tile.spmat->compression_type == COMPRESSED_FORMAT::_DENSE_) switch_activation(C_tile.spmat, true);
     const std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
+    if(row_compaction) C_SPMAT->restore_rows(row_maps[leader_rowgroup], C_tile.height);
     data_x_data_validate_prediction(C_SPMAT, C_tile.start_row, true_categories, predicted_nistances, category_type, classifier, leader_tid, tid);
 }
 
+/* Cross-layer temporal blocking: the rowgroup is cut into row blocks small enough to stay in L2 and 
+   each block runs through layers [first_layer, first_layer + temporal_layers) before the next one starts.
+   Rows are independent in data_x_data, so the stacked blocks are exactly the unblocked output.
+   Returns the first layer not yet computed. */
+template<typename Weight>
+template<typename Activation>
+uint32_t Net<Weight>::data_x_data_blocked(const uint32_t leader_rowgroup, const uint32_t first_layer, const int32_t tid) {
+    const uint32_t last_layer_ = std::min(first_layer + temporal_layers, nmax_layers);
+    struct Tile<Weight>& A_tile = (not(first_layer%2)) ? input_features->tiles[leader_rowgroup][0]
+                                                       : output->tiles[leader_rowgroup][0];
+    std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT = A_tile.spmat;
+    struct Tile<Weight>& C_tile = (not((last_layer_-1)%2)) ? output->tiles[leader_rowgroup][0]
+                                                           : input_features->tiles[leader_rowgroup][0];
+    std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
+    std::shared_ptr<struct Accumulator<Weight>>& s_acc = accumulators[tid];
+    struct Env::thread_struct& thread_st = Env::threads[tid];
+    std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks = row_blocks[tid];
+    
+    /* A block and its output share half of L2, the other half is left to the layer and the SPA */
+    const uint32_t A_nrows = A_SPMAT->nrows;
+    const uint64_t l2_size = (Env::L2_CACHE_SIZE) ? Env::L2_CACHE_SIZE : 262144;
+    const uint64_t row_nnz = std::max((uint64_t) 1, A_SPMAT->nnz_i / std::max(A_nrows, (uint32_t) 1));
+    const uint32_t block_nrows = std::max((uint64_t) 1, (l2_size / 2) / (2 * row_nnz * (sizeof(uint32_t) + sizeof(Weight))));
+    const uint32_t nblocks = (A_nrows) ? ((A_nrows + block_nrows - 1) / block_nrows) : 0;
+    
+    while(blocks.size() < nblocks + 2) {
+        if(compression_type == COMPRESSED_FORMAT::_CSC_) {
+            blocks.push_back(std::make_shared<struct CSC<Weight>>(0, 0, 0, Env::threads_socket_id[tid]));
+        }
+        else {
+            blocks.push_back(std::make_shared<struct CSR<Weight>>(0, 0, 0, Env::threads_socket_id[tid]));
+        }
+    }
+    
+    std::vector<uint32_t> start_rows(nblocks);
+    const uint32_t C_ncols = layer_spmat(last_layer_-1, tid)->ncols;
+    for(uint32_t b = 0; b < nblocks; b++) {
+        const uint32_t start_row = b * block_nrows;
+        const uint32_t end_row = std::min(start_row + block_nrows, A_nrows);
+        start_rows[b] = start_row;
+        std::shared_ptr<struct Compressed_Format<Weight>> X_SPMAT = blocks[nblocks];
+        std::shared_ptr<struct Compressed_Format<Weight>> Y_SPMAT = blocks[nblocks+1];
+        X_SPMAT->extract_rows(A_SPMAT, start_row, end_row);
+        for(uint32_t l = first_layer; l < last_layer_; l++) {
+            std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = layer_spmat(l, tid);
+            std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];
+            std::shared_ptr<struct Compressed_Format<Weight>> Z_SPMAT = (l == last_layer_-1) ? blocks[b] : Y_SPMAT;
+            s_acc->layer = l;
+            const uint32_t B_ncols = B_SPMAT->ncols;
+            const uint32_t end = (compression_type == COMPRESSED_FORMAT::_CSC_) ? B_ncols : (end_row - start_row);
+            bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
+            data_x_data_1_iter<Activation>(X_SPMAT, B_SPMAT, Z_SPMAT, s_acc, b_bias,
+                                           end_row - start_row, B_ncols, 0, end, 0, 
+                                           thread_st, last_layer, fused_spmm, 0, tid);
+            std::swap(X_SPMAT, Y_SPMAT);
+        }
+    }
+    C_SPMAT->stack_rows(blocks, start_rows, nblocks, A_nrows, C_ncols);
+    
+    if(row_compaction) {
+        C_SPMAT->compact_rows(row_maps[leader_rowgroup]);
+        s_acc->live_rows[last_layer_-1] += C_SPMAT->nrows;
+    }
+    return(last_layer_);
+}
+
+/* Switches a rowgroup tile between CSC and dense once its density crosses dense_threshold, 
+   and back once it drops under sparse_threshold (or when to_csc asks for it). */
 template<typename Weight>
+void Net<Weight>::switch_activation(std::shared_ptr<struct Compressed_Format<Weight>>& spmat, const bool to_csc) {
+    const double size = (double) spmat->nrows * spmat->ncols;
+    if(not size) return;
+    if(spmat->compression_type == COMPRESSED_FORMAT::_CSC_) {
+        const uint64_t nnz = std::static_pointer_cast<struct CSC<Weight>>(spmat)->JA_blk->ptr[spmat->ncols];
+        if((not to_csc) and ((nnz / size) > dense_threshold)) {
+            spmat = std::make_shared<struct Dense<Weight>>(spmat);
+        }
+    }
+    else if(spmat->compression_type == COMPRESSED_FORMAT::_DENSE_) {
+        const uint64_t nnz = std::static_pointer_cast<struct Dense<Weight>>(spmat)->nnz_i;
+        if(to_csc or ((nnz / size) < sparse_threshold)) {
+            spmat = std::static_pointer_cast<struct Dense<Weight>>(spmat)->to_csc();
+        }
+    }
+}
+
+template<typename Weight>
+template<typename Activation>
 void Net<Weight>::hybrid_x_hybrid(const int32_t tid) {
 	auto start_t = std::chrono::high_resolution_clock::now();  
     uint32_t my_rowgroup = Env::thread_rowgroup[tid];
     int32_t leader_tid = 0;
     Env::global_time = Env::tic();
 	//printf("tid=%d\n", tid);
-    uint32_t my_start_layer = hybrid_x_data(Env::my_threads[tid], my_rowgroup, tid);
+    uint32_t my_start_layer = hybrid_x_data<Activation>(Env::my_threads[tid], my_rowgroup, tid);
 	//printf("tid=%d %d\n", tid, my_start_layer);
-    if(my_start_layer < nmax_layers) hybrid_x_model(Env::my_threads[tid], my_rowgroup, my_start_layer, my_start_layer, tid, tid);
+    if(my_start_layer < nmax_layers) hybrid_x_model<Activation>(Env::my_threads[tid], my_rowgroup, my_start_layer, my_start_layer, tid, tid);
     while(add_to_idle_threads(Env::my_threads[tid], tid)) {
         const int32_t leader = Env::threads[tid].leader;
         uint32_t leader_rowgroup = Env::threads[tid].rowgroup;
         uint32_t leader_start_layer = Env::threads[tid].start_layer;
 		uint32_t leader_current_layer = Env::threads[tid].current_layer;
-        hybrid_x_model(Env::my_threads[tid], leader_rowgroup, leader_start_layer, leader_current_layer, leader, tid);
+        hybrid_x_model<Activation>(Env::my_threads[tid], leader_rowgroup, leader_start_layer, leader_current_layer, leader, tid);
     }
 	//printf("totaly done %d\n", tid);
     auto finish_t = std::chrono::high_resolution_clock::now();
     Env::execution_time[tid] = (double)(std::chrono::duration_cast< std::chrono::nanoseconds>(finish_t - start_t).count())/1e9;
-	uint32_t layer_index = (my_start_layer == nmax_layers) ? nmax_layers-1 : my_start_layer;
-	//printf("tid=%d idx=%d my_start=%d max=%d\n", tid, layer_index, my_start_layer, nmax_layers);
-	struct Tile<Weight>& C_tile = (not(layer_index%2)) ? output->tiles[my_rowgroup][0]
-											           : input_features->tiles[my_rowgroup][0];
+	//printf("tid=%d my_start=%d max=%d\n", tid, my_start_layer, nmax_layers);
+	// The data phase leaves the result in the output of the last layer, the model phase in the A tile it started with
+	struct Tile<Weight>& C_tile = (my_start_layer == nmax_layers) ? ((not((nmax_layers-1)%2)) ? output->tiles[my_rowgroup][0] : input_features->tiles[my_rowgroup][0])
+	                                                              : ((not(my_start_layer%2)) ? input_features->tiles[my_rowgroup][0] : output->tiles[my_rowgroup][0]);
     //struct Tile<Weight>& A_tile = input_features->tiles[my_rowgroup][0];
     
 	std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
+    if(row_compaction) C_SPMAT->restore_rows(row_maps[my_rowgroup], C_tile.height);
     data_x_data_validate_prediction(C_SPMAT, C_tile.start_row, true_categories, predicted_nistances, category_type, classifier, leader_tid, tid);
 }
 
 template<typename Weight>
+template<typename Activation>
 uint32_t Net<Weight>::hybrid_x_data(std::deque<int32_t>& leader_owned_threads, const int32_t my_rowgroup, const int32_t tid) {
     int32_t sid = (numa_queues) ? Env::threads_socket_id[tid] : Env::rank_socket_id;
     int32_t leader_tid = 0;
@@ -867,12 +1578,12 @@ uint32_t Net<Weight>::hybrid_x_data(std::deque<int32_t>& leader_owned_threads, c
 		struct Tile<Weight>& A_tile = (not(l%2)) ? input_features->tiles[my_rowgroup][0]
                                                  : output->tiles[my_rowgroup][0];
         std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT = A_tile.spmat;
-        struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];    
-        std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = B_tile.spmat;
+        std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = layer_spmat(l, tid);
         struct Tile<Weight>& C_tile = (not(l%2)) ? output->tiles[my_rowgroup][0]
                                                  : input_features->tiles[my_rowgroup][0];
         std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
-		std::shared_ptr<struct Data_Block<Weight>> s_spa = spa_vectors[tid];
+		std::shared_ptr<struct Accumulator<Weight>> s_acc = accumulators[tid];
+		s_acc->layer = l;
         std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];      
         
 		A_nrows = A_SPMAT->nrows;
@@ -897,9 +1608,14 @@ uint32_t Net<Weight>::hybrid_x_data(std::deque<int32_t>& leader_owned_threads, c
 		//
 		//printf("2.tid=%d l=%d A[%d %d] B[%d %d] [%lu %lu]\n", tid, l, A_nrows, A_ncols, B_nrows, B_ncols, A_SPMAT->nnz, B_SPMAT->nnz);
 		bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-		data_x_data_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
+		data_x_data_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias,
                            A_nrows, B_ncols, start, end, off, 
-                           thread_st, last_layer, leader_tid, tid); 
+                           thread_st, last_layer, fused_spmm, leader_tid, tid); 
+        /* Only while the rowgroup is private to its thread, the model phase keeps the rows it starts with */
+        if(row_compaction) {
+            C_SPMAT->compact_rows(row_maps[my_rowgroup]);
+            s_acc->live_rows[l] += C_SPMAT->nrows;
+        }
 						   
         Env::scores[sid][tid]++;     
         //printf("3.tid=%d l=%d\n", tid, l);
@@ -909,6 +1625,7 @@ uint32_t Net<Weight>::hybrid_x_data(std::deque<int32_t>& leader_owned_threads, c
 }
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::hybrid_x_model(std::deque<int32_t>& leader_owned_threads, const uint32_t leader_rowgroup, const uint32_t leader_start_layer, const uint32_t leader_current_layer, const int32_t leader_tid, const int32_t tid) {
     int32_t sid = (numa_queues) ? Env::threads_socket_id[tid] : Env::rank_socket_id;
     struct Env::thread_struct& thread_st = Env::threads[tid];    
@@ -926,13 +1643,13 @@ void Net<Weight>::hybrid_x_model(std::deque<int32_t>& leader_owned_threads, cons
 	//start_row = A_tile.start_row;
 	//struct Tile<Weight>& A_tile =  input_features->tiles[leader_rowgroup][0];
     //struct Tile<Weight>& C_tile = output->tiles[leader_rowgroup][0];
-	B_ncols = layers[leader_current_layer]->tiles[0][0].spmat->ncols;
+	B_ncols = layer_spmat(leader_current_layer, tid)->ncols;
     for (uint32_t l = leader_current_layer; l < nmax_layers; l++) {
 		std::shared_ptr<struct Compressed_Format<Weight>>& A_SPMAT = A_tile.spmat;
-		struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];
-        std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = B_tile.spmat;
+        std::shared_ptr<struct Compressed_Format<Weight>>& B_SPMAT = layer_spmat(l, tid);
         std::shared_ptr<struct Compressed_Format<Weight>>& C_SPMAT = C_tile.spmat;
-		std::shared_ptr<struct Data_Block<Weight>>& s_spa = spa_vectors[tid];
+		std::shared_ptr<struct Accumulator<Weight>>& s_acc = accumulators[tid];
+		s_acc->layer = l;
         std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];
 		
 		B_ncols_prev = B_ncols;
@@ -983,12 +1700,14 @@ void Net<Weight>::hybrid_x_model(std::deque<int32_t>& leader_owned_threads, cons
 		//printf("M:tid=%d/%d/%lu l=%d r=%d A[%d %d] B[%d %d] [%d %d] [%lu %lu]\n", tid, leader_tid, leader_owned_threads.size(), l, leader_rowgroup, A_nrows, A_ncols, B_nrows, B_ncols, start, end, A_SPMAT->nnz, B_SPMAT->nnz);
 		//if(tid==leader_tid) {for(auto t: leader_owned_threads) {printf("%d ", t);} printf("l=%d\n", l);}
 		bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-        data_x_model_hybrid_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
+        std::shared_ptr<struct Compressed_Format<Weight>> S_SPMAT = (output_segments.empty()) ? nullptr : output_segments[tid];
+        data_x_model_hybrid_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, S_SPMAT, s_acc, b_bias,
                A_nrows, B_ncols, start, end, off,
-               leader_owned_threads, thread_st, last_layer, leader_tid, tid);
+               leader_owned_threads, thread_st, last_layer, fused_spmm, leader_tid, tid);
 		//pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
        if(tid == leader_tid) Env::scores[sid][tid]++;
     }
+    if(tid == leader_tid) A_tile.spmat->flatten();
 	//printf("done hybrid %d\n", tid);
 }
 
@@ -1181,6 +1900,7 @@ bool Net<Weight>::add_to_idle_threads(std::deque<int32_t>& leader_owned_threads,
 }
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::manager_x_worker(const int32_t tid) {
 	auto start_t = std::chrono::high_resolution_clock::now(); 
     uint32_t leader_rowgroup = 0;
@@ -1206,12 +1926,12 @@ void Net<Weight>::manager_x_worker(const int32_t tid) {
             struct Tile<Weight>& A_tile = (not(l%2)) ? input_features->tiles[leader_rowgroup][0]
                                                      : output->tiles[leader_rowgroup][0];
             std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT = A_tile.spmat;
-            struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];    
-            std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = B_tile.spmat;
+            std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = layer_spmat(l, tid);
             struct Tile<Weight>& C_tile = (not(l%2)) ? output->tiles[leader_rowgroup][0]
                                                      : input_features->tiles[leader_rowgroup][0];
             std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
-            std::shared_ptr<struct Data_Block<Weight>>& s_spa = spa_vectors[tid];
+            std::shared_ptr<struct Accumulator<Weight>>& s_acc = accumulators[tid];
+            s_acc->layer = l;
 			std::shared_ptr<struct Data_Block<Weight>>& b_bias = bias_vectors[l];    
             
 			A_nrows = A_SPMAT->nrows;
@@ -1225,9 +1945,14 @@ void Net<Weight>::manager_x_worker(const int32_t tid) {
 				std::exit(Env::finalize());
 			}
             bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-            data_x_data_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
+            data_x_data_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias,
                                A_nrows, B_ncols, start, end, off, 
-                               thread_st, last_layer, leader_tid, tid);       
+                               thread_st, last_layer, fused_spmm, leader_tid, tid);       
+            if(row_compaction) {
+                C_SPMAT->compact_rows(row_maps[leader_rowgroup]);
+                s_acc->live_rows[l] += C_SPMAT->nrows;
+                if(l == nmax_layers-1) C_SPMAT->restore_rows(row_maps[leader_rowgroup], C_tile.height);
+            }
         }   
     }
     auto finish_t = std::chrono::high_resolution_clock::now();
@@ -1239,6 +1964,7 @@ void Net<Weight>::manager_x_worker(const int32_t tid) {
 
 
 template<typename Weight>
+template<typename Activation>
 void Net<Weight>::work_x_stealing(const int32_t tid) {
 	auto start_t = std::chrono::high_resolution_clock::now();  
     uint32_t leader_rowgroup = 0;
@@ -1269,12 +1995,12 @@ void Net<Weight>::work_x_stealing(const int32_t tid) {
             struct Tile<Weight>& A_tile = (not(l%2)) ? input_features->tiles[leader_rowgroup][0]
                                                      : output->tiles[leader_rowgroup][0];
             std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT = A_tile.spmat;
-            struct Tile<Weight>& B_tile = layers[l]->tiles[0][0];    
-            std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = B_tile.spmat;
+            std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT = layer_spmat(l, tid);
             struct Tile<Weight>& C_tile = (not(l%2)) ? output->tiles[leader_rowgroup][0]
                                                      : input_features->tiles[leader_rowgroup][0];
             std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT = C_tile.spmat;
-			std::shared_ptr<struct Data_Block<Weight>> s_spa = spa_vectors[tid];
+			std::shared_ptr<struct Accumulator<Weight>> s_acc = accumulators[tid];
+			s_acc->layer = l;
 			std::shared_ptr<struct Data_Block<Weight>> b_bias = bias_vectors[l];  
 		
 			A_nrows = A_SPMAT->nrows;
@@ -1288,9 +2014,14 @@ void Net<Weight>::work_x_stealing(const int32_t tid) {
 				std::exit(Env::finalize());
 			}
             bool last_layer = (category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) and (l==nmax_layers-1);
-            data_x_data_1_iter(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, activation_function,
+            data_x_data_1_iter<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias,
                                A_nrows, B_ncols, start, end, off, 
-                               thread_st, last_layer, leader_tid, tid);       
+                               thread_st, last_layer, fused_spmm, leader_tid, tid);       
+            if(row_compaction) {
+                C_SPMAT->compact_rows(row_maps[leader_rowgroup]);
+                s_acc->live_rows[l] += C_SPMAT->nrows;
+                if(l == nmax_layers-1) C_SPMAT->restore_rows(row_maps[leader_rowgroup], C_tile.height);
+            }
         }   
     }
 
@@ -8,15 +8,17 @@
 #define SPMAT_HPP
 
 #include <numeric>
+#include <algorithm>
 #include <limits.h>
 #include <tuple>
 
 #include "allocator.hpp"
 #include "triple.hpp"
 #include "env.hpp"
+#include "activations.hpp"
 
-enum COMPRESSED_FORMAT {_CSR_, _DCSR_, _TCSR_, _CSC_, _DCSC_, _TCSC_};
-const char* COMPRESSED_FORMATS[] = {"_CSR_", "_DCSR_", "_TCSR_", "_CSC_", "_DCSC_", "_TCSC_"};
+enum COMPRESSED_FORMAT {_CSR_, _DCSR_, _TCSR_, _CSC_, _DCSC_, _TCSC_, _DENSE_};
+const char* COMPRESSED_FORMATS[] = {"_CSR_", "_DCSR_", "_TCSR_", "_CSC_", "_DCSC_", "_TCSC_", "_DENSE_"};
 
 
 template<typename Weight>
@@ -30,7 +32,6 @@ struct Compressed_Format {
         // If tile height and width are not necessarily multiples of nrows and ncols 
         //virtual void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         //virtual void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
-		virtual void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid){Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
 		//virtual void populate_spa_softmax(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid){Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         virtual void walk_dxm1(const bool one_rank, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         virtual void walk_dxm(const bool one_rank, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
@@ -41,6 +42,25 @@ struct Compressed_Format {
         virtual void adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         virtual void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         virtual void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Grow the storage to nnz_ entries (keeping the existing ones) and reset the dimensions without clearing
+        virtual void expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Copy a thread segment produced by the fused SpMM into this matrix starting at index
+        virtual void stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Renumber the nonempty rows 0..nlive-1, rows maps them back to the rows of the tile (empty is the identity)
+        virtual void compact_rows(std::vector<uint32_t>& rows) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Undo compact_rows, back to nrows_ rows
+        virtual void restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Copy rows [start_row, end_row) of other_spmat into this matrix as rows 0..end_row-start_row-1
+        virtual void extract_rows(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t end_row) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Stack the row blocks back into one matrix, block b starting at row start_rows[b]
+        virtual void stack_rows(const std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks, const std::vector<uint32_t>& start_rows, const uint32_t nblocks, const uint32_t nrows_, const uint32_t ncols_) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Keep the thread segments the model parallel SpMM wrote in place instead of copying them together
+        virtual void segment(const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        virtual void segment(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid) {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
+        // Close the gaps between the segments, only a segmented CSC or CSR has any
+        virtual void flatten() {}
+        // Bytes held by the storage blocks
+        virtual uint64_t nbytes() const {Logging::print(Logging::LOG_LEVEL::ERROR, "Not implemented\n"); std::exit(Env::finalize());}
         
         COMPRESSED_FORMAT compression_type;
         
@@ -48,25 +68,46 @@ struct Compressed_Format {
         uint64_t nnz_i = 0;
         uint32_t nrows = 0;
         uint32_t ncols = 0;
+        /* Pattern matrices (all values equal, e.g. Radix-Net layers or binary inputs) drop A_blk
+           and the kernels use pattern_value instead, until the matrix is reallocated */
+        bool   pattern = false;
+        Weight pattern_value = 0;
+        std::shared_ptr<struct Compressed_Format<Weight>> dual = nullptr; /* The same matrix in the other orientation (CSR of a CSC layer) */
         
         std::shared_ptr<struct Data_Block<uint32_t>> IA_blk;
         std::shared_ptr<struct Data_Block<uint32_t>> JA_blk;
         std::shared_ptr<struct Data_Block<Weight>>   A_blk;
 };
 
+template<typename Weight>
+bool uniform_weights(const std::vector<struct Triple<Weight>>& triples) {
+    for(auto& triple: triples) {
+        if(triple.weight != triples.front().weight) return(false);
+    }
+    return(not triples.empty());
+}
+
+template<typename Weight>
+struct CSC;
+
 template<typename Weight>
 struct CSR: public Compressed_Format<Weight> {
     public:
         CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
         CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id);
         //CSR(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width, const int32_t socket_id);
+        CSR(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const int32_t socket_id);
+        CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, uint32_t* IA, uint32_t* JA, Weight* A);
         ~CSR(){};
         
         //void populate(std::vector<struct Triple<Weight>>& triples);
         void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width);
         //void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width);
         //void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
-		void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid);
+		template<typename Activation>
+		void populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
+		template<typename Activation>
+		void populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
 		//void populate_spa_softmax(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid);
         void walk_dxm1(const bool one_rank, const int32_t leader_tid, const int32_t tid){};
         void walk_dxm(const bool one_rank, const int32_t leader_tid, const int32_t tid);
@@ -77,19 +118,37 @@ struct CSR: public Compressed_Format<Weight> {
         void adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
         void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid);
         void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
+        void stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid);
+        void compact_rows(std::vector<uint32_t>& rows);
+        void restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_);
+        void extract_rows(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t end_row);
+        void stack_rows(const std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks, const std::vector<uint32_t>& start_rows, const uint32_t nblocks, const uint32_t nrows_, const uint32_t ncols_);
+        void segment(const int32_t leader_tid, const int32_t tid);
+        void segment(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void flatten();
+        uint64_t nbytes() const;
         
         uint64_t nnz   = 0;
         uint64_t nnz_i = 0;
         uint32_t nrows = 0;
         uint32_t ncols = 0;
+        /* Same as a segmented CSC with rows for columns, row i is [IB[i], IA[i+1]) */
+        bool segmented = false;
         
         std::shared_ptr<struct Data_Block<uint32_t>> IA_blk;
         std::shared_ptr<struct Data_Block<uint32_t>> JA_blk;
         std::shared_ptr<struct Data_Block<Weight>>   A_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> IB_blk;
 };
 
 
 /* Compressed Sparse Row (CSR) */
+template<typename Weight>
+uint64_t CSR<Weight>::nbytes() const {
+    return(((IA_blk) ? IA_blk->nbytes : 0) + ((JA_blk) ? JA_blk->nbytes : 0) + ((A_blk) ? A_blk->nbytes : 0) + ((IB_blk) ? IB_blk->nbytes : 0));
+}
+
 template<typename Weight>
 CSR<Weight>::CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id) {
     Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSR_;
@@ -109,6 +168,75 @@ CSR<Weight>::CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncol
     CSR::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(CSR::nnz, socket_id));
 }
 
+/* CSR orientation of a CSC matrix, rows come out sorted as the columns are walked in order */
+template<typename Weight>
+CSR<Weight>::CSR(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const int32_t socket_id) {
+    std::shared_ptr<struct CSC<Weight>> other_csc = std::static_pointer_cast<struct CSC<Weight>>(other_spmat);
+    uint32_t  o_ncols = other_csc->ncols;
+    uint32_t  o_nrows = other_csc->nrows;
+    uint32_t* o_JA    = other_csc->JA_blk->ptr;
+    uint32_t* o_IA    = other_csc->IA_blk->ptr;
+    Weight*   o_A     = other_csc->A_blk->ptr;
+    uint64_t  o_nnz   = o_JA[o_ncols];
+    
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSR_;
+    Compressed_Format<Weight>::nnz = o_nnz;
+    Compressed_Format<Weight>::nnz_i = o_nnz;
+    Compressed_Format<Weight>::nrows = o_nrows; 
+    Compressed_Format<Weight>::ncols = o_ncols;
+    Compressed_Format<Weight>::pattern = other_csc->pattern;
+    Compressed_Format<Weight>::pattern_value = other_csc->pattern_value;
+    
+    CSR::compression_type = COMPRESSED_FORMAT::_CSR_;
+    CSR::nnz = o_nnz;
+    CSR::nnz_i = o_nnz;
+    CSR::nrows = o_nrows; 
+    CSR::ncols = o_ncols;
+    
+    CSR::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>((CSR::nrows + 1), socket_id));
+    CSR::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSR::nnz, socket_id));
+    CSR::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>((o_A) ? CSR::nnz : 0, socket_id));
+    
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    
+    memset(IA, 0, (CSR::nrows + 1) * sizeof(uint32_t));
+    for(uint64_t i = 0; i < o_nnz; i++) IA[o_IA[i] + 1]++;
+    for(uint32_t i = 0; i < CSR::nrows; i++) IA[i + 1] += IA[i];
+    for(uint32_t j = 0; j < o_ncols; j++) {
+        for(uint32_t i = o_JA[j]; i < o_JA[j + 1]; i++) {
+            uint32_t& k = IA[o_IA[i]];
+            JA[k] = j;
+            if(A) A[k] = o_A[i];
+            k++;
+        }
+    }
+    // IA[i] now ends row i, shift it back to its start
+    for(uint32_t i = CSR::nrows; i > 0; i--) IA[i] = IA[i - 1];
+    IA[0] = 0;
+}
+
+/* A CSR over arrays owned elsewhere (A is null for patterns) */
+template<typename Weight>
+CSR<Weight>::CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, uint32_t* IA, uint32_t* JA, Weight* A) {
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSR_;
+    Compressed_Format<Weight>::nnz = nnz_;
+    Compressed_Format<Weight>::nnz_i = nnz_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    
+    CSR::compression_type = COMPRESSED_FORMAT::_CSR_;
+    CSR::nnz = nnz_;
+    CSR::nnz_i = nnz_;
+    CSR::nrows = nrows_; 
+    CSR::ncols = ncols_;
+    
+    CSR::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(IA, (CSR::nrows + 1)));
+    CSR::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(JA, CSR::nnz));
+    CSR::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(A, (A) ? CSR::nnz : 0));
+}
+
 template<typename Weight>
 CSR<Weight>::CSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {
     Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSR_;
@@ -265,7 +393,13 @@ void CSR<Weight>::populate(std::vector<struct Triple<Weight>>& triples, const ui
         IA[i] = IA[i - 1];
     }
 
-    CSR::nnz_i = CSR::nnz; 	
+    CSR::nnz_i = CSR::nnz;
+    
+    if(uniform_weights(triples)) {
+        Compressed_Format<Weight>::pattern = true;
+        Compressed_Format<Weight>::pattern_value = triples.front().weight;
+        CSR::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(0, CSR::A_blk->socket_id));
+    }
 }
 /*
 template<typename Weight>
@@ -329,27 +463,81 @@ void CSR<Weight>::populate_spa_softmax(Weight** spa, const Weight* bias, const u
 */
 
 template<typename Weight>
-void CSR<Weight>::populate_spa(Weight** spa, const Weight* bias, const uint32_t row, uint64_t& index, Weight(*activation_function)(Weight), const int32_t tid) {
+template<typename Activation>
+void CSR<Weight>::populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t row, uint64_t& index, const int32_t tid) {
     uint64_t&  k = index;
     uint32_t   r = row + 1;
     uint32_t* IA = CSR::IA_blk->ptr;
     uint32_t* JA = CSR::JA_blk->ptr;
     Weight*    A = CSR::A_blk->ptr;
     Weight*    s = *spa;
+    uint64_t*  m = bitmap;
     const Weight* b = bias;
     
-    for(uint32_t j = 0; j < CSR::ncols; j++) {
-        if(s[j]) {
-            s[j] += b[j];
-            //s[j] = (s[j] < YMIN) ? YMIN : (s[j] > YMAX) ? YMAX : s[j];
-			s[j]=activation_function(s[j]);
+    if(not m) {
+        for(uint32_t j = 0; j < CSR::ncols; j++) {
             if(s[j]) {
+                s[j] += b[j];
+                s[j]=Activation::apply(s[j]);
+                if(s[j]) {
+                    JA[k] = j;
+                    A[k] = s[j];
+                    k++;
+                    s[j] = 0;
+                }
+            }
+        }
+        IA[r] = k;
+        return;
+    }
+    
+    /* Visit only the touched columns, lowest bit first to keep JA sorted */
+    const uint32_t nwords = (CSR::ncols + 63) >> 6;
+    for(uint32_t w = 0; w < nwords; w++) {
+        uint64_t word = m[w];
+        if(not word) continue;
+        m[w] = 0;
+        while(word) {
+            uint32_t j = (w << 6) + __builtin_ctzll(word);
+            word &= (word - 1);
+            if(s[j]) {
+                s[j] += b[j];
+                s[j]=Activation::apply(s[j]);
+                if(s[j]) {
+                    JA[k] = j;
+                    A[k] = s[j];
+                    k++;
+                    s[j] = 0;
+                }
+            }
+        }
+    }
+    IA[r] = k;
+}
+
+/* Same as populate_spa, but the row comes from a hash or sort accumulator as columns sorted with their values */
+template<typename Weight>
+template<typename Activation>
+void CSR<Weight>::populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t row, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t   r = row + 1;
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    const Weight* b = bias;
+    
+    for(uint32_t n = 0; n < nitems; n++) {
+        uint32_t j = list_idx[n];
+        Weight   v = list_val[n];
+        if(v) {
+            v += b[j];
+            v = Activation::apply(v);
+            if(v) {
                 JA[k] = j;
-                A[k] = s[j];
+                A[k] = v;
                 k++;
-                s[j] = 0;
             }
-       }
+        }
     }
     IA[r] = k;
 }
@@ -466,12 +654,13 @@ void CSR<Weight>::reallocate(const uint64_t nnz_, const uint32_t nrows_, const u
         CSR::nnz_i = 0;
         CSR::nrows = nrows_; 
         CSR::ncols = ncols_;
+        // Every row pointer is written by the SpMM, and entries only up to them
 		CSR::IA_blk->reallocate(CSR::nrows+1);
-		CSR::IA_blk->clear();
         CSR::JA_blk->reallocate(CSR::nnz);
-		CSR::JA_blk->clear();
         CSR::A_blk->reallocate(CSR::nnz);
-        CSR::A_blk->clear();    
+        CSR::IA_blk->ptr[0] = 0;
+        CSR::segmented = false;
+        Compressed_Format<Weight>::pattern = false;
         Compressed_Format<Weight>::nnz = nnz_;
         Compressed_Format<Weight>::nnz_i = 0;
         Compressed_Format<Weight>::nrows = nrows_; 
@@ -536,9 +725,8 @@ void CSR<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
 		CSR::IA_blk->reallocate(CSR::nrows+1);
         CSR::IA_blk->clear();
         CSR::JA_blk->reallocate(CSR::nnz_i);
-        CSR::JA_blk->clear();
         CSR::A_blk->reallocate(CSR::nnz_i);
-        CSR::A_blk->clear();
+        Compressed_Format<Weight>::pattern = false;
         
         Compressed_Format<Weight>::nnz = CSR::nnz_i;
         Compressed_Format<Weight>::nnz_i = CSR::nnz_i;
@@ -597,9 +785,8 @@ void CSR<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
 		CSR::IA_blk->reallocate(CSR::nrows+1);
         CSR::IA_blk->clear();
         CSR::JA_blk->reallocate(CSR::nnz_i);
-        CSR::JA_blk->clear();
         CSR::A_blk->reallocate(CSR::nnz_i);
-        CSR::A_blk->clear();
+        Compressed_Format<Weight>::pattern = false;
         
         Compressed_Format<Weight>::nnz = CSR::nnz_i;
         Compressed_Format<Weight>::nnz_i = CSR::nnz_i;
@@ -728,12 +915,214 @@ void CSR<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
     */
 }
 
+template<typename Weight>
+void CSR<Weight>::expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {
+    if(nnz_ > CSR::nnz) {
+        CSR::JA_blk->reallocate(nnz_);
+        CSR::A_blk->reallocate(nnz_);
+        CSR::nnz = nnz_;
+        Compressed_Format<Weight>::nnz = nnz_;
+    }
+    if(nrows_ != CSR::nrows) {
+        CSR::IA_blk->reallocate(nrows_+1);
+    }
+    CSR::nrows = nrows_; 
+    CSR::ncols = ncols_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+}
+
+template<typename Weight>
+void CSR<Weight>::stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid) {
+    std::shared_ptr<struct CSR<Weight>> other_csr = std::static_pointer_cast<struct CSR<Weight>>(other_spmat);
+    uint32_t* o_IA = other_csr->IA_blk->ptr;
+    uint32_t* o_JA = other_csr->JA_blk->ptr;
+    Weight*   o_A  = other_csr->A_blk->ptr;
+    
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    
+    uint64_t& k = index;
+    if(start < end) {
+        // The segment always starts at zero, so its last row pointer is its length
+        const uint64_t o_nnz_i = o_IA[off + end];
+        memcpy(JA + k, o_JA, o_nnz_i * sizeof(uint32_t));
+        memcpy(A + k, o_A, o_nnz_i * sizeof(Weight));
+        for(uint32_t i = off + start; i < off + end; i++) {
+            IA[i+1] = o_IA[i+1] + k;
+        }
+        k += o_nnz_i;
+    }
+}
+
+/* Rows are dropped from IA, JA and A stay where they are */
+template<typename Weight>
+void CSR<Weight>::compact_rows(std::vector<uint32_t>& rows) {
+    uint32_t* IA = CSR::IA_blk->ptr;
+    
+    if(rows.empty()) {
+        rows.resize(CSR::nrows);
+        std::iota(rows.begin(), rows.end(), 0);
+    }
+    uint32_t nlive = 0;
+    uint32_t begin = IA[0];
+    for(uint32_t i = 0; i < CSR::nrows; i++) {
+        uint32_t end = IA[i+1];
+        if(end > begin) {
+            rows[nlive] = rows[i];
+            IA[nlive+1] = end;
+            nlive++;
+        }
+        begin = end;
+    }
+    rows.resize(nlive);
+    CSR::nrows = nlive;
+    Compressed_Format<Weight>::nrows = nlive;
+}
+
+template<typename Weight>
+void CSR<Weight>::restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_) {
+    if(not rows.empty()) {
+        std::vector<uint32_t> o_IA(CSR::IA_blk->ptr, CSR::IA_blk->ptr + CSR::nrows + 1);
+        CSR::IA_blk->reallocate(nrows_ + 1);
+        uint32_t* IA = CSR::IA_blk->ptr;
+        uint32_t i = 0;
+        for(uint32_t p = 0; p < CSR::nrows; p++) {
+            for(; i <= rows[p]; i++) IA[i] = o_IA[p];
+        }
+        for(; i <= nrows_; i++) IA[i] = o_IA[CSR::nrows];
+    }
+    CSR::nrows = nrows_;
+    Compressed_Format<Weight>::nrows = nrows_;
+}
+
+template<typename Weight>
+void CSR<Weight>::extract_rows(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t end_row) {
+    std::shared_ptr<struct CSR<Weight>> other_csr = std::static_pointer_cast<struct CSR<Weight>>(other_spmat);
+    uint32_t* o_IA = other_csr->IA_blk->ptr;
+    uint32_t* o_JA = other_csr->JA_blk->ptr;
+    Weight*   o_A  = other_csr->A_blk->ptr;
+    
+    const uint64_t o_start = o_IA[start_row];
+    const uint64_t nnz_ = o_IA[end_row] - o_start;
+    CSR::reallocate(nnz_, end_row - start_row, other_csr->ncols, -1, 0);
+    
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    for(uint32_t i = start_row; i < end_row; i++) {
+        IA[i - start_row + 1] = o_IA[i + 1] - o_start;
+    }
+    memcpy(JA, o_JA + o_start, nnz_ * sizeof(uint32_t));
+    if(o_A) memcpy(A, o_A + o_start, nnz_ * sizeof(Weight));
+    else std::fill(A, A + nnz_, other_csr->pattern_value);
+    CSR::nnz_i = nnz_;
+    Compressed_Format<Weight>::nnz_i = nnz_;
+}
+
+template<typename Weight>
+void CSR<Weight>::stack_rows(const std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks, const std::vector<uint32_t>& start_rows, const uint32_t nblocks, const uint32_t nrows_, const uint32_t ncols_) {
+    uint64_t nnz_ = 0;
+    for(uint32_t b = 0; b < nblocks; b++) {
+        std::shared_ptr<struct CSR<Weight>> block = std::static_pointer_cast<struct CSR<Weight>>(blocks[b]);
+        nnz_ += block->IA_blk->ptr[block->nrows];
+    }
+    CSR::reallocate(nnz_, nrows_, ncols_, -1, 0);
+    
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    uint64_t k = 0;
+    for(uint32_t b = 0; b < nblocks; b++) {
+        std::shared_ptr<struct CSR<Weight>> block = std::static_pointer_cast<struct CSR<Weight>>(blocks[b]);
+        uint32_t* b_IA = block->IA_blk->ptr;
+        const uint64_t b_nnz = b_IA[block->nrows];
+        memcpy(JA + k, block->JA_blk->ptr, b_nnz * sizeof(uint32_t));
+        memcpy(A + k, block->A_blk->ptr, b_nnz * sizeof(Weight));
+        for(uint32_t i = 0; i < block->nrows; i++) {
+            IA[start_rows[b] + i + 1] = b_IA[i + 1] + k;
+        }
+        k += b_nnz;
+    }
+    CSR::nnz_i = k;
+    Compressed_Format<Weight>::nnz_i = k;
+}
+
+/* After spmm_real the rows of a thread start at its off_nnz, while IA[start_row] is where 
+   the previous thread stopped. IB records the former so the next layer can read the matrix as is. */
+template<typename Weight>
+void CSR<Weight>::segment(const int32_t leader_tid, const int32_t tid) {
+    if(tid == leader_tid) {
+        if(not CSR::IB_blk) CSR::IB_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSR::nrows + 1, CSR::IA_blk->socket_id));
+        else if(CSR::IB_blk->nitems < (CSR::nrows + 1)) CSR::IB_blk->reallocate(CSR::nrows + 1);
+        CSR::segmented = true;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+    
+    const uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* IB = CSR::IB_blk->ptr;
+    const uint32_t start_row = Env::threads[tid].start_row;
+    const uint32_t end_row   = Env::threads[tid].end_row;
+    for(uint32_t i = start_row; i < end_row; i++) {
+        IB[i] = (i == start_row) ? Env::threads[tid].off_nnz : IA[i];
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+}
+
+template<typename Weight>
+void CSR<Weight>::segment(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid) {
+    if(tid == leader_tid) {
+        if(not CSR::IB_blk) CSR::IB_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSR::nrows + 1, CSR::IA_blk->socket_id));
+        else if(CSR::IB_blk->nitems < (CSR::nrows + 1)) CSR::IB_blk->reallocate(CSR::nrows + 1);
+        CSR::segmented = true;
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+    
+    const uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* IB = CSR::IB_blk->ptr;
+    const uint32_t start_row = Env::threads[tid].start_row;
+    const uint32_t end_row   = Env::threads[tid].end_row;
+    for(uint32_t i = start_row; i < end_row; i++) {
+        IB[i] = (i == start_row) ? Env::threads[tid].off_nnz : IA[i];
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+/* Moves the segments down over the gaps, single threaded */
+template<typename Weight>
+void CSR<Weight>::flatten() {
+    if(not CSR::segmented) return;
+    uint32_t* IA = CSR::IA_blk->ptr;
+    uint32_t* JA = CSR::JA_blk->ptr;
+    Weight*    A = CSR::A_blk->ptr;
+    const uint32_t* IB = CSR::IB_blk->ptr;
+    
+    uint64_t k = 0;
+    for(uint32_t i = 0; i < CSR::nrows; i++) {
+        const uint32_t begin = IB[i];
+        const uint32_t end = IA[i+1];
+        if(begin != k) {
+            memmove(JA + k, JA + begin, (end - begin) * sizeof(uint32_t));
+            memmove(A + k, A + begin, (end - begin) * sizeof(Weight));
+        }
+        k += end - begin;
+        IA[i+1] = k;
+    }
+    IA[0] = 0;
+    CSR::segmented = false;
+    CSR::nnz_i = k;
+    Compressed_Format<Weight>::nnz_i = k;
+}
+
 /* Compressed Sparse Column (CSC) */
 template<typename Weight>
 struct CSC: public Compressed_Format<Weight> {
     public:
         CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
         CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id);        
+        CSC(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const int32_t socket_id);
+        CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, uint32_t* JA, uint32_t* IA, Weight* A);
         //CSC(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width, const int32_t socket_id);
         ~CSC(){};
         
@@ -741,7 +1130,12 @@ struct CSC: public Compressed_Format<Weight> {
         void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width);
         //void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width);
         //void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
-		void populate_spa(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid);
+		template<typename Activation>
+		void populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
+		template<typename Activation>
+		void populate_spa_rows(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col, const uint32_t start_row, const uint32_t end_row, uint64_t& index, const int32_t tid);
+		template<typename Activation>
+		void populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
 		//void populate_spa_softmax(Weight** spa, const Weight* bias, const uint32_t col,  uint64_t& index, Weight (*)(Weight), const int32_t tid);
         void walk_dxm1(const bool one_rank, const int32_t leader_tid, const int32_t tid);
         void walk_dxm(const bool one_rank, const int32_t leader_tid, const int32_t tid);
@@ -752,17 +1146,37 @@ struct CSC: public Compressed_Format<Weight> {
         void adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
         void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid);
         void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
+        void stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid);
+        void compact_rows(std::vector<uint32_t>& rows);
+        void restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_);
+        void extract_rows(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t end_row);
+        void stack_rows(const std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks, const std::vector<uint32_t>& start_rows, const uint32_t nblocks, const uint32_t nrows_, const uint32_t ncols_);
+        void segment(const int32_t leader_tid, const int32_t tid);
+        void segment(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void flatten();
+        uint64_t nbytes() const;
         
         uint64_t nnz   = 0;
         uint64_t nnz_i = 0;
         uint32_t nrows = 0;
         uint32_t ncols = 0;
+        /* A segmented matrix keeps the gap a thread leaves between its last entry and the offset of 
+           the next thread, column j is [JB[j], JA[j+1]) and JB only differs from JA at the first 
+           column of a thread. Reallocating drops it. */
+        bool segmented = false;
         
         std::shared_ptr<struct Data_Block<uint32_t>> IA_blk;
         std::shared_ptr<struct Data_Block<uint32_t>> JA_blk;
         std::shared_ptr<struct Data_Block<Weight>>   A_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> JB_blk;
 };
 
+template<typename Weight>
+uint64_t CSC<Weight>::nbytes() const {
+    return(((IA_blk) ? IA_blk->nbytes : 0) + ((JA_blk) ? JA_blk->nbytes : 0) + ((A_blk) ? A_blk->nbytes : 0) + ((JB_blk) ? JB_blk->nbytes : 0));
+}
+
 template<typename Weight>
 CSC<Weight>::CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id) {
     Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSC_;
@@ -800,6 +1214,60 @@ CSC<Weight>::CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncol
     CSC::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSC::nnz, Env::rank_socket_id));
     CSC::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(CSC::nnz, Env::rank_socket_id));
 }
+/* Copy of a (flat) CSC on socket_id, e.g. the per socket replicas of a layer */
+template<typename Weight>
+CSC<Weight>::CSC(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const int32_t socket_id) {
+    std::shared_ptr<struct CSC<Weight>> other_csc = std::static_pointer_cast<struct CSC<Weight>>(other_spmat);
+    uint32_t  o_ncols = other_csc->ncols;
+    uint32_t  o_nrows = other_csc->nrows;
+    uint64_t  o_nnz   = other_csc->nnz;
+    uint64_t  o_nnz_i = other_csc->nnz_i;
+    Weight*   o_A     = other_csc->A_blk->ptr;
+    
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSC_;
+    Compressed_Format<Weight>::nnz = o_nnz;
+    Compressed_Format<Weight>::nnz_i = o_nnz_i;
+    Compressed_Format<Weight>::nrows = o_nrows; 
+    Compressed_Format<Weight>::ncols = o_ncols;
+    Compressed_Format<Weight>::pattern = other_csc->pattern;
+    Compressed_Format<Weight>::pattern_value = other_csc->pattern_value;
+    Compressed_Format<Weight>::dual = other_csc->dual;
+    
+    CSC::compression_type = COMPRESSED_FORMAT::_CSC_;
+    CSC::nnz = o_nnz;
+    CSC::nnz_i = o_nnz_i;
+    CSC::nrows = o_nrows; 
+    CSC::ncols = o_ncols;
+    
+    CSC::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>((CSC::ncols + 1), socket_id));
+    CSC::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSC::nnz, socket_id));
+    CSC::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>((o_A) ? CSC::nnz : 0, socket_id));
+    
+    CSC::JA_blk->copy(other_csc->JA_blk->ptr);
+    CSC::IA_blk->copy(other_csc->IA_blk->ptr);
+    if(o_A) CSC::A_blk->copy(o_A);
+}
+
+/* A CSC over arrays owned elsewhere, e.g. layers in an MPI shared window (A is null for patterns) */
+template<typename Weight>
+CSC<Weight>::CSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, uint32_t* JA, uint32_t* IA, Weight* A) {
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_CSC_;
+    Compressed_Format<Weight>::nnz = nnz_;
+    Compressed_Format<Weight>::nnz_i = nnz_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    
+    CSC::compression_type = COMPRESSED_FORMAT::_CSC_;
+    CSC::nnz = nnz_;
+    CSC::nnz_i = nnz_;
+    CSC::nrows = nrows_; 
+    CSC::ncols = ncols_;
+    
+    CSC::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(JA, (CSC::ncols + 1)));
+    CSC::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(IA, CSC::nnz));
+    CSC::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(A, (A) ? CSC::nnz : 0));
+}
+
 /*
 template<typename Weight>
 CSC<Weight>::CSC(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t tile_height, const uint32_t start_col, const uint32_t tile_width, const int32_t socket_id) {
@@ -938,6 +1406,12 @@ void CSC<Weight>::populate(std::vector<struct Triple<Weight>>& triples, const ui
         JA[j] = JA[j - 1];
     }
     CSC::nnz_i = CSC::nnz;
+    
+    if(uniform_weights(triples)) {
+        Compressed_Format<Weight>::pattern = true;
+        Compressed_Format<Weight>::pattern_value = triples.front().weight;
+        CSC::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(0, CSC::A_blk->socket_id));
+    }
 }
 /*
 template<typename Weight>
@@ -1033,29 +1507,52 @@ void CSC<Weight>::populate_spa_softmax(Weight** spa, const Weight* bias, const u
 */
 
 template<typename Weight>
-void CSC<Weight>::populate_spa(Weight** spa, const Weight* bias, const uint32_t col, uint64_t& index, Weight(*activation_function)(Weight), const int32_t tid) {
+template<typename Activation>
+void CSC<Weight>::populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col, uint64_t& index, const int32_t tid) {
     uint64_t&  k = index;
     uint32_t   c = col + 1;
     uint32_t* IA = CSC::IA_blk->ptr;
     uint32_t* JA = CSC::JA_blk->ptr;
     Weight*    A = CSC::A_blk->ptr;
     Weight*    s = *spa;
+    uint64_t*  m = bitmap;
     const Weight* b = bias;
     
-    /* ReLU activation function thresholds */
-    //const Weight YMIN = 0; 
-    //const Weight YMAX = 32;
+    if(not m) {
+        for(uint32_t i = 0; i < CSC::nrows; i++) {
+            if(s[i]) {
+                s[i] += b[c-1];
+                s[i]=Activation::apply(s[i]);
+                if(s[i]) {
+                    IA[k] = i;
+                    A[k] = s[i];
+                    k++;
+                    s[i] = 0;
+                }
+            }
+        }
+        JA[c] = k;
+        return;
+    }
     
-    for(uint32_t i = 0; i < CSC::nrows; i++) {
-        if(s[i]) {
-            s[i] += b[c-1];
-            //s[i] = (s[i] < YMIN) ? YMIN : (s[i] > YMAX) ? YMAX : s[i];
-			s[i]=activation_function(s[i]);
+    /* Visit only the touched rows, lowest bit first to keep IA sorted */
+    const uint32_t nwords = (CSC::nrows + 63) >> 6;
+    for(uint32_t w = 0; w < nwords; w++) {
+        uint64_t word = m[w];
+        if(not word) continue;
+        m[w] = 0;
+        while(word) {
+            uint32_t i = (w << 6) + __builtin_ctzll(word);
+            word &= (word - 1);
             if(s[i]) {
-                IA[k] = i;
-                A[k] = s[i];
-                k++;
-                s[i] = 0;
+                s[i] += b[c-1];
+                s[i]=Activation::apply(s[i]);
+                if(s[i]) {
+                    IA[k] = i;
+                    A[k] = s[i];
+                    k++;
+                    s[i] = 0;
+                }
             }
         }
     }
@@ -1065,30 +1562,111 @@ void CSC<Weight>::populate_spa(Weight** spa, const Weight* bias, const uint32_t
 	//}
 }
 
+/* populate_spa restricted to the rows [start_row, end_row) of a row strip, start_row is a multiple of 64.
+   Strips are appended in order, so the column stays sorted. */
 template<typename Weight>
-void CSC<Weight>::walk_dxm(const bool one_rank, const int32_t leader_tid, const int32_t tid) {  
-    if(tid == leader_tid) {
-        uint32_t* IA = CSC::IA_blk->ptr;
-        uint32_t* JA = CSC::JA_blk->ptr;
-        Weight*    A = CSC::A_blk->ptr;
-        
-        double checksum = 0;
-        uint64_t checkcount = 0;
-        for(uint32_t j = 0; j < CSC::ncols; j++) {
-            //if(!Env::rank)
-            //    std::cout << "j=" << j << "," << j << ": " << JA[j] << "--" << JA[j + 1] << ": " <<  JA[j + 1] - JA[j] << std::endl;
-            for(uint32_t i = JA[j]; i < JA[j + 1]; i++) {
-                (void) IA[i];
-                (void) A[i];
-                checksum += A[i];
-                checkcount++;
-                //if(!Env::rank)
-                //    std::cout << "    i=" << i << ",i=" << IA[i] <<  ",value=" << A[i] << std::endl;
-            }
-        }
-
-        Env::barrier();
-        if(one_rank) {
+template<typename Activation>
+void CSC<Weight>::populate_spa_rows(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col, const uint32_t start_row, const uint32_t end_row, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t   c = col + 1;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    uint32_t* JA = CSC::JA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    Weight*    s = *spa;
+    uint64_t*  m = bitmap;
+    const Weight* b = bias;
+    
+    if(not m) {
+        for(uint32_t i = start_row; i < end_row; i++) {
+            if(s[i]) {
+                s[i] += b[c-1];
+                s[i]=Activation::apply(s[i]);
+                if(s[i]) {
+                    IA[k] = i;
+                    A[k] = s[i];
+                    k++;
+                    s[i] = 0;
+                }
+            }
+        }
+        JA[c] = k;
+        return;
+    }
+    
+    const uint32_t end_word = (end_row + 63) >> 6;
+    for(uint32_t w = (start_row >> 6); w < end_word; w++) {
+        uint64_t word = m[w];
+        if(not word) continue;
+        m[w] = 0;
+        while(word) {
+            uint32_t i = (w << 6) + __builtin_ctzll(word);
+            word &= (word - 1);
+            if(s[i]) {
+                s[i] += b[c-1];
+                s[i]=Activation::apply(s[i]);
+                if(s[i]) {
+                    IA[k] = i;
+                    A[k] = s[i];
+                    k++;
+                    s[i] = 0;
+                }
+            }
+        }
+    }
+    JA[c] = k;
+}
+
+/* Same as populate_spa, but the column comes from a hash or sort accumulator as rows sorted with their values */
+template<typename Weight>
+template<typename Activation>
+void CSC<Weight>::populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t col, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t   c = col + 1;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    uint32_t* JA = CSC::JA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    const Weight* b = bias;
+    
+    for(uint32_t n = 0; n < nitems; n++) {
+        uint32_t i = list_idx[n];
+        Weight   v = list_val[n];
+        if(v) {
+            v += b[c-1];
+            v = Activation::apply(v);
+            if(v) {
+                IA[k] = i;
+                A[k] = v;
+                k++;
+            }
+        }
+    }
+    JA[c] = k;
+}
+
+template<typename Weight>
+void CSC<Weight>::walk_dxm(const bool one_rank, const int32_t leader_tid, const int32_t tid) {  
+    if(tid == leader_tid) {
+        uint32_t* IA = CSC::IA_blk->ptr;
+        uint32_t* JA = CSC::JA_blk->ptr;
+        Weight*    A = CSC::A_blk->ptr;
+        
+        double checksum = 0;
+        uint64_t checkcount = 0;
+        for(uint32_t j = 0; j < CSC::ncols; j++) {
+            //if(!Env::rank)
+            //    std::cout << "j=" << j << "," << j << ": " << JA[j] << "--" << JA[j + 1] << ": " <<  JA[j + 1] - JA[j] << std::endl;
+            for(uint32_t i = JA[j]; i < JA[j + 1]; i++) {
+                (void) IA[i];
+                (void) A[i];
+                checksum += A[i];
+                checkcount++;
+                //if(!Env::rank)
+                //    std::cout << "    i=" << i << ",i=" << IA[i] <<  ",value=" << A[i] << std::endl;
+            }
+        }
+
+        Env::barrier();
+        if(one_rank) {
             Logging::print(Logging::LOG_LEVEL::INFO, "Iteration=%d, Total checksum=%f, Total count=%d\n", Env::iteration, checksum, checkcount);
         }
         else {
@@ -1211,12 +1789,13 @@ void CSC<Weight>::reallocate(const uint64_t nnz_, const uint32_t nrows_, const u
         CSC::nnz_i = 0;
         CSC::nrows = nrows_; 
         CSC::ncols = ncols_;
+        // Every column pointer is written by the SpMM, and entries only up to them
         CSC::JA_blk->reallocate(CSC::ncols+1);
-		CSC::JA_blk->clear();
         CSC::IA_blk->reallocate(CSC::nnz);
-		CSC::IA_blk->clear();
         CSC::A_blk->reallocate(CSC::nnz);
-        CSC::A_blk->clear();
+        CSC::JA_blk->ptr[0] = 0;
+        CSC::segmented = false;
+        Compressed_Format<Weight>::pattern = false;
         
         Compressed_Format<Weight>::nnz = nnz_;
         Compressed_Format<Weight>::nnz_i = 0;
@@ -1314,9 +1893,8 @@ void CSC<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
 		CSC::JA_blk->reallocate(CSC::ncols+1);
         CSC::JA_blk->clear();
         CSC::IA_blk->reallocate(CSC::nnz_i);
-        CSC::IA_blk->clear();
         CSC::A_blk->reallocate(CSC::nnz_i);
-        CSC::A_blk->clear();
+        Compressed_Format<Weight>::pattern = false;
 		//printf("%lu %lu %lu\n", CSC::JA_blk->nbytes, CSC::IA_blk->nbytes, CSC::A_blk->nbytes );
         Compressed_Format<Weight>::nnz = CSC::nnz_i;
         Compressed_Format<Weight>::nnz_i = CSC::nnz_i;
@@ -1406,9 +1984,8 @@ void CSC<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
 		CSC::JA_blk->reallocate(CSC::ncols+1);
         CSC::JA_blk->clear();
         CSC::IA_blk->reallocate(CSC::nnz_i);
-        CSC::IA_blk->clear();
         CSC::A_blk->reallocate(CSC::nnz_i);
-        CSC::A_blk->clear();
+        Compressed_Format<Weight>::pattern = false;
         Compressed_Format<Weight>::nnz = CSC::nnz_i;
         Compressed_Format<Weight>::nnz_i = CSC::nnz_i;
 		Compressed_Format<Weight>::nrows = CSC::nrows;
@@ -1550,6 +2127,225 @@ void CSC<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weig
     
 }
 
+template<typename Weight>
+void CSC<Weight>::expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {
+    if(nnz_ > CSC::nnz) {
+        CSC::IA_blk->reallocate(nnz_);
+        CSC::A_blk->reallocate(nnz_);
+        CSC::nnz = nnz_;
+        Compressed_Format<Weight>::nnz = nnz_;
+    }
+    if(ncols_ != CSC::ncols) {
+        CSC::JA_blk->reallocate(ncols_+1);
+    }
+    CSC::nrows = nrows_; 
+    CSC::ncols = ncols_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+}
+
+template<typename Weight>
+void CSC<Weight>::stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid) {
+    std::shared_ptr<struct CSC<Weight>> other_csc = std::static_pointer_cast<struct CSC<Weight>>(other_spmat);
+    uint32_t* o_JA = other_csc->JA_blk->ptr;
+    uint32_t* o_IA = other_csc->IA_blk->ptr;
+    Weight*   o_A  = other_csc->A_blk->ptr;
+    
+    uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    
+    uint64_t& k = index;
+    if(start < end) {
+        // The segment always starts at zero, so its last column pointer is its length
+        const uint64_t o_nnz_i = o_JA[off + end];
+        memcpy(IA + k, o_IA, o_nnz_i * sizeof(uint32_t));
+        memcpy(A + k, o_A, o_nnz_i * sizeof(Weight));
+        for(uint32_t j = off + start; j < off + end; j++) {
+            JA[j+1] = o_JA[j+1] + k;
+        }
+        k += o_nnz_i;
+    }
+}
+
+/* Row ids in IA are renumbered in place, the mapping is monotonic so the columns stay sorted.
+   The gaps of a segmented matrix are skipped column by column. */
+template<typename Weight>
+void CSC<Weight>::compact_rows(std::vector<uint32_t>& rows) {
+    uint32_t* IA = CSC::IA_blk->ptr;
+    uint32_t* JA = CSC::JA_blk->ptr;
+    const uint32_t* JB = (CSC::segmented) ? CSC::JB_blk->ptr : JA;
+    
+    if(rows.empty()) {
+        rows.resize(CSC::nrows);
+        std::iota(rows.begin(), rows.end(), 0);
+    }
+    std::vector<uint32_t> renumbered(CSC::nrows, 0);
+    for(uint32_t j = 0; j < CSC::ncols; j++) {
+        for(uint32_t i = JB[j]; i < JA[j+1]; i++) renumbered[IA[i]] = 1;
+    }
+    uint32_t nlive = 0;
+    for(uint32_t i = 0; i < CSC::nrows; i++) {
+        if(renumbered[i]) {
+            rows[nlive] = rows[i];
+            renumbered[i] = nlive;
+            nlive++;
+        }
+    }
+    if(nlive < CSC::nrows) {
+        for(uint32_t j = 0; j < CSC::ncols; j++) {
+            for(uint32_t i = JB[j]; i < JA[j+1]; i++) IA[i] = renumbered[IA[i]];
+        }
+    }
+    rows.resize(nlive);
+    CSC::nrows = nlive;
+    Compressed_Format<Weight>::nrows = nlive;
+}
+
+template<typename Weight>
+void CSC<Weight>::restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_) {
+    uint32_t* IA = CSC::IA_blk->ptr;
+    uint32_t* JA = CSC::JA_blk->ptr;
+    const uint32_t* JB = (CSC::segmented) ? CSC::JB_blk->ptr : JA;
+    if(not rows.empty()) {
+        for(uint32_t j = 0; j < CSC::ncols; j++) {
+            for(uint32_t i = JB[j]; i < JA[j+1]; i++) IA[i] = rows[IA[i]];
+        }
+    }
+    CSC::nrows = nrows_;
+    Compressed_Format<Weight>::nrows = nrows_;
+}
+
+/* After spmm_real the columns of a thread start at its off_nnz, while JA[start_col] is where 
+   the previous thread stopped. JB records the former so the next layer can read the matrix as is. */
+template<typename Weight>
+void CSC<Weight>::segment(const int32_t leader_tid, const int32_t tid) {
+    if(tid == leader_tid) {
+        if(not CSC::JB_blk) CSC::JB_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSC::ncols + 1, CSC::JA_blk->socket_id));
+        else if(CSC::JB_blk->nitems < (CSC::ncols + 1)) CSC::JB_blk->reallocate(CSC::ncols + 1);
+        CSC::segmented = true;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+    
+    const uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* JB = CSC::JB_blk->ptr;
+    const uint32_t start_col = Env::threads[tid].start_col;
+    const uint32_t end_col   = Env::threads[tid].end_col;
+    for(uint32_t j = start_col; j < end_col; j++) {
+        JB[j] = (j == start_col) ? Env::threads[tid].off_nnz : JA[j];
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+}
+
+template<typename Weight>
+void CSC<Weight>::segment(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid) {
+    if(tid == leader_tid) {
+        if(not CSC::JB_blk) CSC::JB_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(CSC::ncols + 1, CSC::JA_blk->socket_id));
+        else if(CSC::JB_blk->nitems < (CSC::ncols + 1)) CSC::JB_blk->reallocate(CSC::ncols + 1);
+        CSC::segmented = true;
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+    
+    const uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* JB = CSC::JB_blk->ptr;
+    const uint32_t start_col = Env::threads[tid].start_col;
+    const uint32_t end_col   = Env::threads[tid].end_col;
+    for(uint32_t j = start_col; j < end_col; j++) {
+        JB[j] = (j == start_col) ? Env::threads[tid].off_nnz : JA[j];
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+/* Moves the segments down over the gaps, single threaded */
+template<typename Weight>
+void CSC<Weight>::flatten() {
+    if(not CSC::segmented) return;
+    uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    const uint32_t* JB = CSC::JB_blk->ptr;
+    
+    uint64_t k = 0;
+    for(uint32_t j = 0; j < CSC::ncols; j++) {
+        const uint32_t begin = JB[j];
+        const uint32_t end = JA[j+1];
+        if(begin != k) {
+            memmove(IA + k, IA + begin, (end - begin) * sizeof(uint32_t));
+            memmove(A + k, A + begin, (end - begin) * sizeof(Weight));
+        }
+        k += end - begin;
+        JA[j+1] = k;
+    }
+    JA[0] = 0;
+    CSC::segmented = false;
+    CSC::nnz_i = k;
+    Compressed_Format<Weight>::nnz_i = k;
+}
+
+/* Columns keep their rows sorted, so the rows of the block are a binary searched range of each column */
+template<typename Weight>
+void CSC<Weight>::extract_rows(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start_row, const uint32_t end_row) {
+    std::shared_ptr<struct CSC<Weight>> other_csc = std::static_pointer_cast<struct CSC<Weight>>(other_spmat);
+    uint32_t  o_ncols = other_csc->ncols;
+    uint32_t* o_JA = other_csc->JA_blk->ptr;
+    uint32_t* o_IA = other_csc->IA_blk->ptr;
+    Weight*   o_A  = other_csc->A_blk->ptr;
+    
+    uint64_t nnz_ = 0;
+    for(uint32_t j = 0; j < o_ncols; j++) {
+        nnz_ += std::lower_bound(o_IA + o_JA[j], o_IA + o_JA[j+1], end_row) - std::lower_bound(o_IA + o_JA[j], o_IA + o_JA[j+1], start_row);
+    }
+    CSC::reallocate(nnz_, end_row - start_row, o_ncols, -1, 0);
+    
+    uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    uint64_t k = 0;
+    for(uint32_t j = 0; j < o_ncols; j++) {
+        uint32_t first = std::lower_bound(o_IA + o_JA[j], o_IA + o_JA[j+1], start_row) - o_IA;
+        uint32_t last  = std::lower_bound(o_IA + first, o_IA + o_JA[j+1], end_row) - o_IA;
+        for(uint32_t i = first; i < last; i++) {
+            IA[k] = o_IA[i] - start_row;
+            A[k] = (o_A) ? o_A[i] : other_csc->pattern_value;
+            k++;
+        }
+        JA[j+1] = k;
+    }
+    CSC::nnz_i = k;
+    Compressed_Format<Weight>::nnz_i = k;
+}
+
+template<typename Weight>
+void CSC<Weight>::stack_rows(const std::vector<std::shared_ptr<struct Compressed_Format<Weight>>>& blocks, const std::vector<uint32_t>& start_rows, const uint32_t nblocks, const uint32_t nrows_, const uint32_t ncols_) {
+    uint64_t nnz_ = 0;
+    for(uint32_t b = 0; b < nblocks; b++) {
+        std::shared_ptr<struct CSC<Weight>> block = std::static_pointer_cast<struct CSC<Weight>>(blocks[b]);
+        nnz_ += block->JA_blk->ptr[block->ncols];
+    }
+    CSC::reallocate(nnz_, nrows_, ncols_, -1, 0);
+    
+    uint32_t* JA = CSC::JA_blk->ptr;
+    uint32_t* IA = CSC::IA_blk->ptr;
+    Weight*    A = CSC::A_blk->ptr;
+    uint64_t k = 0;
+    for(uint32_t j = 0; j < ncols_; j++) {
+        for(uint32_t b = 0; b < nblocks; b++) {
+            std::shared_ptr<struct CSC<Weight>> block = std::static_pointer_cast<struct CSC<Weight>>(blocks[b]);
+            uint32_t* b_JA = block->JA_blk->ptr;
+            uint32_t* b_IA = block->IA_blk->ptr;
+            Weight*   b_A  = block->A_blk->ptr;
+            for(uint32_t i = b_JA[j]; i < b_JA[j+1]; i++) {
+                IA[k] = b_IA[i] + start_rows[b];
+                A[k] = b_A[i];
+                k++;
+            }
+        }
+        JA[j+1] = k;
+    }
+    CSC::nnz_i = k;
+    Compressed_Format<Weight>::nnz_i = k;
+}
+
 template<typename Weight>
 void CSC<Weight>::walk_dxm1(const bool one_rank, const int32_t leader_tid, const int32_t tid) {  
     if(tid == leader_tid) {
@@ -1603,4 +2399,1015 @@ void CSC<Weight>::walk_dxm1(const bool one_rank, const int32_t leader_tid, const
     }    
 }
 
+/* Doubly Compressed Sparse Row (DCSR)
+   Only the nonempty rows are stored: IR holds their ids and IA their nnzrows+1 pointers, so hypersparse
+   activations neither walk nor clear empty rows. Rows are appended in order by a single writer, threads
+   of a model parallel layer fill their own segment, stitch it into a slot starting at their first row and
+   adjust packs the slots back together. */
+template<typename Weight>
+struct DCSR: public Compressed_Format<Weight> {
+    public:
+        DCSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id);
+        ~DCSR(){};
+        
+        void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width);
+		template<typename Activation>
+		void populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t row,  uint64_t& index, const int32_t tid);
+		template<typename Activation>
+		void populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t row,  uint64_t& index, const int32_t tid);
+        void reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid);
+        void adjust(const int32_t tid);
+        void adjust(const int32_t leader_tid, const int32_t tid);
+        void adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid);
+        void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
+        void stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid);
+        void compact_rows(std::vector<uint32_t>& rows);
+        void restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_);
+        
+        uint64_t nnz   = 0;
+        uint64_t nnz_i = 0;
+        uint32_t nrows = 0;
+        uint32_t ncols = 0;
+        uint32_t nnzrows = 0; /* Stored (nonempty) rows */
+        
+        std::shared_ptr<struct Data_Block<uint32_t>> IR_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> IA_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> JA_blk;
+        std::shared_ptr<struct Data_Block<Weight>>   A_blk;
+};
+
+template<typename Weight>
+DCSR<Weight>::DCSR(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id) {
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_DCSR_;
+    Compressed_Format<Weight>::nnz = nnz_;
+    Compressed_Format<Weight>::nnz_i = nnz_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    
+    DCSR::compression_type = COMPRESSED_FORMAT::_DCSR_;
+    DCSR::nnz = nnz_;
+    DCSR::nnz_i = nnz_;
+    DCSR::nrows = nrows_; 
+    DCSR::ncols = ncols_;
+    
+    DCSR::IR_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(DCSR::nrows, socket_id));
+    DCSR::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>((DCSR::nrows + 1), socket_id));
+    DCSR::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(DCSR::nnz, socket_id));
+    DCSR::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(DCSR::nnz, socket_id));
+}
+
+template<typename Weight>
+void DCSR<Weight>::populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width) {
+    const RowSort<Weight> f_row;
+    std::sort(triples.begin(), triples.end(), f_row);  
+    
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    
+    uint32_t& r = DCSR::nnzrows;
+    uint32_t j = 0;
+    r = 0;
+    IA[0] = 0;
+    for(auto &triple: triples) {
+        std::pair pair = std::make_pair((triple.row % tile_height), (triple.col % tile_width));
+        if((not r) or (IR[r-1] != pair.first)) {
+            IR[r] = pair.first;
+            r++;
+            IA[r] = IA[r-1];
+        }
+        IA[r]++;
+        JA[j] = pair.second;
+        A[j] = triple.weight;
+        j++;
+    }
+    DCSR::nnz_i = DCSR::nnz;
+}
+
+template<typename Weight>
+template<typename Activation>
+void DCSR<Weight>::populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t row, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    Weight*    s = *spa;
+    uint64_t*  m = bitmap;
+    const Weight* b = bias;
+    
+    if(not m) {
+        for(uint32_t j = 0; j < DCSR::ncols; j++) {
+            if(s[j]) {
+                s[j] += b[j];
+                s[j]=Activation::apply(s[j]);
+                if(s[j]) {
+                    JA[k] = j;
+                    A[k] = s[j];
+                    k++;
+                    s[j] = 0;
+                }
+            }
+        }
+    }
+    else {
+        const uint32_t nwords = (DCSR::ncols + 63) >> 6;
+        for(uint32_t w = 0; w < nwords; w++) {
+            uint64_t word = m[w];
+            if(not word) continue;
+            m[w] = 0;
+            while(word) {
+                uint32_t j = (w << 6) + __builtin_ctzll(word);
+                word &= (word - 1);
+                if(s[j]) {
+                    s[j] += b[j];
+                    s[j]=Activation::apply(s[j]);
+                    if(s[j]) {
+                        JA[k] = j;
+                        A[k] = s[j];
+                        k++;
+                        s[j] = 0;
+                    }
+                }
+            }
+        }
+    }
+    
+    /* Store the row only if something survived the activation */
+    if(k > IA[DCSR::nnzrows]) {
+        IR[DCSR::nnzrows] = row;
+        DCSR::nnzrows++;
+        IA[DCSR::nnzrows] = k;
+    }
+}
+
+template<typename Weight>
+template<typename Activation>
+void DCSR<Weight>::populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t row, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    const Weight* b = bias;
+    
+    for(uint32_t n = 0; n < nitems; n++) {
+        uint32_t j = list_idx[n];
+        Weight   v = list_val[n];
+        if(v) {
+            v += b[j];
+            v = Activation::apply(v);
+            if(v) {
+                JA[k] = j;
+                A[k] = v;
+                k++;
+            }
+        }
+    }
+    
+    if(k > IA[DCSR::nnzrows]) {
+        IR[DCSR::nnzrows] = row;
+        DCSR::nnzrows++;
+        IA[DCSR::nnzrows] = k;
+    }
+}
+
+/* Unlike CSR, nothing is cleared: only the first nnzrows+1 pointers are ever read */
+template<typename Weight>
+void DCSR<Weight>::reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid) {
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSR::nnz = nnz_;
+        DCSR::nnz_i = 0;
+        DCSR::nrows = nrows_; 
+        DCSR::ncols = ncols_;
+        DCSR::nnzrows = 0;
+        DCSR::IR_blk->reallocate(DCSR::nrows);
+        DCSR::IA_blk->reallocate(DCSR::nrows+1);
+        DCSR::JA_blk->reallocate(DCSR::nnz);
+        DCSR::A_blk->reallocate(DCSR::nnz);
+        DCSR::IA_blk->ptr[0] = 0;
+        
+        Compressed_Format<Weight>::nnz = nnz_;
+        Compressed_Format<Weight>::nnz_i = 0;
+        Compressed_Format<Weight>::nrows = nrows_; 
+        Compressed_Format<Weight>::ncols = ncols_;
+    }
+}
+
+template<typename Weight>
+void DCSR<Weight>::adjust(const int32_t tid){
+    DCSR::nnz_i = Env::threads[tid].idx_nnz;
+    Compressed_Format<Weight>::nnz_i = DCSR::nnz_i;
+}
+
+template<typename Weight>
+void DCSR<Weight>::adjust(const int32_t leader_tid, const int32_t tid){
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSR::nnz_i = 0;
+        for(uint32_t i = 0; i < Env::threads.size(); i++) {    
+            DCSR::nnz_i += (Env::threads[i].idx_nnz - Env::threads[i].off_nnz);
+        }
+        Compressed_Format<Weight>::nnz_i = DCSR::nnz_i;
+        
+        // Pack the rows stitched into the thread slots, the entries are already packed
+        uint32_t* IR = DCSR::IR_blk->ptr;
+        uint32_t* IA = DCSR::IA_blk->ptr;
+        uint32_t& r = DCSR::nnzrows;
+        r = 0;
+        for(uint32_t i = 0; i < Env::threads.size(); i++) {    
+            const uint32_t slot = Env::threads[i].start_row;
+            for(uint32_t i = 0; i < Env::threads[i].nnz_vecs; i++) {
+                IR[r] = IR[slot + i];
+                IA[r + 1] = IA[slot + i + 1];
+                r++;
+            }
+        }
+        IA[0] = 0;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+}
+
+template<typename Weight>
+void DCSR<Weight>::adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid){    
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSR::nnz_i = 0;
+        for(uint32_t i = 0; i < my_threads.size(); i++) {    
+            int32_t t = my_threads[i];
+            DCSR::nnz_i += (Env::threads[t].idx_nnz - Env::threads[t].off_nnz);
+        }
+        Compressed_Format<Weight>::nnz_i = DCSR::nnz_i;
+        
+        uint32_t* IR = DCSR::IR_blk->ptr;
+        uint32_t* IA = DCSR::IA_blk->ptr;
+        uint32_t& r = DCSR::nnzrows;
+        r = 0;
+        for(uint32_t i = 0; i < my_threads.size(); i++) {    
+            int32_t t = my_threads[i];
+            const uint32_t slot = Env::threads[t].start_row;
+            for(uint32_t i = 0; i < Env::threads[t].nnz_vecs; i++) {
+                IR[r] = IR[slot + i];
+                IA[r + 1] = IA[slot + i + 1];
+                r++;
+            }
+        }
+        IA[0] = 0;
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+/* Each thread copies back the entries and rows it stitched, at the same positions as in the packed other_spmat */
+template<typename Weight>
+void DCSR<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid) {
+    std::shared_ptr<struct DCSR<Weight>> other_dcsr = std::static_pointer_cast<struct DCSR<Weight>>(other_spmat);
+    
+    uint32_t  o_ncols = other_dcsr->ncols;
+    uint32_t  o_nrows = other_dcsr->nrows;
+    uint64_t  o_nnz_i = other_dcsr->nnz_i;
+    uint32_t  o_nnzrows = other_dcsr->nnzrows;
+    uint32_t* o_IR    = other_dcsr->IR_blk->ptr;
+    uint32_t* o_IA    = other_dcsr->IA_blk->ptr;
+    uint32_t* o_JA    = other_dcsr->JA_blk->ptr;
+    Weight*   o_A     = other_dcsr->A_blk->ptr;
+    
+    const uint64_t off_nnz  = Env::threads[tid].off_nnz;
+    const uint64_t idx_nnz  = Env::threads[tid].idx_nnz;
+    const uint32_t nnz_vecs = Env::threads[tid].nnz_vecs;
+    uint32_t r = 0;
+    for(int32_t i = 0; i < tid; i++) {
+        r += Env::threads[i].nnz_vecs;
+    }
+    
+    if(tid == leader_tid) {
+        DCSR::nnz = o_nnz_i;
+        DCSR::nnz_i = o_nnz_i;
+        DCSR::nrows = o_nrows;
+        DCSR::ncols = o_ncols;
+        DCSR::nnzrows = o_nnzrows;
+        DCSR::IR_blk->reallocate(DCSR::nrows);
+        DCSR::IA_blk->reallocate(DCSR::nrows+1);
+        DCSR::JA_blk->reallocate(DCSR::nnz_i);
+        DCSR::A_blk->reallocate(DCSR::nnz_i);
+        DCSR::IA_blk->ptr[0] = 0;
+        Compressed_Format<Weight>::nnz = DCSR::nnz_i;
+        Compressed_Format<Weight>::nnz_i = DCSR::nnz_i;
+		Compressed_Format<Weight>::nrows = DCSR::nrows;
+		Compressed_Format<Weight>::ncols = DCSR::ncols;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+    
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    memcpy(JA + off_nnz, o_JA + off_nnz, (idx_nnz - off_nnz) * sizeof(uint32_t));
+    memcpy(A + off_nnz, o_A + off_nnz, (idx_nnz - off_nnz) * sizeof(Weight));
+    memcpy(IR + r, o_IR + r, nnz_vecs * sizeof(uint32_t));
+    memcpy(IA + r + 1, o_IA + r + 1, nnz_vecs * sizeof(uint32_t));
+}
+
+template<typename Weight>
+void DCSR<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid,  const int32_t tid) {
+    std::shared_ptr<struct DCSR<Weight>> other_dcsr = std::static_pointer_cast<struct DCSR<Weight>>(other_spmat);
+    
+    uint32_t  o_ncols = other_dcsr->ncols;
+    uint32_t  o_nrows = other_dcsr->nrows;
+    uint64_t  o_nnz_i = other_dcsr->nnz_i;
+    uint32_t  o_nnzrows = other_dcsr->nnzrows;
+    uint32_t* o_IR    = other_dcsr->IR_blk->ptr;
+    uint32_t* o_IA    = other_dcsr->IA_blk->ptr;
+    uint32_t* o_JA    = other_dcsr->JA_blk->ptr;
+    Weight*   o_A     = other_dcsr->A_blk->ptr;
+    
+    const uint64_t off_nnz  = Env::threads[tid].off_nnz;
+    const uint64_t idx_nnz  = Env::threads[tid].idx_nnz;
+    const uint32_t nnz_vecs = Env::threads[tid].nnz_vecs;
+    uint32_t r = 0;
+    for(uint32_t j = 0; j < Env::threads[tid].index; j++) {
+        int32_t tt = Env::my_threads[leader_tid][j];
+        r += Env::threads[tt].nnz_vecs;
+    }
+
+    if(tid == leader_tid) {
+        DCSR::nnz = o_nnz_i;
+        DCSR::nnz_i = o_nnz_i;
+        DCSR::nrows = o_nrows;
+        DCSR::ncols = o_ncols;
+        DCSR::nnzrows = o_nnzrows;
+        DCSR::IR_blk->reallocate(DCSR::nrows);
+        DCSR::IA_blk->reallocate(DCSR::nrows+1);
+        DCSR::JA_blk->reallocate(DCSR::nnz_i);
+        DCSR::A_blk->reallocate(DCSR::nnz_i);
+        DCSR::IA_blk->ptr[0] = 0;
+        Compressed_Format<Weight>::nnz = DCSR::nnz_i;
+        Compressed_Format<Weight>::nnz_i = DCSR::nnz_i;
+		Compressed_Format<Weight>::nrows = DCSR::nrows;
+        Compressed_Format<Weight>::ncols = DCSR::ncols;
+    }    
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+    
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    memcpy(JA + off_nnz, o_JA + off_nnz, (idx_nnz - off_nnz) * sizeof(uint32_t));
+    memcpy(A + off_nnz, o_A + off_nnz, (idx_nnz - off_nnz) * sizeof(Weight));
+    memcpy(IR + r, o_IR + r, nnz_vecs * sizeof(uint32_t));
+    memcpy(IA + r + 1, o_IA + r + 1, nnz_vecs * sizeof(uint32_t));
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+template<typename Weight>
+void DCSR<Weight>::expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {
+    if(nnz_ > DCSR::nnz) {
+        DCSR::JA_blk->reallocate(nnz_);
+        DCSR::A_blk->reallocate(nnz_);
+        DCSR::nnz = nnz_;
+        Compressed_Format<Weight>::nnz = nnz_;
+    }
+    if(nrows_ != DCSR::nrows) {
+        DCSR::IR_blk->reallocate(nrows_);
+        DCSR::IA_blk->reallocate(nrows_+1);
+    }
+    DCSR::nrows = nrows_; 
+    DCSR::ncols = ncols_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+}
+
+template<typename Weight>
+void DCSR<Weight>::stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid) {
+    std::shared_ptr<struct DCSR<Weight>> other_dcsr = std::static_pointer_cast<struct DCSR<Weight>>(other_spmat);
+    uint32_t  o_nnzrows = other_dcsr->nnzrows;
+    uint32_t* o_IR = other_dcsr->IR_blk->ptr;
+    uint32_t* o_IA = other_dcsr->IA_blk->ptr;
+    uint32_t* o_JA = other_dcsr->JA_blk->ptr;
+    Weight*   o_A  = other_dcsr->A_blk->ptr;
+    
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    uint32_t* IA = DCSR::IA_blk->ptr;
+    uint32_t* JA = DCSR::JA_blk->ptr;
+    Weight*    A = DCSR::A_blk->ptr;
+    
+    uint64_t& k = index;
+    Env::threads[tid].nnz_vecs = 0;
+    if(start < end) {
+        const uint64_t o_nnz_i = o_IA[o_nnzrows];
+        memcpy(JA + k, o_JA, o_nnz_i * sizeof(uint32_t));
+        memcpy(A + k, o_A, o_nnz_i * sizeof(Weight));
+        // A thread has at most end - start rows, so its slot never runs into the next one
+        const uint32_t slot = off + start;
+        for(uint32_t i = 0; i < o_nnzrows; i++) {
+            IR[slot + i] = o_IR[i];
+            IA[slot + i + 1] = o_IA[i + 1] + k;
+        }
+        Env::threads[tid].nnz_vecs = o_nnzrows;
+        k += o_nnz_i;
+    }
+}
+
+/* Stored rows are already packed, only IR is renumbered */
+template<typename Weight>
+void DCSR<Weight>::compact_rows(std::vector<uint32_t>& rows) {
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    
+    if(rows.empty()) {
+        rows.resize(DCSR::nrows);
+        std::iota(rows.begin(), rows.end(), 0);
+    }
+    for(uint32_t p = 0; p < DCSR::nnzrows; p++) {
+        rows[p] = rows[IR[p]];
+        IR[p] = p;
+    }
+    rows.resize(DCSR::nnzrows);
+    DCSR::nrows = DCSR::nnzrows;
+    Compressed_Format<Weight>::nrows = DCSR::nnzrows;
+}
+
+template<typename Weight>
+void DCSR<Weight>::restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_) {
+    uint32_t* IR = DCSR::IR_blk->ptr;
+    if(not rows.empty()) {
+        for(uint32_t p = 0; p < DCSR::nnzrows; p++) IR[p] = rows[IR[p]];
+    }
+    DCSR::nrows = nrows_;
+    Compressed_Format<Weight>::nrows = nrows_;
+}
+
+/* Doubly Compressed Sparse Column (DCSC)
+   Only the nonempty columns are stored: JC holds their ids and JA their nnzcols+1 pointers.
+   Filled the same way as DCSR, one column at a time by a single writer. */
+template<typename Weight>
+struct DCSC: public Compressed_Format<Weight> {
+    public:
+        DCSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id);
+        ~DCSC(){};
+        
+        void populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width);
+		template<typename Activation>
+		void populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
+		template<typename Activation>
+		void populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t col,  uint64_t& index, const int32_t tid);
+        void reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid);
+        void adjust(const int32_t tid);
+        void adjust(const int32_t leader_tid, const int32_t tid);
+        void adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid);
+        void repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid);
+        void expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_);
+        void stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid);
+        void compact_rows(std::vector<uint32_t>& rows);
+        void restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_);
+        
+        uint64_t nnz   = 0;
+        uint64_t nnz_i = 0;
+        uint32_t nrows = 0;
+        uint32_t ncols = 0;
+        uint32_t nnzcols = 0; /* Stored (nonempty) columns */
+        
+        std::shared_ptr<struct Data_Block<uint32_t>> JC_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> JA_blk;
+        std::shared_ptr<struct Data_Block<uint32_t>> IA_blk;
+        std::shared_ptr<struct Data_Block<Weight>>   A_blk;
+};
+
+template<typename Weight>
+DCSC<Weight>::DCSC(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id) {
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_DCSC_;
+    Compressed_Format<Weight>::nnz = nnz_;
+    Compressed_Format<Weight>::nnz_i = nnz_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    
+    DCSC::compression_type = COMPRESSED_FORMAT::_DCSC_;
+    DCSC::nnz = nnz_;
+    DCSC::nnz_i = nnz_;
+    DCSC::nrows = nrows_; 
+    DCSC::ncols = ncols_;
+    
+    DCSC::JC_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(DCSC::ncols, socket_id));
+    DCSC::JA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>((DCSC::ncols + 1), socket_id));
+    DCSC::IA_blk = std::move(std::make_shared<struct Data_Block<uint32_t>>(DCSC::nnz, socket_id));
+    DCSC::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(DCSC::nnz, socket_id));
+}
+
+template<typename Weight>
+void DCSC<Weight>::populate(std::vector<struct Triple<Weight>>& triples, const uint32_t tile_height, const uint32_t tile_width) {
+    const ColSort<Weight> f_col;
+    std::sort(triples.begin(), triples.end(), f_col);  
+    
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    
+    uint32_t& c = DCSC::nnzcols;
+    uint32_t i = 0;
+    c = 0;
+    JA[0] = 0;
+    for(auto &triple: triples) {
+        std::pair pair = std::make_pair((triple.row % tile_height), (triple.col % tile_width));
+        if((not c) or (JC[c-1] != pair.second)) {
+            JC[c] = pair.second;
+            c++;
+            JA[c] = JA[c-1];
+        }
+        JA[c]++;
+        IA[i] = pair.first;
+        A[i] = triple.weight;
+        i++;
+    }
+    DCSC::nnz_i = DCSC::nnz;
+}
+
+template<typename Weight>
+template<typename Activation>
+void DCSC<Weight>::populate_spa(Weight** spa, uint64_t* bitmap, const Weight* bias, const uint32_t col, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    Weight*    s = *spa;
+    uint64_t*  m = bitmap;
+    const Weight* b = bias;
+    
+    if(not m) {
+        for(uint32_t i = 0; i < DCSC::nrows; i++) {
+            if(s[i]) {
+                s[i] += b[col];
+                s[i]=Activation::apply(s[i]);
+                if(s[i]) {
+                    IA[k] = i;
+                    A[k] = s[i];
+                    k++;
+                    s[i] = 0;
+                }
+            }
+        }
+    }
+    else {
+        const uint32_t nwords = (DCSC::nrows + 63) >> 6;
+        for(uint32_t w = 0; w < nwords; w++) {
+            uint64_t word = m[w];
+            if(not word) continue;
+            m[w] = 0;
+            while(word) {
+                uint32_t i = (w << 6) + __builtin_ctzll(word);
+                word &= (word - 1);
+                if(s[i]) {
+                    s[i] += b[col];
+                    s[i]=Activation::apply(s[i]);
+                    if(s[i]) {
+                        IA[k] = i;
+                        A[k] = s[i];
+                        k++;
+                        s[i] = 0;
+                    }
+                }
+            }
+        }
+    }
+    
+    /* Store the column only if something survived the activation */
+    if(k > JA[DCSC::nnzcols]) {
+        JC[DCSC::nnzcols] = col;
+        DCSC::nnzcols++;
+        JA[DCSC::nnzcols] = k;
+    }
+}
+
+template<typename Weight>
+template<typename Activation>
+void DCSC<Weight>::populate_list(const uint32_t* list_idx, const Weight* list_val, const uint32_t nitems, const Weight* bias, const uint32_t col, uint64_t& index, const int32_t tid) {
+    uint64_t&  k = index;
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    const Weight* b = bias;
+    
+    for(uint32_t n = 0; n < nitems; n++) {
+        uint32_t i = list_idx[n];
+        Weight   v = list_val[n];
+        if(v) {
+            v += b[col];
+            v = Activation::apply(v);
+            if(v) {
+                IA[k] = i;
+                A[k] = v;
+                k++;
+            }
+        }
+    }
+    
+    if(k > JA[DCSC::nnzcols]) {
+        JC[DCSC::nnzcols] = col;
+        DCSC::nnzcols++;
+        JA[DCSC::nnzcols] = k;
+    }
+}
+
+/* Unlike CSC, nothing is cleared: only the first nnzcols+1 pointers are ever read */
+template<typename Weight>
+void DCSC<Weight>::reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid) {
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSC::nnz = nnz_;
+        DCSC::nnz_i = 0;
+        DCSC::nrows = nrows_; 
+        DCSC::ncols = ncols_;
+        DCSC::nnzcols = 0;
+        DCSC::JC_blk->reallocate(DCSC::ncols);
+        DCSC::JA_blk->reallocate(DCSC::ncols+1);
+        DCSC::IA_blk->reallocate(DCSC::nnz);
+        DCSC::A_blk->reallocate(DCSC::nnz);
+        DCSC::JA_blk->ptr[0] = 0;
+        
+        Compressed_Format<Weight>::nnz = nnz_;
+        Compressed_Format<Weight>::nnz_i = 0;
+        Compressed_Format<Weight>::nrows = nrows_; 
+        Compressed_Format<Weight>::ncols = ncols_;
+    }
+}
+
+template<typename Weight>
+void DCSC<Weight>::adjust(const int32_t tid){
+    DCSC::nnz_i = Env::threads[tid].idx_nnz;
+    Compressed_Format<Weight>::nnz_i = DCSC::nnz_i;
+}
+
+template<typename Weight>
+void DCSC<Weight>::adjust(const int32_t leader_tid, const int32_t tid){
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSC::nnz_i = 0;
+        for(uint32_t i = 0; i < Env::threads.size(); i++) {    
+            DCSC::nnz_i += (Env::threads[i].idx_nnz - Env::threads[i].off_nnz);
+        }
+        Compressed_Format<Weight>::nnz_i = DCSC::nnz_i;
+        
+        // Pack the columns stitched into the thread slots, the entries are already packed
+        uint32_t* JC = DCSC::JC_blk->ptr;
+        uint32_t* JA = DCSC::JA_blk->ptr;
+        uint32_t& c = DCSC::nnzcols;
+        c = 0;
+        for(uint32_t i = 0; i < Env::threads.size(); i++) {    
+            const uint32_t slot = Env::threads[i].start_col;
+            for(uint32_t j = 0; j < Env::threads[i].nnz_vecs; j++) {
+                JC[c] = JC[slot + j];
+                JA[c + 1] = JA[slot + j + 1];
+                c++;
+            }
+        }
+        JA[0] = 0;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+}
+
+template<typename Weight>
+void DCSC<Weight>::adjust(const std::deque<int32_t> my_threads, const int32_t leader_tid, const int32_t tid){    
+    if((leader_tid == -1) or (tid == leader_tid)) {
+        DCSC::nnz_i = 0;
+        for(uint32_t i = 0; i < my_threads.size(); i++) {    
+            int32_t t = my_threads[i];
+            DCSC::nnz_i += (Env::threads[t].idx_nnz - Env::threads[t].off_nnz);
+        }
+        Compressed_Format<Weight>::nnz_i = DCSC::nnz_i;
+        
+        uint32_t* JC = DCSC::JC_blk->ptr;
+        uint32_t* JA = DCSC::JA_blk->ptr;
+        uint32_t& c = DCSC::nnzcols;
+        c = 0;
+        for(uint32_t i = 0; i < my_threads.size(); i++) {    
+            int32_t t = my_threads[i];
+            const uint32_t slot = Env::threads[t].start_col;
+            for(uint32_t j = 0; j < Env::threads[t].nnz_vecs; j++) {
+                JC[c] = JC[slot + j];
+                JA[c + 1] = JA[slot + j + 1];
+                c++;
+            }
+        }
+        JA[0] = 0;
+    }
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+/* Each thread copies back the entries and columns it stitched, at the same positions as in the packed other_spmat */
+template<typename Weight>
+void DCSC<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t dis_nnz, const int32_t leader_tid, const int32_t tid) {
+    std::shared_ptr<struct DCSC<Weight>> other_dcsc = std::static_pointer_cast<struct DCSC<Weight>>(other_spmat);
+    
+    uint32_t  o_ncols = other_dcsc->ncols;
+    uint32_t  o_nrows = other_dcsc->nrows;
+    uint64_t  o_nnz_i = other_dcsc->nnz_i;
+    uint32_t  o_nnzcols = other_dcsc->nnzcols;
+    uint32_t* o_JC    = other_dcsc->JC_blk->ptr;
+    uint32_t* o_JA    = other_dcsc->JA_blk->ptr;
+    uint32_t* o_IA    = other_dcsc->IA_blk->ptr;
+    Weight*   o_A     = other_dcsc->A_blk->ptr;
+    
+    const uint64_t off_nnz  = Env::threads[tid].off_nnz;
+    const uint64_t idx_nnz  = Env::threads[tid].idx_nnz;
+    const uint32_t nnz_vecs = Env::threads[tid].nnz_vecs;
+    uint32_t c = 0;
+    for(int32_t i = 0; i < tid; i++) {
+        c += Env::threads[i].nnz_vecs;
+    }
+    
+    if(tid == leader_tid) {
+        DCSC::nnz = o_nnz_i;
+        DCSC::nnz_i = o_nnz_i;
+        DCSC::nrows = o_nrows;
+        DCSC::ncols = o_ncols;
+        DCSC::nnzcols = o_nnzcols;
+        DCSC::JC_blk->reallocate(DCSC::ncols);
+        DCSC::JA_blk->reallocate(DCSC::ncols+1);
+        DCSC::IA_blk->reallocate(DCSC::nnz_i);
+        DCSC::A_blk->reallocate(DCSC::nnz_i);
+        DCSC::JA_blk->ptr[0] = 0;
+        Compressed_Format<Weight>::nnz = DCSC::nnz_i;
+        Compressed_Format<Weight>::nnz_i = DCSC::nnz_i;
+		Compressed_Format<Weight>::nrows = DCSC::nrows;
+		Compressed_Format<Weight>::ncols = DCSC::ncols;
+    }
+    pthread_barrier_wait(&Env::thread_barrier);
+    
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    memcpy(IA + off_nnz, o_IA + off_nnz, (idx_nnz - off_nnz) * sizeof(uint32_t));
+    memcpy(A + off_nnz, o_A + off_nnz, (idx_nnz - off_nnz) * sizeof(Weight));
+    memcpy(JC + c, o_JC + c, nnz_vecs * sizeof(uint32_t));
+    memcpy(JA + c + 1, o_JA + c + 1, nnz_vecs * sizeof(uint32_t));
+}
+
+template<typename Weight>
+void DCSC<Weight>::repopulate(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const std::deque<int32_t> my_threads, const int32_t leader_tid,  const int32_t tid) {
+    std::shared_ptr<struct DCSC<Weight>> other_dcsc = std::static_pointer_cast<struct DCSC<Weight>>(other_spmat);
+    
+    uint32_t  o_ncols = other_dcsc->ncols;
+    uint32_t  o_nrows = other_dcsc->nrows;
+    uint64_t  o_nnz_i = other_dcsc->nnz_i;
+    uint32_t  o_nnzcols = other_dcsc->nnzcols;
+    uint32_t* o_JC    = other_dcsc->JC_blk->ptr;
+    uint32_t* o_JA    = other_dcsc->JA_blk->ptr;
+    uint32_t* o_IA    = other_dcsc->IA_blk->ptr;
+    Weight*   o_A     = other_dcsc->A_blk->ptr;
+    
+    const uint64_t off_nnz  = Env::threads[tid].off_nnz;
+    const uint64_t idx_nnz  = Env::threads[tid].idx_nnz;
+    const uint32_t nnz_vecs = Env::threads[tid].nnz_vecs;
+    uint32_t c = 0;
+    for(uint32_t j = 0; j < Env::threads[tid].index; j++) {
+        int32_t tt = Env::my_threads[leader_tid][j];
+        c += Env::threads[tt].nnz_vecs;
+    }
+
+    if(tid == leader_tid) {
+        DCSC::nnz = o_nnz_i;
+        DCSC::nnz_i = o_nnz_i;
+        DCSC::nrows = o_nrows;
+        DCSC::ncols = o_ncols;
+        DCSC::nnzcols = o_nnzcols;
+        DCSC::JC_blk->reallocate(DCSC::ncols);
+        DCSC::JA_blk->reallocate(DCSC::ncols+1);
+        DCSC::IA_blk->reallocate(DCSC::nnz_i);
+        DCSC::A_blk->reallocate(DCSC::nnz_i);
+        DCSC::JA_blk->ptr[0] = 0;
+        Compressed_Format<Weight>::nnz = DCSC::nnz_i;
+        Compressed_Format<Weight>::nnz_i = DCSC::nnz_i;
+		Compressed_Format<Weight>::nrows = DCSC::nrows;
+        Compressed_Format<Weight>::ncols = DCSC::ncols;
+    }    
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+    
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    memcpy(IA + off_nnz, o_IA + off_nnz, (idx_nnz - off_nnz) * sizeof(uint32_t));
+    memcpy(A + off_nnz, o_A + off_nnz, (idx_nnz - off_nnz) * sizeof(Weight));
+    memcpy(JC + c, o_JC + c, nnz_vecs * sizeof(uint32_t));
+    memcpy(JA + c + 1, o_JA + c + 1, nnz_vecs * sizeof(uint32_t));
+    pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+}
+
+template<typename Weight>
+void DCSC<Weight>::expand(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_) {
+    if(nnz_ > DCSC::nnz) {
+        DCSC::IA_blk->reallocate(nnz_);
+        DCSC::A_blk->reallocate(nnz_);
+        DCSC::nnz = nnz_;
+        Compressed_Format<Weight>::nnz = nnz_;
+    }
+    if(ncols_ != DCSC::ncols) {
+        DCSC::JC_blk->reallocate(ncols_);
+        DCSC::JA_blk->reallocate(ncols_+1);
+    }
+    DCSC::nrows = nrows_; 
+    DCSC::ncols = ncols_;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+}
+
+template<typename Weight>
+void DCSC<Weight>::stitch(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat, const uint32_t start, const uint32_t end, const uint32_t off, uint64_t& index, const int32_t tid) {
+    std::shared_ptr<struct DCSC<Weight>> other_dcsc = std::static_pointer_cast<struct DCSC<Weight>>(other_spmat);
+    uint32_t  o_nnzcols = other_dcsc->nnzcols;
+    uint32_t* o_JC = other_dcsc->JC_blk->ptr;
+    uint32_t* o_JA = other_dcsc->JA_blk->ptr;
+    uint32_t* o_IA = other_dcsc->IA_blk->ptr;
+    Weight*   o_A  = other_dcsc->A_blk->ptr;
+    
+    uint32_t* JC = DCSC::JC_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    Weight*    A = DCSC::A_blk->ptr;
+    
+    uint64_t& k = index;
+    Env::threads[tid].nnz_vecs = 0;
+    if(start < end) {
+        const uint64_t o_nnz_i = o_JA[o_nnzcols];
+        memcpy(IA + k, o_IA, o_nnz_i * sizeof(uint32_t));
+        memcpy(A + k, o_A, o_nnz_i * sizeof(Weight));
+        // A thread has at most end - start columns, so its slot never runs into the next one
+        const uint32_t slot = off + start;
+        for(uint32_t j = 0; j < o_nnzcols; j++) {
+            JC[slot + j] = o_JC[j];
+            JA[slot + j + 1] = o_JA[j + 1] + k;
+        }
+        Env::threads[tid].nnz_vecs = o_nnzcols;
+        k += o_nnz_i;
+    }
+}
+
+template<typename Weight>
+void DCSC<Weight>::compact_rows(std::vector<uint32_t>& rows) {
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    
+    if(rows.empty()) {
+        rows.resize(DCSC::nrows);
+        std::iota(rows.begin(), rows.end(), 0);
+    }
+    std::vector<uint32_t> renumbered(DCSC::nrows, 0);
+    for(uint32_t i = 0; i < JA[DCSC::nnzcols]; i++) renumbered[IA[i]] = 1;
+    uint32_t nlive = 0;
+    for(uint32_t i = 0; i < DCSC::nrows; i++) {
+        if(renumbered[i]) {
+            rows[nlive] = rows[i];
+            renumbered[i] = nlive;
+            nlive++;
+        }
+    }
+    if(nlive < DCSC::nrows) {
+        for(uint32_t i = 0; i < JA[DCSC::nnzcols]; i++) IA[i] = renumbered[IA[i]];
+    }
+    rows.resize(nlive);
+    DCSC::nrows = nlive;
+    Compressed_Format<Weight>::nrows = nlive;
+}
+
+template<typename Weight>
+void DCSC<Weight>::restore_rows(const std::vector<uint32_t>& rows, const uint32_t nrows_) {
+    uint32_t* IA = DCSC::IA_blk->ptr;
+    uint32_t* JA = DCSC::JA_blk->ptr;
+    if(not rows.empty()) {
+        for(uint32_t i = 0; i < JA[DCSC::nnzcols]; i++) IA[i] = rows[IA[i]];
+    }
+    DCSC::nrows = nrows_;
+    Compressed_Format<Weight>::nrows = nrows_;
+}
+
+/* Column-major dense activation tile, entry (i, j) is A[j * nrows + i].
+   nnz is the capacity (nrows * ncols) and nnz_i the nonzeros, which drive the switch back to CSC.
+   Conversions from and to CSC reuse the CSC value block in place: expanding columns backwards
+   never overwrites an entry not yet moved, and compacting them forwards never does either. */
+template<typename Weight>
+struct Dense: public Compressed_Format<Weight> {
+    public:
+        Dense(const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id);
+        Dense(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat);
+        ~Dense(){};
+        
+        void reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid);
+        std::shared_ptr<struct Compressed_Format<Weight>> to_csc();
+        
+        uint64_t nnz   = 0;
+        uint64_t nnz_i = 0;
+        uint32_t nrows = 0;
+        uint32_t ncols = 0;
+        
+        std::shared_ptr<struct Data_Block<Weight>> A_blk;
+};
+
+template<typename Weight>
+Dense<Weight>::Dense(const uint32_t nrows_, const uint32_t ncols_, const int32_t socket_id) {
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_DENSE_;
+    Compressed_Format<Weight>::nnz = (uint64_t) nrows_ * ncols_;
+    Compressed_Format<Weight>::nnz_i = 0;
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    
+    Dense::compression_type = COMPRESSED_FORMAT::_DENSE_;
+    Dense::nnz = (uint64_t) nrows_ * ncols_;
+    Dense::nnz_i = 0;
+    Dense::nrows = nrows_; 
+    Dense::ncols = ncols_;
+    
+    Dense::A_blk = std::move(std::make_shared<struct Data_Block<Weight>>(Dense::nnz, socket_id));
+}
+
+/* Takes over the value block of a CSC matrix and expands it in place */
+template<typename Weight>
+Dense<Weight>::Dense(const std::shared_ptr<struct Compressed_Format<Weight>> other_spmat) {
+    std::shared_ptr<struct CSC<Weight>> other_csc = std::static_pointer_cast<struct CSC<Weight>>(other_spmat);
+    const uint32_t  o_nrows = other_csc->nrows;
+    const uint32_t  o_ncols = other_csc->ncols;
+    const uint32_t* o_JA    = other_csc->JA_blk->ptr;
+    const uint32_t* o_IA    = other_csc->IA_blk->ptr;
+    const bool      o_pattern = other_csc->pattern;
+    const Weight    o_pattern_value = other_csc->pattern_value;
+    
+    Compressed_Format<Weight>::compression_type = COMPRESSED_FORMAT::_DENSE_;
+    Compressed_Format<Weight>::nnz = (uint64_t) o_nrows * o_ncols;
+    Compressed_Format<Weight>::nnz_i = o_JA[o_ncols];
+    Compressed_Format<Weight>::nrows = o_nrows; 
+    Compressed_Format<Weight>::ncols = o_ncols;
+    
+    Dense::compression_type = COMPRESSED_FORMAT::_DENSE_;
+    Dense::nnz = (uint64_t) o_nrows * o_ncols;
+    Dense::nnz_i = o_JA[o_ncols];
+    Dense::nrows = o_nrows; 
+    Dense::ncols = o_ncols;
+    
+    Dense::A_blk = other_csc->A_blk;
+    Dense::A_blk->reallocate(Dense::nnz);
+    Weight* A = Dense::A_blk->ptr;
+    for(uint32_t j = o_ncols; j-- > 0;) {
+        uint64_t k = o_JA[j+1];
+        Weight* a = A + ((uint64_t) j * o_nrows);
+        for(uint32_t i = o_nrows; i-- > 0;) {
+            if((k > o_JA[j]) and (o_IA[k-1] == i)) {
+                k--;
+                a[i] = (o_pattern) ? o_pattern_value : A[k];
+            }
+            else {
+                a[i] = 0;
+            }
+        }
+    }
+}
+
+template<typename Weight>
+void Dense<Weight>::reallocate(const uint64_t nnz_, const uint32_t nrows_, const uint32_t ncols_, const int32_t leader_tid, const int32_t tid) {
+    Dense::nrows = nrows_; 
+    Dense::ncols = ncols_;
+    Dense::nnz = (uint64_t) nrows_ * ncols_;
+    Dense::nnz_i = 0;
+    if(Dense::A_blk->nitems != Dense::nnz) Dense::A_blk->reallocate(Dense::nnz);
+    
+    Compressed_Format<Weight>::nrows = nrows_; 
+    Compressed_Format<Weight>::ncols = ncols_;
+    Compressed_Format<Weight>::nnz = Dense::nnz;
+    Compressed_Format<Weight>::nnz_i = 0;
+}
+
+/* Compacts the columns in place into a CSC matrix that takes over the value block */
+template<typename Weight>
+std::shared_ptr<struct Compressed_Format<Weight>> Dense<Weight>::to_csc() {
+    std::shared_ptr<struct CSC<Weight>> csc = std::make_shared<struct CSC<Weight>>(0, Dense::nrows, Dense::ncols, Dense::A_blk->socket_id);
+    Weight* A = Dense::A_blk->ptr;
+    uint64_t nnz_ = 0;
+    for(uint64_t p = 0; p < Dense::nnz; p++) nnz_ += (A[p] != 0);
+    csc->IA_blk->reallocate(nnz_);
+    
+    uint32_t* IA = csc->IA_blk->ptr;
+    uint32_t* JA = csc->JA_blk->ptr;
+    uint64_t k = 0;
+    JA[0] = 0;
+    for(uint32_t j = 0; j < Dense::ncols; j++) {
+        const Weight* a = A + ((uint64_t) j * Dense::nrows);
+        for(uint32_t i = 0; i < Dense::nrows; i++) {
+            if(a[i]) {
+                IA[k] = i;
+                A[k] = a[i];
+                k++;
+            }
+        }
+        JA[j+1] = k;
+    }
+    Dense::A_blk->reallocate(nnz_);
+    csc->A_blk = Dense::A_blk;
+    
+    csc->nnz = nnz_;
+    csc->nnz_i = nnz_;
+    std::shared_ptr<struct Compressed_Format<Weight>> spmat = csc;
+    spmat->nnz = nnz_;
+    spmat->nnz_i = nnz_;
+    return(spmat);
+}
+
 #endif
\ No newline at end of file
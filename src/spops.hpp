@@ -12,13 +12,751 @@
 #include "spmat.hpp"
 
 #include <math.h>
+#include <array>
+#include <immintrin.h>
 template<typename Weight>
 Weight sigmoid(Weight x) { return 1 / (1 + exp(-x)); }
 
+/* The touched bitmap only pays off for columns (rows for CSR) whose flops are well below the SPA length,
+   denser ones are cheaper to accumulate and scan directly. */
+const uint32_t SPARSE_SPA_RATIO = 4;
+inline bool sparse_spa(const uint64_t flops, const uint32_t length) { return((flops * SPARSE_SPA_RATIO) < length); }
+
+/* SIMD flavor of the dense SPA update, picked once at startup from CPUID so one binary fits all nodes */
+enum SIMD_TYPE {_SCALAR_, _AVX2_, _AVX512_};
+const char* SIMD_TYPES[] = {"_SCALAR_", "_AVX2_", "_AVX512_"};
+
+SIMD_TYPE simd_select() {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return(SIMD_TYPE::_AVX512_);
+    else if(__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) return(SIMD_TYPE::_AVX2_);
+    else return(SIMD_TYPE::_SCALAR_);
+}
+const SIMD_TYPE simd_type = simd_select();
+
+/* s[idx[n]] += x * val[n] for the nitems entries of one column (row for CSR) */
+template<typename Weight>
+inline void spa_axpy_scalar(Weight* s, const uint32_t* idx, const Weight* val, const Weight x, const uint32_t nitems) {
+    for(uint32_t n = 0; n < nitems; n++) {
+        s[idx[n]] += (x * val[n]);
+    }
+}
+
+/* AVX2 has gathers but no scatters, so results are stored lane by lane. Indices of a compressed column are sorted, 
+   hence a repeated index shows up in adjacent lanes and that chunk takes the scalar path. */
+__attribute__((target("avx2,fma")))
+void spa_axpy_avx2(float* s, const uint32_t* idx, const float* val, const float x, const uint32_t nitems) {
+    const __m256  vx = _mm256_set1_ps(x);
+    const __m256i next = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 7);
+    alignas(32) float out[8];
+    uint32_t n = 0;
+    for(; (n + 8) <= nitems; n += 8) {
+        __m256i vi = _mm256_loadu_si256((const __m256i*) (idx + n));
+        __m256i eq = _mm256_cmpeq_epi32(vi, _mm256_permutevar8x32_epi32(vi, next));
+        if(_mm256_movemask_ps(_mm256_castsi256_ps(eq)) & 0x7F) {
+            spa_axpy_scalar<float>(s, idx + n, val + n, x, 8);
+            continue;
+        }
+        __m256 vs = _mm256_i32gather_ps(s, vi, 4);
+        vs = _mm256_fmadd_ps(vx, _mm256_loadu_ps(val + n), vs);
+        _mm256_store_ps(out, vs);
+        for(uint32_t i = 0; i < 8; i++) {
+            s[idx[n + i]] = out[i];
+        }
+    }
+    spa_axpy_scalar<float>(s, idx + n, val + n, x, nitems - n);
+}
+
+/* AVX-512 gathers and scatters 16 lanes under a mask for the tail. The same adjacent lane test replaces vpconflictd,
+   which costs more than it saves on short columns. */
+__attribute__((target("avx512f")))
+void spa_axpy_avx512(float* s, const uint32_t* idx, const float* val, const float x, const uint32_t nitems) {
+    const __m512  vx = _mm512_set1_ps(x);
+    const __m512i next = _mm512_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 15);
+    uint32_t n = 0;
+    for(; n < nitems; n += 16) {
+        const __mmask16 m = ((nitems - n) >= 16) ? 0xFFFF : (__mmask16) ((1U << (nitems - n)) - 1);
+        __m512i vi = _mm512_maskz_loadu_epi32(m, idx + n);
+        if(_mm512_mask_cmpeq_epi32_mask(m & 0x7FFF, vi, _mm512_permutexvar_epi32(next, vi))) {
+            spa_axpy_scalar<float>(s, idx + n, val + n, x, std::min(nitems - n, (uint32_t) 16));
+            continue;
+        }
+        __m512 vs = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, vi, s, 4);
+        vs = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(m, val + n), vs);
+        _mm512_mask_i32scatter_ps(s, m, vi, vs, 4);
+    }
+}
+
+template<typename Weight>
+inline void spa_axpy(Weight* s, const uint32_t* idx, const Weight* val, const Weight x, const uint32_t nitems) {
+    spa_axpy_scalar<Weight>(s, idx, val, x, nitems);
+}
+
+template<>
+inline void spa_axpy<float>(float* s, const uint32_t* idx, const float* val, const float x, const uint32_t nitems) {
+    if(simd_type == SIMD_TYPE::_AVX512_) spa_axpy_avx512(s, idx, val, x, nitems);
+    else if(simd_type == SIMD_TYPE::_AVX2_) spa_axpy_avx2(s, idx, val, x, nitems);
+    else spa_axpy_scalar<float>(s, idx, val, x, nitems);
+}
+
+/* s[idx[n]] += x * c, spa_axpy for a pattern matrix whose values are all c */
+template<typename Weight>
+inline void spa_axpy_pattern_scalar(Weight* s, const uint32_t* idx, const Weight c, const Weight x, const uint32_t nitems) {
+    for(uint32_t n = 0; n < nitems; n++) {
+        s[idx[n]] += (x * c);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void spa_axpy_pattern_avx2(float* s, const uint32_t* idx, const float c, const float x, const uint32_t nitems) {
+    const __m256  vx = _mm256_set1_ps(x);
+    const __m256  vc = _mm256_set1_ps(c);
+    const __m256i next = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 7);
+    alignas(32) float out[8];
+    uint32_t n = 0;
+    for(; (n + 8) <= nitems; n += 8) {
+        __m256i vi = _mm256_loadu_si256((const __m256i*) (idx + n));
+        __m256i eq = _mm256_cmpeq_epi32(vi, _mm256_permutevar8x32_epi32(vi, next));
+        if(_mm256_movemask_ps(_mm256_castsi256_ps(eq)) & 0x7F) {
+            spa_axpy_pattern_scalar<float>(s, idx + n, c, x, 8);
+            continue;
+        }
+        __m256 vs = _mm256_i32gather_ps(s, vi, 4);
+        vs = _mm256_fmadd_ps(vx, vc, vs);
+        _mm256_store_ps(out, vs);
+        for(uint32_t i = 0; i < 8; i++) {
+            s[idx[n + i]] = out[i];
+        }
+    }
+    spa_axpy_pattern_scalar<float>(s, idx + n, c, x, nitems - n);
+}
+
+__attribute__((target("avx512f")))
+void spa_axpy_pattern_avx512(float* s, const uint32_t* idx, const float c, const float x, const uint32_t nitems) {
+    const __m512  vx = _mm512_set1_ps(x);
+    const __m512  vc = _mm512_set1_ps(c);
+    const __m512i next = _mm512_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 15);
+    uint32_t n = 0;
+    for(; n < nitems; n += 16) {
+        const __mmask16 m = ((nitems - n) >= 16) ? 0xFFFF : (__mmask16) ((1U << (nitems - n)) - 1);
+        __m512i vi = _mm512_maskz_loadu_epi32(m, idx + n);
+        if(_mm512_mask_cmpeq_epi32_mask(m & 0x7FFF, vi, _mm512_permutexvar_epi32(next, vi))) {
+            spa_axpy_pattern_scalar<float>(s, idx + n, c, x, std::min(nitems - n, (uint32_t) 16));
+            continue;
+        }
+        __m512 vs = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, vi, s, 4);
+        vs = _mm512_fmadd_ps(vx, vc, vs);
+        _mm512_mask_i32scatter_ps(s, m, vi, vs, 4);
+    }
+}
+
+template<typename Weight>
+inline void spa_axpy_pattern(Weight* s, const uint32_t* idx, const Weight c, const Weight x, const uint32_t nitems) {
+    spa_axpy_pattern_scalar<Weight>(s, idx, c, x, nitems);
+}
+
+template<>
+inline void spa_axpy_pattern<float>(float* s, const uint32_t* idx, const float c, const float x, const uint32_t nitems) {
+    if(simd_type == SIMD_TYPE::_AVX512_) spa_axpy_pattern_avx512(s, idx, c, x, nitems);
+    else if(simd_type == SIMD_TYPE::_AVX2_) spa_axpy_pattern_avx2(s, idx, c, x, nitems);
+    else spa_axpy_pattern_scalar<float>(s, idx, c, x, nitems);
+}
+
+/* Accumulators of one output column (row for CSR), picked per column from its flop count:
+   a dense SPA, an open addressing hash table that fits in L1, or a sorted list for a handful of flops */
+enum ACCUMULATOR_TYPE {_DENSE_ACC_, _HASH_ACC_, _SORT_ACC_, _NUM_ACC_};
+const char* ACCUMULATOR_TYPES[] = {"_DENSE_ACC_", "_HASH_ACC_", "_SORT_ACC_"};
+
+/* Direction of the CSC kernels, as in direction-optimizing BFS: push walks every B column and scatters 
+   the A columns it names, pull gathers the B columns from the CSR rows of the active (nonempty) A columns only. 
+   Pull pays off once those rows hold well under the B entries. */
+enum DIRECTION_TYPE {_PUSH_, _PULL_, _NUM_DIR_};
+const char* DIRECTION_TYPES[] = {"_PUSH_", "_PULL_"};
+const uint32_t PULL_RATIO = 2;
+const uint32_t SORT_ACC_MAX_FLOPS = 32;
+
+template<typename Weight>
+struct Accumulator {
+    public:
+        Accumulator(const uint64_t length_, const uint32_t nlayers, const int32_t socket_id);
+        ~Accumulator() {};
+        inline ACCUMULATOR_TYPE select(const uint64_t flops, const uint32_t nitems) const;
+        inline void hash_insert(const uint32_t key, const Weight value, const uint32_t mask);
+        inline uint32_t hash_gather(const uint32_t mask);
+        inline void list_insert(const uint32_t key, const Weight value, uint32_t& nitems);
+        inline uint32_t list_gather(const uint32_t nitems);
+        inline uint32_t hash_mask(const uint64_t flops) const;
+        inline void map_vectors(const uint32_t* ids, const uint32_t nvecs, const uint32_t nitems);
+        inline void unmap_vectors(const uint32_t* ids, const uint32_t nvecs);
+        inline uint32_t gather_vectors(const uint32_t* X_idx, const Weight* X_val, const Weight X_c, const uint32_t k_start, const uint32_t k_end);
+        inline uint32_t strip_rows(const uint64_t nnz, const uint32_t nrows) const;
+        inline uint32_t map_strips(const uint32_t* JB, const uint32_t* JE, const uint32_t* IA, const uint32_t ncols, const uint32_t nrows, const uint32_t rows);
+        inline DIRECTION_TYPE direction(const uint32_t* A_begin, const uint32_t* A_end, const uint32_t A_ncols, const std::shared_ptr<struct Compressed_Format<Weight>> B_dual) const;
+        inline void gather_rows(const uint32_t* A_begin, const uint32_t* A_end, const uint32_t A_ncols, const std::shared_ptr<struct Compressed_Format<Weight>> B_dual, const uint32_t start, const uint32_t end);
+        inline void count_blocks();
+        
+        uint64_t length;    /* Entries of the dense SPA */
+        uint32_t hash_size; /* Slots of the hash table, a power of two */
+        bool     dense_fits; /* Dense SPA fits in L2, the hash table is not worth it */
+        uint32_t layer = 0;
+        std::shared_ptr<struct Data_Block<Weight>>   spa;
+        std::shared_ptr<struct Data_Block<uint64_t>> bitmap;  /* One bit per SPA entry marking touched rows */
+        std::shared_ptr<struct Data_Block<uint32_t>> keys;    /* Hash keys stored as row+1, zero is an empty slot */
+        std::shared_ptr<struct Data_Block<Weight>>   values;
+        std::shared_ptr<struct Data_Block<uint32_t>> list_idx; /* Sorted rows of a hash or sort column */
+        std::shared_ptr<struct Data_Block<Weight>>   list_val; /* and their values */
+        std::vector<std::array<uint64_t, _NUM_ACC_>> counters; /* Columns per layer and accumulator */
+        std::vector<uint64_t> live_rows; /* Rows left after each layer when rows are compacted */
+        std::shared_ptr<struct Data_Block<uint32_t>> vec_map; /* Position+1 of a stored column of a DCSC operand, zero if empty */
+        std::shared_ptr<struct Data_Block<uint32_t>> vec_idx; /* Positions of the stored columns an output column reads */
+        std::shared_ptr<struct Data_Block<Weight>>   vec_val; /* and their scales */
+        bool     strips = false;  /* Split the CSC operand A into row strips, see map_strips */
+        uint32_t strip_nrows = 0; /* Rows of a strip, 0 sizes them from L2 */
+        std::shared_ptr<struct Data_Block<uint32_t>> strip_ptr; /* First entry of every strip in every column of A, strip major */
+        std::vector<std::array<uint64_t, _NUM_DIR_>> directions; /* Push and pull kernel calls per layer */
+        std::shared_ptr<struct Data_Block<uint32_t>> pull_ptr; /* B columns gathered by gather_rows */
+        std::shared_ptr<struct Data_Block<uint32_t>> pull_idx;
+        std::shared_ptr<struct Data_Block<Weight>>   pull_val;
+        std::vector<uint64_t> remaps;  /* Data_Block remaps per layer */
+        std::vector<uint64_t> memsets; /* Data_Block bytes cleared per layer */
+};
+
+template<typename Weight>
+Accumulator<Weight>::Accumulator(const uint64_t length_, const uint32_t nlayers, const int32_t socket_id) : length(length_) {
+    const uint64_t l1_size = (Env::L1_DCACHE_SIZE) ? Env::L1_DCACHE_SIZE : 32768;
+    const uint64_t l2_size = (Env::L2_CACHE_SIZE) ? Env::L2_CACHE_SIZE : 262144;
+    hash_size = 16;
+    while(((hash_size * 2) * (sizeof(uint32_t) + sizeof(Weight))) <= (l1_size / 2)) { hash_size *= 2; }
+    dense_fits = ((length * sizeof(Weight)) <= l2_size);
+    
+    spa = std::make_shared<struct Data_Block<Weight>>(length, socket_id);
+    bitmap = std::make_shared<struct Data_Block<uint64_t>>((length + 63) / 64, socket_id);
+    keys = std::make_shared<struct Data_Block<uint32_t>>(hash_size, socket_id);
+    values = std::make_shared<struct Data_Block<Weight>>(hash_size, socket_id);
+    list_idx = std::make_shared<struct Data_Block<uint32_t>>(std::max(hash_size / 2, SORT_ACC_MAX_FLOPS), socket_id);
+    list_val = std::make_shared<struct Data_Block<Weight>>(std::max(hash_size / 2, SORT_ACC_MAX_FLOPS), socket_id);
+    counters.resize(nlayers);
+    live_rows.resize(nlayers);
+    vec_map = std::make_shared<struct Data_Block<uint32_t>>(0, socket_id);
+    vec_idx = std::make_shared<struct Data_Block<uint32_t>>(0, socket_id);
+    vec_val = std::make_shared<struct Data_Block<Weight>>(0, socket_id);
+    strip_ptr = std::make_shared<struct Data_Block<uint32_t>>(0, socket_id);
+    directions.resize(nlayers);
+    pull_ptr = std::make_shared<struct Data_Block<uint32_t>>(0, socket_id);
+    pull_idx = std::make_shared<struct Data_Block<uint32_t>>(0, socket_id);
+    pull_val = std::make_shared<struct Data_Block<Weight>>(0, socket_id);
+    remaps.resize(nlayers);
+    memsets.resize(nlayers);
+}
+
+template<typename Weight>
+inline ACCUMULATOR_TYPE Accumulator<Weight>::select(const uint64_t flops, const uint32_t nitems) const {
+    if(flops <= SORT_ACC_MAX_FLOPS) return(ACCUMULATOR_TYPE::_SORT_ACC_);
+    else if((not dense_fits) and ((flops * 2) <= hash_size) and ((flops * 2) < nitems)) return(ACCUMULATOR_TYPE::_HASH_ACC_);
+    else return(ACCUMULATOR_TYPE::_DENSE_ACC_);
+}
+
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::hash_mask(const uint64_t flops) const {
+    /* Smallest power of two with at most 50% load, so gathering scans as few slots as possible */
+    uint32_t size = 16;
+    while(size < (flops * 2)) { size *= 2; }
+    return(size - 1);
+}
+
+template<typename Weight>
+inline void Accumulator<Weight>::hash_insert(const uint32_t key, const Weight value, const uint32_t mask) {
+    uint32_t* k_A = keys->ptr;
+    Weight*   v_A = values->ptr;
+    uint32_t h = (key * 2654435761U) & mask;
+    while(k_A[h] and (k_A[h] != (key + 1))) { h = (h + 1) & mask; }
+    k_A[h] = key + 1;
+    v_A[h] += value;
+}
+
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::hash_gather(const uint32_t mask) {
+    uint32_t* k_A = keys->ptr;
+    Weight*   v_A = values->ptr;
+    uint32_t* i_A = list_idx->ptr;
+    Weight*   l_A = list_val->ptr;
+    uint32_t nitems = 0;
+    for(uint32_t h = 0; h <= mask; h++) {
+        if(k_A[h]) { i_A[nitems++] = k_A[h] - 1; }
+    }
+    /* Sort the rows, then probe again for their values as probing chains must stay intact until all are read */
+    std::sort(i_A, i_A + nitems);
+    for(uint32_t n = 0; n < nitems; n++) {
+        uint32_t h = (i_A[n] * 2654435761U) & mask;
+        while(k_A[h] != (i_A[n] + 1)) { h = (h + 1) & mask; }
+        l_A[n] = v_A[h];
+    }
+    memset(k_A, 0, (mask + 1) * sizeof(uint32_t));
+    memset(v_A, 0, (mask + 1) * sizeof(Weight));
+    return(nitems);
+}
+
+template<typename Weight>
+inline void Accumulator<Weight>::list_insert(const uint32_t key, const Weight value, uint32_t& nitems) {
+    list_idx->ptr[nitems] = key;
+    list_val->ptr[nitems] = value;
+    nitems++;
+}
+
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::list_gather(const uint32_t nitems) {
+    uint32_t* i_A = list_idx->ptr;
+    Weight*   l_A = list_val->ptr;
+    if(not nitems) return(0);
+    /* Insertion sort is the fastest for the few pairs that end up here, then merge equal rows */
+    for(uint32_t i = 1; i < nitems; i++) {
+        uint32_t key = i_A[i];
+        Weight value = l_A[i];
+        uint32_t j = i;
+        while(j and (i_A[j-1] > key)) { i_A[j] = i_A[j-1]; l_A[j] = l_A[j-1]; j--; }
+        i_A[j] = key;
+        l_A[j] = value;
+    }
+    uint32_t n = 0;
+    for(uint32_t i = 1; i < nitems; i++) {
+        if(i_A[i] == i_A[n]) { l_A[n] += l_A[i]; }
+        else { n++; i_A[n] = i_A[i]; l_A[n] = l_A[i]; }
+    }
+    return(n + 1);
+}
+
+/* Indexes the stored columns of a DCSC operand by id, so it can be read like a CSC one */
+template<typename Weight>
+inline void Accumulator<Weight>::map_vectors(const uint32_t* ids, const uint32_t nvecs, const uint32_t nitems) {
+    if(vec_map->nitems < nitems) vec_map->reallocate(nitems);
+    uint32_t* m_A = vec_map->ptr;
+    for(uint32_t p = 0; p < nvecs; p++) {
+        m_A[ids[p]] = p + 1;
+    }
+}
+
+template<typename Weight>
+inline void Accumulator<Weight>::unmap_vectors(const uint32_t* ids, const uint32_t nvecs) {
+    uint32_t* m_A = vec_map->ptr;
+    for(uint32_t p = 0; p < nvecs; p++) {
+        m_A[ids[p]] = 0;
+    }
+}
+
+/* Translates the column ids X_idx[k_start, k_end) to positions, dropping the empty columns (X_c for a pattern X) */
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::gather_vectors(const uint32_t* X_idx, const Weight* X_val, const Weight X_c, const uint32_t k_start, const uint32_t k_end) {
+    if(vec_idx->nitems < (k_end - k_start)) {
+        vec_idx->reallocate(k_end - k_start);
+        vec_val->reallocate(k_end - k_start);
+    }
+    const uint32_t* m_A = vec_map->ptr;
+    uint32_t* i_A = vec_idx->ptr;
+    Weight*   v_A = vec_val->ptr;
+    uint32_t nvecs = 0;
+    for(uint32_t k = k_start; k < k_end; k++) {
+        uint32_t p = m_A[X_idx[k]];
+        if(p) {
+            i_A[nvecs] = p - 1;
+            v_A[nvecs] = (X_val) ? X_val[k] : X_c;
+            nvecs++;
+        }
+    }
+    return(nvecs);
+}
+
+/* Rows of a strip of A (a multiple of 64 to align with the bitmap words), or 0 if A is not worth splitting.
+   A strip is sized so that its SPA and its share of A's row indices and values fit in half of L2. */
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::strip_rows(const uint64_t nnz, const uint32_t nrows) const {
+    if(not strips) return(0);
+    uint32_t rows = strip_nrows;
+    if(not rows) {
+        const uint64_t l2_size = (Env::L2_CACHE_SIZE) ? Env::L2_CACHE_SIZE : 262144;
+        const uint64_t row_bytes = sizeof(Weight) + ((nnz / std::max(nrows, (uint32_t) 1)) * (sizeof(uint32_t) + sizeof(Weight)));
+        rows = std::min((uint64_t) nrows, (l2_size / 2) / row_bytes);
+    }
+    rows = std::max((uint32_t) 64, rows & ~63U);
+    return((rows < nrows) ? rows : 0);
+}
+
+/* Fills strip_ptr with the first entry of strip t in column l at [t * (ncols + 1) + l], 
+   strip t of column l is then [strip_ptr[t][l], strip_ptr[t+1][l]). Column l is [JB[l], JE[l]).
+   Returns the number of strips. */
+template<typename Weight>
+inline uint32_t Accumulator<Weight>::map_strips(const uint32_t* JB, const uint32_t* JE, const uint32_t* IA, const uint32_t ncols, const uint32_t nrows, const uint32_t rows) {
+    const uint32_t nstrips = (nrows + rows - 1) / rows;
+    const uint64_t nitems = (uint64_t) (nstrips + 1) * (ncols + 1);
+    if(strip_ptr->nitems < nitems) strip_ptr->reallocate(nitems);
+    uint32_t* p_A = strip_ptr->ptr;
+    for(uint32_t l = 0; l < ncols; l++) {
+        uint32_t i = JB[l];
+        for(uint32_t t = 0; t < nstrips; t++) {
+            const uint32_t row_start = t * rows;
+            while((i < JE[l]) and (IA[i] < row_start)) i++;
+            p_A[(t * (ncols + 1)) + l] = i;
+        }
+        p_A[(nstrips * (ncols + 1)) + l] = JE[l];
+    }
+    return(nstrips);
+}
+
+/* Push unless B has a CSR copy and the rows of the active A columns hold under 1/PULL_RATIO of B */
+template<typename Weight>
+inline DIRECTION_TYPE Accumulator<Weight>::direction(const uint32_t* A_begin, const uint32_t* A_end, const uint32_t A_ncols, const std::shared_ptr<struct Compressed_Format<Weight>> B_dual) const {
+    if(not B_dual) return(DIRECTION_TYPE::_PUSH_);
+    const uint32_t* R_IA = std::static_pointer_cast<struct CSR<Weight>>(B_dual)->IA_blk->ptr;
+    uint64_t active_nnz = 0;
+    for(uint32_t l = 0; l < A_ncols; l++) {
+        if(A_end[l] > A_begin[l]) active_nnz += R_IA[l+1] - R_IA[l];
+    }
+    return(((active_nnz * PULL_RATIO) < R_IA[A_ncols]) ? DIRECTION_TYPE::_PULL_ : DIRECTION_TYPE::_PUSH_);
+}
+
+/* Builds the columns [start, end) of B restricted to the rows of the active A columns into 
+   pull_ptr (indexed by the column id), pull_idx and pull_val, a counting sort of their CSR rows */
+template<typename Weight>
+inline void Accumulator<Weight>::gather_rows(const uint32_t* A_begin, const uint32_t* A_end, const uint32_t A_ncols, const std::shared_ptr<struct Compressed_Format<Weight>> B_dual, const uint32_t start, const uint32_t end) {
+    const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_dual);
+    const uint32_t* R_IA = B_CSR->IA_blk->ptr;
+    const uint32_t* R_JA = B_CSR->JA_blk->ptr;
+    const Weight*   R_A  = B_CSR->A_blk->ptr;
+    if(pull_ptr->nitems < (B_CSR->ncols + 1)) pull_ptr->reallocate(B_CSR->ncols + 1);
+    uint32_t* p_A = pull_ptr->ptr;
+    memset(p_A + start, 0, (end - start + 1) * sizeof(uint32_t));
+    
+    uint64_t nitems = 0;
+    for(uint32_t l = 0; l < A_ncols; l++) {
+        if(A_end[l] == A_begin[l]) continue;
+        const uint32_t* first = (start) ? std::lower_bound(R_JA + R_IA[l], R_JA + R_IA[l+1], start) : R_JA + R_IA[l];
+        for(const uint32_t* n = first; (n < R_JA + R_IA[l+1]) and (*n < end); n++) {
+            p_A[*n + 1]++;
+            nitems++;
+        }
+    }
+    if(pull_idx->nitems < nitems) {
+        pull_idx->reallocate(nitems);
+        pull_val->reallocate(nitems);
+    }
+    uint32_t* i_A = pull_idx->ptr;
+    Weight*   v_A = pull_val->ptr;
+    
+    // p_A[j+1] holds the count of column j, shift it to the start of column j and fill
+    uint32_t sum = 0;
+    for(uint32_t j = start; j < end; j++) {
+        uint32_t count = p_A[j+1];
+        p_A[j+1] = sum;
+        sum += count;
+    }
+    for(uint32_t l = 0; l < A_ncols; l++) {
+        if(A_end[l] == A_begin[l]) continue;
+        const uint32_t* first = (start) ? std::lower_bound(R_JA + R_IA[l], R_JA + R_IA[l+1], start) : R_JA + R_IA[l];
+        for(const uint32_t* n = first; (n < R_JA + R_IA[l+1]) and (*n < end); n++) {
+            uint32_t& k = p_A[*n + 1];
+            i_A[k] = l;
+            v_A[k] = (R_A) ? R_A[n - R_JA] : B_dual->pattern_value;
+            k++;
+        }
+    }
+    p_A[start] = 0;
+}
+
+/* Moves what the calling thread's Data_Blocks did since the last call into the current layer */
+template<typename Weight>
+inline void Accumulator<Weight>::count_blocks() {
+    remaps[layer] += Env::nremaps;
+    memsets[layer] += Env::nmemset_bytes;
+    Env::nremaps = 0;
+    Env::nmemset_bytes = 0;
+}
+
+/* Computes one output column (one row for CSR): for every k in [k_start, k_end), the Y column (row) X_idx[k] 
+   scaled by X_val[k] is added to the accumulator, then the result goes through bias and activation into C.
+   A null X_val (Y_val) is a pattern matrix whose values are all X_c (Y_c). Y column l is [Y_begin[l], Y_end[l]),
+   Y_end is Y_begin + 1 unless Y is a segmented CSC. */
+template<typename Activation, typename Weight, typename Matrix>
+inline void spmm_accumulate(std::shared_ptr<struct Accumulator<Weight>> s,
+                            const std::shared_ptr<Matrix> C_SPMAT,
+                            const uint32_t* X_idx, const Weight* X_val, const Weight X_c, const uint32_t k_start, const uint32_t k_end,
+                            const uint32_t* Y_begin, const uint32_t* Y_end, const uint32_t* Y_idx, const Weight* Y_val, const Weight Y_c, const uint32_t nitems,
+                            const Weight* b_A,
+                            const uint32_t col,
+                            uint64_t& idx_nnz,
+                            const int32_t tid) {
+    uint64_t flops = 0;
+    for(uint32_t k = k_start; k < k_end; k++) {
+        uint32_t l = X_idx[k];
+        flops += Y_end[l] - Y_begin[l];
+    }
+    
+    ACCUMULATOR_TYPE accumulator_type = s->select(flops, nitems);
+    s->counters[s->layer][accumulator_type]++;
+    if(accumulator_type == ACCUMULATOR_TYPE::_DENSE_ACC_) {
+        Weight*   s_A = s->spa->ptr;
+        uint64_t* m_A = (sparse_spa(flops, nitems)) ? s->bitmap->ptr : nullptr;
+        if(m_A) {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                Weight   x = (X_val) ? X_val[k] : X_c;
+                for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                    uint32_t r = Y_idx[n];
+                    s_A[r] += (x * ((Y_val) ? Y_val[n] : Y_c));
+                    m_A[r >> 6] |= (1UL << (r & 63));
+                }
+            }
+        }
+        else if(Y_val) {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                spa_axpy<Weight>(s_A, Y_idx + Y_begin[l], Y_val + Y_begin[l], (X_val) ? X_val[k] : X_c, Y_end[l] - Y_begin[l]);
+            }
+        }
+        else {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                spa_axpy_pattern<Weight>(s_A, Y_idx + Y_begin[l], Y_c, (X_val) ? X_val[k] : X_c, Y_end[l] - Y_begin[l]);
+            }
+        }
+        C_SPMAT->template populate_spa<Activation>(&s_A, m_A, b_A, col, idx_nnz, tid);
+    }
+    else if(accumulator_type == ACCUMULATOR_TYPE::_HASH_ACC_) {
+        const uint32_t mask = s->hash_mask(flops);
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            Weight   x = (X_val) ? X_val[k] : X_c;
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->hash_insert(Y_idx[n], (x * ((Y_val) ? Y_val[n] : Y_c)), mask);
+            }
+        }
+        C_SPMAT->template populate_list<Activation>(s->list_idx->ptr, s->list_val->ptr, s->hash_gather(mask), b_A, col, idx_nnz, tid);
+    }
+    else {
+        uint32_t nlist = 0;
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            Weight   x = (X_val) ? X_val[k] : X_c;
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->list_insert(Y_idx[n], (x * ((Y_val) ? Y_val[n] : Y_c)), nlist);
+            }
+        }
+        C_SPMAT->template populate_list<Activation>(s->list_idx->ptr, s->list_val->ptr, s->list_gather(nlist), b_A, col, idx_nnz, tid);
+    }
+}
+
+/* Row strip counterpart of spmm_accumulate for a CSC A: only the rows [row_start, row_end) of the
+   Y (A) columns are read, Y_begin/Y_end bound them, and the strip is appended to column col of C
+   after the previous strips, so the merged column needs no sort. */
+template<typename Activation, typename Weight>
+inline void spmm_accumulate_strip(std::shared_ptr<struct Accumulator<Weight>> s,
+                                  const std::shared_ptr<struct CSC<Weight>> C_CSC,
+                                  const uint32_t* X_idx, const Weight* X_val, const Weight X_c, const uint32_t k_start, const uint32_t k_end,
+                                  const uint32_t* Y_begin, const uint32_t* Y_end, const uint32_t* Y_idx, const Weight* Y_val, const Weight Y_c, 
+                                  const uint32_t row_start, const uint32_t row_end,
+                                  const Weight* b_A,
+                                  const uint32_t col,
+                                  uint64_t& idx_nnz,
+                                  const int32_t tid) {
+    uint64_t flops = 0;
+    for(uint32_t k = k_start; k < k_end; k++) {
+        uint32_t l = X_idx[k];
+        flops += Y_end[l] - Y_begin[l];
+    }
+    if(not flops) return;
+    
+    ACCUMULATOR_TYPE accumulator_type = s->select(flops, row_end - row_start);
+    s->counters[s->layer][accumulator_type]++;
+    if(accumulator_type == ACCUMULATOR_TYPE::_DENSE_ACC_) {
+        Weight*   s_A = s->spa->ptr;
+        uint64_t* m_A = (sparse_spa(flops, row_end - row_start)) ? s->bitmap->ptr : nullptr;
+        if(m_A) {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                Weight   x = (X_val) ? X_val[k] : X_c;
+                for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                    uint32_t r = Y_idx[n];
+                    s_A[r] += (x * ((Y_val) ? Y_val[n] : Y_c));
+                    m_A[r >> 6] |= (1UL << (r & 63));
+                }
+            }
+        }
+        else if(Y_val) {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                spa_axpy<Weight>(s_A, Y_idx + Y_begin[l], Y_val + Y_begin[l], (X_val) ? X_val[k] : X_c, Y_end[l] - Y_begin[l]);
+            }
+        }
+        else {
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                spa_axpy_pattern<Weight>(s_A, Y_idx + Y_begin[l], Y_c, (X_val) ? X_val[k] : X_c, Y_end[l] - Y_begin[l]);
+            }
+        }
+        C_CSC->template populate_spa_rows<Activation>(&s_A, m_A, b_A, col, row_start, row_end, idx_nnz, tid);
+    }
+    else if(accumulator_type == ACCUMULATOR_TYPE::_HASH_ACC_) {
+        const uint32_t mask = s->hash_mask(flops);
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            Weight   x = (X_val) ? X_val[k] : X_c;
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->hash_insert(Y_idx[n], (x * ((Y_val) ? Y_val[n] : Y_c)), mask);
+            }
+        }
+        C_CSC->template populate_list<Activation>(s->list_idx->ptr, s->list_val->ptr, s->hash_gather(mask), b_A, col, idx_nnz, tid);
+    }
+    else {
+        uint32_t nlist = 0;
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            Weight   x = (X_val) ? X_val[k] : X_c;
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->list_insert(Y_idx[n], (x * ((Y_val) ? Y_val[n] : Y_c)), nlist);
+            }
+        }
+        C_CSC->template populate_list<Activation>(s->list_idx->ptr, s->list_val->ptr, s->list_gather(nlist), b_A, col, idx_nnz, tid);
+    }
+}
+
+/* Symbolic counterpart of spmm_accumulate, returns the number of distinct rows (columns for CSR) */
+template<typename Weight>
+inline uint64_t spmm_count(std::shared_ptr<struct Accumulator<Weight>> s,
+                           const uint32_t* X_idx, const uint32_t k_start, const uint32_t k_end,
+                           const uint32_t* Y_begin, const uint32_t* Y_end, const uint32_t* Y_idx, const uint32_t nitems) {
+    uint64_t nnz = 0;
+    uint64_t flops = 0;
+    for(uint32_t k = k_start; k < k_end; k++) {
+        uint32_t l = X_idx[k];
+        flops += Y_end[l] - Y_begin[l];
+    }
+    
+    ACCUMULATOR_TYPE accumulator_type = s->select(flops, nitems);
+    if(accumulator_type == ACCUMULATOR_TYPE::_DENSE_ACC_) {
+        if(sparse_spa(flops, nitems)) {
+            uint64_t* m_A = s->bitmap->ptr;
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                    uint32_t r = Y_idx[n];
+                    m_A[r >> 6] |= (1UL << (r & 63));
+                }
+            }
+            // Count touched rows a word at a time instead of scanning the whole SPA
+            const uint32_t nwords = (nitems + 63) >> 6;
+            for(uint32_t w = 0; w < nwords; w++) {
+                if(m_A[w]) {
+                    nnz += __builtin_popcountll(m_A[w]);
+                    m_A[w] = 0;
+                }
+            }
+        }
+        else {
+            Weight* s_A = s->spa->ptr;
+            for(uint32_t k = k_start; k < k_end; k++) {
+                uint32_t l = X_idx[k];
+                for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                    s_A[Y_idx[n]] = 1;
+                }
+            }
+            for(uint32_t i = 0; i < nitems; i++) {
+                if(s_A[i]) {
+                    nnz++;
+                    s_A[i] = 0;
+                }
+            }
+        }
+    }
+    else if(accumulator_type == ACCUMULATOR_TYPE::_HASH_ACC_) {
+        const uint32_t mask = s->hash_mask(flops);
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->hash_insert(Y_idx[n], 1, mask);
+            }
+        }
+        uint32_t* k_A = s->keys->ptr;
+        for(uint32_t h = 0; h <= mask; h++) {
+            if(k_A[h]) nnz++;
+        }
+        memset(k_A, 0, (mask + 1) * sizeof(uint32_t));
+        memset(s->values->ptr, 0, (mask + 1) * sizeof(Weight));
+    }
+    else {
+        uint32_t nlist = 0;
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->list_insert(Y_idx[n], 1, nlist);
+            }
+        }
+        nnz = s->list_gather(nlist);
+    }
+    return(nnz);
+}
+
+/* Symbolic counterpart of spmm_accumulate_strip */
+template<typename Weight>
+inline uint64_t spmm_count_strip(std::shared_ptr<struct Accumulator<Weight>> s,
+                                 const uint32_t* X_idx, const uint32_t k_start, const uint32_t k_end,
+                                 const uint32_t* Y_begin, const uint32_t* Y_end, const uint32_t* Y_idx, 
+                                 const uint32_t row_start, const uint32_t row_end) {
+    uint64_t nnz = 0;
+    uint64_t flops = 0;
+    for(uint32_t k = k_start; k < k_end; k++) {
+        uint32_t l = X_idx[k];
+        flops += Y_end[l] - Y_begin[l];
+    }
+    if(not flops) return(0);
+    
+    ACCUMULATOR_TYPE accumulator_type = s->select(flops, row_end - row_start);
+    if(accumulator_type == ACCUMULATOR_TYPE::_DENSE_ACC_) {
+        uint64_t* m_A = s->bitmap->ptr;
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                uint32_t r = Y_idx[n];
+                m_A[r >> 6] |= (1UL << (r & 63));
+            }
+        }
+        const uint32_t end_word = (row_end + 63) >> 6;
+        for(uint32_t w = (row_start >> 6); w < end_word; w++) {
+            if(m_A[w]) {
+                nnz += __builtin_popcountll(m_A[w]);
+                m_A[w] = 0;
+            }
+        }
+    }
+    else if(accumulator_type == ACCUMULATOR_TYPE::_HASH_ACC_) {
+        const uint32_t mask = s->hash_mask(flops);
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->hash_insert(Y_idx[n], 1, mask);
+            }
+        }
+        uint32_t* k_A = s->keys->ptr;
+        for(uint32_t h = 0; h <= mask; h++) {
+            if(k_A[h]) nnz++;
+        }
+        memset(k_A, 0, (mask + 1) * sizeof(uint32_t));
+        memset(s->values->ptr, 0, (mask + 1) * sizeof(Weight));
+    }
+    else {
+        uint32_t nlist = 0;
+        for(uint32_t k = k_start; k < k_end; k++) {
+            uint32_t l = X_idx[k];
+            for(uint32_t n = Y_begin[l]; n < Y_end[l]; n++) {
+                s->list_insert(Y_idx[n], 1, nlist);
+            }
+        }
+        nnz = s->list_gather(nlist);
+    }
+    return(nnz);
+}
+
 template<typename Weight>
 inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
                                                           std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT,
-                                                          std::shared_ptr<struct Data_Block<Weight>> s,
+                                                          std::shared_ptr<struct Accumulator<Weight>> s,
                                                           const uint32_t start,
                                                           const uint32_t end,
                                                           const int32_t tid) {
@@ -41,8 +779,6 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
     uint32_t* B_JA;
     Weight*    B_A;
     
-    Weight* s_A   = s->ptr;
-    
     COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;
     if(compression_type == COMPRESSED_FORMAT::_CSC_) {
         const std::shared_ptr<struct CSC<Weight>> A_CSC = std::static_pointer_cast<struct CSC<Weight>>(A_SPMAT);
@@ -52,6 +788,7 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
         A_IA   = A_CSC->IA_blk->ptr;
         A_JA   = A_CSC->JA_blk->ptr;
         A_A   = A_CSC->A_blk->ptr;
+        const uint32_t* A_JB = (A_CSC->segmented) ? A_CSC->JB_blk->ptr : A_JA;
     
         const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);
         B_nnz   = B_CSC->nnz;
@@ -61,30 +798,35 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
         B_JA   = B_CSC->JA_blk->ptr;
         B_A   = B_CSC->A_blk->ptr;
         
-        if((A_ncols != B_nrows) or (s->nitems < A_nrows)) {
-            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->nitems);
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
             std::exit(1); 
         }
-		//printf("SpMM dimensions tid=%d A[%d %d] B[%d %d], SPA[%lu] [%d %d]\n", tid, A_nrows, A_ncols, B_nrows, B_ncols, s->nitems, start, end);
+		//printf("SpMM dimensions tid=%d A[%d %d] B[%d %d], SPA[%lu] [%d %d]\n", tid, A_nrows, A_ncols, B_nrows, B_ncols, s->length, start, end);
 		//printf("tid=%d start=%d end=%d\n", tid, start, end);
 
-		for(uint32_t j = start; j < end; j++) {
-			//printf("c=%d\n", j);
-			for(uint32_t k = B_JA[j]; k < B_JA[j+1]; k++) {
-				uint32_t l = B_IA[k];
-				//printf("k=%d ", k);
-				for(uint32_t n = A_JA[l]; n < A_JA[l+1]; n++) {
-					//printf("r=%d,v=%f\n", A_IA[n], A_A[n]);
-					s_A[A_IA[n]] = 1;
-				}
-			}
-			for(uint32_t i = 0; i < A_nrows; i++) {
-				if(s_A[i]){
-					nnzmax++;
-					s_A[i] = 0;
-				}
-			}
-		}
+        const uint32_t* X_ptr = B_JA;
+        const uint32_t* X_idx = B_IA;
+        if(s->direction(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual) == DIRECTION_TYPE::_PULL_) {
+            s->gather_rows(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual, start, end);
+            X_ptr = s->pull_ptr->ptr;
+            X_idx = s->pull_idx->ptr;
+        }
+        const uint32_t rows = s->strip_rows(A_JA[A_ncols], A_nrows);
+        if(rows) {
+            const uint32_t nstrips = s->map_strips(A_JB, A_JA + 1, A_IA, A_ncols, A_nrows, rows);
+            const uint32_t* A_SP = s->strip_ptr->ptr;
+            for(uint32_t j = start; j < end; j++) {
+                for(uint32_t t = 0; t < nstrips; t++) {
+                    nnzmax += spmm_count_strip(s, X_idx, X_ptr[j], X_ptr[j+1], A_SP + (t * (A_ncols + 1)), A_SP + ((t + 1) * (A_ncols + 1)), A_IA, t * rows, std::min((t + 1) * rows, A_nrows));
+                }
+            }
+        }
+        else {
+            for(uint32_t j = start; j < end; j++) {
+                nnzmax += spmm_count(s, X_idx, X_ptr[j], X_ptr[j+1], A_JB, A_JA + 1, A_IA, A_nrows);
+            }
+        }
     }
     else if(compression_type == COMPRESSED_FORMAT::_CSR_) {
         const std::shared_ptr<struct CSR<Weight>> A_CSR = std::static_pointer_cast<struct CSR<Weight>>(A_SPMAT);
@@ -94,6 +836,7 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
         A_IA   = A_CSR->IA_blk->ptr;
         A_JA   = A_CSR->JA_blk->ptr;
         A_A   = A_CSR->A_blk->ptr;
+        const uint32_t* A_IB = (A_CSR->segmented) ? A_CSR->IB_blk->ptr : A_IA;
     
         const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);
         B_nnz   = B_CSR->nnz;
@@ -103,24 +846,75 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
         B_JA   = B_CSR->JA_blk->ptr;
         B_A   = B_CSR->A_blk->ptr;
         
-        if((A_ncols != B_nrows) or (s->nitems < B_ncols)) {
-            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->nitems);
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
             std::exit(1); 
         }
 
 		for(uint32_t i = start; i < end; i++) {
-			for(uint32_t k = A_IA[i]; k < A_IA[i+1]; k++) {
-				uint32_t l = A_JA[k];
-				for(uint32_t n = B_IA[l]; n < B_IA[l+1]; n++) {
-					s_A[B_JA[n]] = 1;
-				}
-			}
-			for(uint32_t j = 0; j < B_ncols; j++) {
-				if(s_A[j]){
-					nnzmax++;
-					s_A[j] = 0;
-				}
-			}
+			nnzmax += spmm_count(s, A_JA, A_IB[i], A_IA[i+1], B_IA, B_IA + 1, B_JA, B_ncols);
+		}
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSC_) {
+        const std::shared_ptr<struct DCSC<Weight>> A_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(A_SPMAT);
+        A_nnz   = A_DCSC->nnz;
+        A_nrows = A_DCSC->nrows;
+        A_ncols = A_DCSC->ncols;
+        A_IA   = A_DCSC->IA_blk->ptr;
+        A_JA   = A_DCSC->JA_blk->ptr;
+        A_A   = A_DCSC->A_blk->ptr;
+        uint32_t* A_JC = A_DCSC->JC_blk->ptr;
+        uint32_t A_nnzcols = A_DCSC->nnzcols;
+    
+        const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);
+        B_nnz   = B_CSC->nnz;
+        B_nrows = B_CSC->nrows;
+        B_ncols = B_CSC->ncols;
+        B_IA   = B_CSC->IA_blk->ptr;
+        B_JA   = B_CSC->JA_blk->ptr;
+        B_A   = B_CSC->A_blk->ptr;
+        
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
+            std::exit(1); 
+        }
+        
+        s->map_vectors(A_JC, A_nnzcols, A_ncols);
+		for(uint32_t j = start; j < end; j++) {
+            uint32_t nvecs = s->gather_vectors(B_IA, B_A, B_SPMAT->pattern_value, B_JA[j], B_JA[j+1]);
+			if(nvecs) nnzmax += spmm_count(s, s->vec_idx->ptr, 0, nvecs, A_JA, A_JA + 1, A_IA, A_nrows);
+		}
+        s->unmap_vectors(A_JC, A_nnzcols);
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSR_) {
+        const std::shared_ptr<struct DCSR<Weight>> A_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(A_SPMAT);
+        A_nnz   = A_DCSR->nnz;
+        A_nrows = A_DCSR->nrows;
+        A_ncols = A_DCSR->ncols;
+        A_IA   = A_DCSR->IA_blk->ptr;
+        A_JA   = A_DCSR->JA_blk->ptr;
+        A_A   = A_DCSR->A_blk->ptr;
+        uint32_t* A_IR = A_DCSR->IR_blk->ptr;
+        uint32_t A_nnzrows = A_DCSR->nnzrows;
+    
+        const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);
+        B_nnz   = B_CSR->nnz;
+        B_nrows = B_CSR->nrows;
+        B_ncols = B_CSR->ncols;
+        B_IA   = B_CSR->IA_blk->ptr;
+        B_JA   = B_CSR->JA_blk->ptr;
+        B_A   = B_CSR->A_blk->ptr;
+        
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
+            std::exit(1); 
+        }
+        
+        // Only the stored rows in [start, end) are visited
+        const uint32_t p_start = std::lower_bound(A_IR, A_IR + A_nnzrows, start) - A_IR;
+        const uint32_t p_end = std::lower_bound(A_IR + p_start, A_IR + A_nnzrows, end) - A_IR;
+		for(uint32_t p = p_start; p < p_end; p++) {
+			nnzmax += spmm_count(s, A_JA, A_IA[p], A_IA[p+1], B_IA, B_IA + 1, B_JA, B_ncols);
 		}
     }
     else {
@@ -134,13 +928,12 @@ inline std::tuple<uint64_t, uint32_t, uint32_t> spmm_symb(std::shared_ptr<struct
     return std::make_tuple(nnzmax, nrows, ncols);
 }
 
-template<typename Weight>
+template<typename Activation, typename Weight>
 inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
                       std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT,
                       std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT,
-                      std::shared_ptr<struct Data_Block<Weight>> s,
+                      std::shared_ptr<struct Accumulator<Weight>> s,
                       const std::shared_ptr<struct Data_Block<Weight>> b,
-					  Weight(*activation_function)(Weight),
                       const uint32_t start,
                       const uint32_t end,
                       const uint32_t off,
@@ -168,7 +961,6 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
     uint32_t* C_JA;
     Weight*    C_A;
     
-    Weight*       s_A = s->ptr;
     const Weight* b_A = b->ptr;
     
     COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;
@@ -180,6 +972,7 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
         A_IA   = A_CSC->IA_blk->ptr;
         A_JA   = A_CSC->JA_blk->ptr;
         A_A   = A_CSC->A_blk->ptr;
+        const uint32_t* A_JB = (A_CSC->segmented) ? A_CSC->JB_blk->ptr : A_JA;
         
         const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);          
         B_nnz   = B_CSC->nnz;
@@ -197,19 +990,38 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
         C_JA   = C_CSC->JA_blk->ptr;
         C_A   = C_CSC->A_blk->ptr;
                         
-        if((A_ncols != B_nrows) or (s->nitems < A_nrows)) {
-            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree C[%d %d] != A[%d %d] B[%d %d], SPA[%lu]\n", C_nrows, C_ncols, A_nrows, A_ncols, B_nrows, B_ncols, s->nitems);
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree C[%d %d] != A[%d %d] B[%d %d], SPA[%lu]\n", C_nrows, C_ncols, A_nrows, A_ncols, B_nrows, B_ncols, s->length);
             std::exit(1); 
         }
 
-        for(uint32_t j = start; j < end; j++) {
-            for(uint32_t k = B_JA[j]; k < B_JA[j+1]; k++) {
-                uint32_t l = B_IA[k];
-                for(uint32_t n = A_JA[l]; n < A_JA[l+1]; n++) {
-                    s_A[A_IA[n]] += (B_A[k] * A_A[n]);
+        const uint32_t* X_ptr = B_JA;
+        const uint32_t* X_idx = B_IA;
+        const Weight*   X_val = B_A;
+        const DIRECTION_TYPE direction = s->direction(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual);
+        s->directions[s->layer][direction]++;
+        if(direction == DIRECTION_TYPE::_PULL_) {
+            s->gather_rows(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual, start, end);
+            X_ptr = s->pull_ptr->ptr;
+            X_idx = s->pull_idx->ptr;
+            X_val = s->pull_val->ptr;
+        }
+        const uint32_t rows = s->strip_rows(A_JA[A_ncols], A_nrows);
+        if(rows) {
+            const uint32_t nstrips = s->map_strips(A_JB, A_JA + 1, A_IA, A_ncols, A_nrows, rows);
+            const uint32_t* A_SP = s->strip_ptr->ptr;
+            for(uint32_t j = start; j < end; j++) {
+                // Strips with no flops leave the column untouched
+                C_JA[off + j + 1] = idx_nnz;
+                for(uint32_t t = 0; t < nstrips; t++) {
+                    spmm_accumulate_strip<Activation>(s, C_CSC, X_idx, X_val, B_SPMAT->pattern_value, X_ptr[j], X_ptr[j+1], A_SP + (t * (A_ncols + 1)), A_SP + ((t + 1) * (A_ncols + 1)), A_IA, A_A, A_SPMAT->pattern_value, t * rows, std::min((t + 1) * rows, A_nrows), b_A, off + j, idx_nnz, tid);
                 }
             }
-			C_CSC->populate_spa(&s_A, b_A, off + j, idx_nnz, activation_function, tid);
+        }
+        else {
+            for(uint32_t j = start; j < end; j++) {
+                spmm_accumulate<Activation>(s, C_CSC, X_idx, X_val, B_SPMAT->pattern_value, X_ptr[j], X_ptr[j+1], A_JB, A_JA + 1, A_IA, A_A, A_SPMAT->pattern_value, A_nrows, b_A, off + j, idx_nnz, tid);
+            }
         }
     }
     else if(compression_type == COMPRESSED_FORMAT::_CSR_) {
@@ -220,6 +1032,7 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
         A_IA   = A_CSR->IA_blk->ptr;
         A_JA   = A_CSR->JA_blk->ptr;
         A_A   = A_CSR->A_blk->ptr;
+        const uint32_t* A_IB = (A_CSR->segmented) ? A_CSR->IB_blk->ptr : A_IA;
         
         const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);          
         B_nnz   = B_CSR->nnz;
@@ -237,21 +1050,270 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
         C_JA   = C_CSR->JA_blk->ptr;
         C_A   = C_CSR->A_blk->ptr;
 
-        if((A_ncols != B_nrows) or (s->nitems < B_ncols)) {
-            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree C[%d %d] != A[%d %d] B[%d %d], SPA[%lu] Bias[%lu]\n", C_nrows, C_ncols, A_nrows, A_ncols, B_nrows, B_ncols, s->nitems, b->nitems);
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree C[%d %d] != A[%d %d] B[%d %d], SPA[%lu] Bias[%lu]\n", C_nrows, C_ncols, A_nrows, A_ncols, B_nrows, B_ncols, s->length, b->nitems);
             std::exit(1); 
         }
 		
-		for(uint32_t i = start; i < end; i++) {
-			for(uint32_t k = A_IA[i]; k < A_IA[i+1]; k++) {
-				uint32_t l = A_JA[k];
-				for(uint32_t n = B_IA[l]; n < B_IA[l+1]; n++) {
-					s_A[B_JA[n]] += (A_A[k] * B_A[n]);
-				}
-			}
-			C_CSR->populate_spa(&s_A, b_A, off + i, idx_nnz, activation_function, tid);
+        for(uint32_t i = start; i < end; i++) {
+            spmm_accumulate<Activation>(s, C_CSR, A_JA, A_A, A_SPMAT->pattern_value, A_IB[i], A_IA[i+1], B_IA, B_IA + 1, B_JA, B_A, B_SPMAT->pattern_value, B_ncols, b_A, off + i, idx_nnz, tid);
 		}        
     }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSC_) {
+        const std::shared_ptr<struct DCSC<Weight>> A_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(A_SPMAT);
+        A_nrows = A_DCSC->nrows;
+        A_ncols = A_DCSC->ncols;
+        A_IA   = A_DCSC->IA_blk->ptr;
+        A_JA   = A_DCSC->JA_blk->ptr;
+        A_A   = A_DCSC->A_blk->ptr;
+        uint32_t* A_JC = A_DCSC->JC_blk->ptr;
+        uint32_t A_nnzcols = A_DCSC->nnzcols;
+        
+        const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);          
+        B_nrows = B_CSC->nrows;
+        B_ncols = B_CSC->ncols;
+        B_IA   = B_CSC->IA_blk->ptr;
+        B_JA   = B_CSC->JA_blk->ptr;
+        B_A   = B_CSC->A_blk->ptr;
+            
+        const std::shared_ptr<struct DCSC<Weight>> C_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(C_SPMAT);              
+                        
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
+            std::exit(1); 
+        }
+        
+        // B column entries are mapped to the stored A columns, the ones hitting empty columns are dropped
+        s->map_vectors(A_JC, A_nnzcols, A_ncols);
+        for(uint32_t j = start; j < end; j++) {
+            uint32_t nvecs = s->gather_vectors(B_IA, B_A, B_SPMAT->pattern_value, B_JA[j], B_JA[j+1]);
+            if(not nvecs) continue;
+            spmm_accumulate<Activation>(s, C_DCSC, s->vec_idx->ptr, s->vec_val->ptr, (Weight) 0, 0, nvecs, A_JA, A_JA + 1, A_IA, A_A, A_SPMAT->pattern_value, A_nrows, b_A, off + j, idx_nnz, tid);
+        }
+        s->unmap_vectors(A_JC, A_nnzcols);
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSR_) {
+        const std::shared_ptr<struct DCSR<Weight>> A_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(A_SPMAT);
+        A_nrows = A_DCSR->nrows;
+        A_ncols = A_DCSR->ncols;
+        A_IA   = A_DCSR->IA_blk->ptr;
+        A_JA   = A_DCSR->JA_blk->ptr;
+        A_A   = A_DCSR->A_blk->ptr;
+        uint32_t* A_IR = A_DCSR->IR_blk->ptr;
+        uint32_t A_nnzrows = A_DCSR->nnzrows;
+        
+        const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);          
+        B_nrows = B_CSR->nrows;
+        B_ncols = B_CSR->ncols;
+        B_IA   = B_CSR->IA_blk->ptr;
+        B_JA   = B_CSR->JA_blk->ptr;
+        B_A   = B_CSR->A_blk->ptr;
+            
+        const std::shared_ptr<struct DCSR<Weight>> C_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(C_SPMAT);              
+
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu] Bias[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length, b->nitems);
+            std::exit(1); 
+        }
+        
+        const uint32_t p_start = std::lower_bound(A_IR, A_IR + A_nnzrows, start) - A_IR;
+        const uint32_t p_end = std::lower_bound(A_IR + p_start, A_IR + A_nnzrows, end) - A_IR;
+        for(uint32_t p = p_start; p < p_end; p++) {
+            spmm_accumulate<Activation>(s, C_DCSR, A_JA, A_A, A_SPMAT->pattern_value, A_IA[p], A_IA[p+1], B_IA, B_IA + 1, B_JA, B_A, B_SPMAT->pattern_value, B_ncols, b_A, off + A_IR[p], idx_nnz, tid);
+        }
+    }
+    else {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
+        std::exit(Env::finalize());
+    }
+}
+
+
+/* Fused single-pass SpMM: each output column (row for CSR) is computed once and
+   appended to C, which grows on demand instead of being sized by spmm_symb. */
+template<typename Activation, typename Weight>
+inline void spmm_fused(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
+                       std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT,
+                       std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT,
+                       std::shared_ptr<struct Accumulator<Weight>> s,
+                       const std::shared_ptr<struct Data_Block<Weight>> b,
+                       const uint32_t start,
+                       const uint32_t end,
+                       const uint32_t off,
+                       uint64_t& idx_nnz,
+                       const int32_t tid) {
+    
+    uint32_t A_nrows;
+    uint32_t A_ncols;
+    uint32_t* A_IA;
+    uint32_t* A_JA;
+    Weight*    A_A;
+        
+    uint32_t B_nrows;
+    uint32_t B_ncols;
+    uint32_t* B_IA;
+    uint32_t* B_JA;
+    Weight*    B_A;
+    
+    const Weight* b_A = b->ptr;
+    
+    COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;
+    if(compression_type == COMPRESSED_FORMAT::_CSC_) {
+        const std::shared_ptr<struct CSC<Weight>> A_CSC = std::static_pointer_cast<struct CSC<Weight>>(A_SPMAT);
+        A_nrows = A_CSC->nrows;
+        A_ncols = A_CSC->ncols;
+        A_IA   = A_CSC->IA_blk->ptr;
+        A_JA   = A_CSC->JA_blk->ptr;
+        A_A   = A_CSC->A_blk->ptr;
+        const uint32_t* A_JB = (A_CSC->segmented) ? A_CSC->JB_blk->ptr : A_JA;
+        
+        const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);          
+        B_nrows = B_CSC->nrows;
+        B_ncols = B_CSC->ncols;
+        B_IA   = B_CSC->IA_blk->ptr;
+        B_JA   = B_CSC->JA_blk->ptr;
+        B_A   = B_CSC->A_blk->ptr;
+            
+        const std::shared_ptr<struct CSC<Weight>> C_CSC = std::static_pointer_cast<struct CSC<Weight>>(C_SPMAT);              
+                        
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
+            std::exit(1); 
+        }
+
+        const uint32_t* X_ptr = B_JA;
+        const uint32_t* X_idx = B_IA;
+        const Weight*   X_val = B_A;
+        const DIRECTION_TYPE direction = s->direction(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual);
+        s->directions[s->layer][direction]++;
+        if(direction == DIRECTION_TYPE::_PULL_) {
+            s->gather_rows(A_JB, A_JA + 1, A_ncols, B_SPMAT->dual, start, end);
+            X_ptr = s->pull_ptr->ptr;
+            X_idx = s->pull_idx->ptr;
+            X_val = s->pull_val->ptr;
+        }
+        const uint32_t rows = s->strip_rows(A_JA[A_ncols], A_nrows);
+        const uint32_t nstrips = (rows) ? s->map_strips(A_JB, A_JA + 1, A_IA, A_ncols, A_nrows, rows) : 0;
+        const uint32_t* A_SP = s->strip_ptr->ptr;
+        for(uint32_t j = start; j < end; j++) {
+            // A column holds at most A_nrows entries, grow geometrically if they may not fit
+            if((idx_nnz + A_nrows) > C_CSC->nnz) {
+                C_CSC->expand(std::max(2 * C_CSC->nnz, idx_nnz + A_nrows), C_CSC->nrows, C_CSC->ncols);
+            }
+            if(nstrips) {
+                // Strips with no flops leave the column untouched
+                C_CSC->JA_blk->ptr[off + j + 1] = idx_nnz;
+                for(uint32_t t = 0; t < nstrips; t++) {
+                    spmm_accumulate_strip<Activation>(s, C_CSC, X_idx, X_val, B_SPMAT->pattern_value, X_ptr[j], X_ptr[j+1], A_SP + (t * (A_ncols + 1)), A_SP + ((t + 1) * (A_ncols + 1)), A_IA, A_A, A_SPMAT->pattern_value, t * rows, std::min((t + 1) * rows, A_nrows), b_A, off + j, idx_nnz, tid);
+                }
+            }
+            else {
+                spmm_accumulate<Activation>(s, C_CSC, X_idx, X_val, B_SPMAT->pattern_value, X_ptr[j], X_ptr[j+1], A_JB, A_JA + 1, A_IA, A_A, A_SPMAT->pattern_value, A_nrows, b_A, off + j, idx_nnz, tid);
+            }
+        }
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_CSR_) {
+        const std::shared_ptr<struct CSR<Weight>> A_CSR = std::static_pointer_cast<struct CSR<Weight>>(A_SPMAT);
+        A_nrows = A_CSR->nrows;
+        A_ncols = A_CSR->ncols;
+        A_IA   = A_CSR->IA_blk->ptr;
+        A_JA   = A_CSR->JA_blk->ptr;
+        A_A   = A_CSR->A_blk->ptr;
+        const uint32_t* A_IB = (A_CSR->segmented) ? A_CSR->IB_blk->ptr : A_IA;
+        
+        const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);          
+        B_nrows = B_CSR->nrows;
+        B_ncols = B_CSR->ncols;
+        B_IA   = B_CSR->IA_blk->ptr;
+        B_JA   = B_CSR->JA_blk->ptr;
+        B_A   = B_CSR->A_blk->ptr;
+            
+        const std::shared_ptr<struct CSR<Weight>> C_CSR = std::static_pointer_cast<struct CSR<Weight>>(C_SPMAT);              
+
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu] Bias[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length, b->nitems);
+            std::exit(1); 
+        }
+		
+        for(uint32_t i = start; i < end; i++) {
+            // A row holds at most B_ncols entries, grow geometrically if they may not fit
+            if((idx_nnz + B_ncols) > C_CSR->nnz) {
+                C_CSR->expand(std::max(2 * C_CSR->nnz, idx_nnz + B_ncols), C_CSR->nrows, C_CSR->ncols);
+            }
+            spmm_accumulate<Activation>(s, C_CSR, A_JA, A_A, A_SPMAT->pattern_value, A_IB[i], A_IA[i+1], B_IA, B_IA + 1, B_JA, B_A, B_SPMAT->pattern_value, B_ncols, b_A, off + i, idx_nnz, tid);
+        }        
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSC_) {
+        const std::shared_ptr<struct DCSC<Weight>> A_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(A_SPMAT);
+        A_nrows = A_DCSC->nrows;
+        A_ncols = A_DCSC->ncols;
+        A_IA   = A_DCSC->IA_blk->ptr;
+        A_JA   = A_DCSC->JA_blk->ptr;
+        A_A   = A_DCSC->A_blk->ptr;
+        uint32_t* A_JC = A_DCSC->JC_blk->ptr;
+        uint32_t A_nnzcols = A_DCSC->nnzcols;
+        
+        const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);          
+        B_nrows = B_CSC->nrows;
+        B_ncols = B_CSC->ncols;
+        B_IA   = B_CSC->IA_blk->ptr;
+        B_JA   = B_CSC->JA_blk->ptr;
+        B_A   = B_CSC->A_blk->ptr;
+            
+        const std::shared_ptr<struct DCSC<Weight>> C_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(C_SPMAT);              
+                        
+        if((A_ncols != B_nrows) or (s->length < A_nrows)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length);
+            std::exit(1); 
+        }
+        
+        // B column entries are mapped to the stored A columns, the ones hitting empty columns are dropped
+        s->map_vectors(A_JC, A_nnzcols, A_ncols);
+        for(uint32_t j = start; j < end; j++) {
+            uint32_t nvecs = s->gather_vectors(B_IA, B_A, B_SPMAT->pattern_value, B_JA[j], B_JA[j+1]);
+            if(not nvecs) continue;
+            // A column holds at most A_nrows entries, grow geometrically if they may not fit
+            if((idx_nnz + A_nrows) > C_DCSC->nnz) {
+                C_DCSC->expand(std::max(2 * C_DCSC->nnz, idx_nnz + A_nrows), C_DCSC->nrows, C_DCSC->ncols);
+            }
+            spmm_accumulate<Activation>(s, C_DCSC, s->vec_idx->ptr, s->vec_val->ptr, (Weight) 0, 0, nvecs, A_JA, A_JA + 1, A_IA, A_A, A_SPMAT->pattern_value, A_nrows, b_A, off + j, idx_nnz, tid);
+        }
+        s->unmap_vectors(A_JC, A_nnzcols);
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_DCSR_) {
+        const std::shared_ptr<struct DCSR<Weight>> A_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(A_SPMAT);
+        A_nrows = A_DCSR->nrows;
+        A_ncols = A_DCSR->ncols;
+        A_IA   = A_DCSR->IA_blk->ptr;
+        A_JA   = A_DCSR->JA_blk->ptr;
+        A_A   = A_DCSR->A_blk->ptr;
+        uint32_t* A_IR = A_DCSR->IR_blk->ptr;
+        uint32_t A_nnzrows = A_DCSR->nnzrows;
+        
+        const std::shared_ptr<struct CSR<Weight>> B_CSR = std::static_pointer_cast<struct CSR<Weight>>(B_SPMAT);          
+        B_nrows = B_CSR->nrows;
+        B_ncols = B_CSR->ncols;
+        B_IA   = B_CSR->IA_blk->ptr;
+        B_JA   = B_CSR->JA_blk->ptr;
+        B_A   = B_CSR->A_blk->ptr;
+            
+        const std::shared_ptr<struct DCSR<Weight>> C_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(C_SPMAT);              
+
+        if((A_ncols != B_nrows) or (s->length < B_ncols)) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree A[%d %d] B[%d %d], SPA[%lu] Bias[%lu]\n", A_nrows, A_ncols, B_nrows, B_ncols, s->length, b->nitems);
+            std::exit(1); 
+        }
+        
+        const uint32_t p_start = std::lower_bound(A_IR, A_IR + A_nnzrows, start) - A_IR;
+        const uint32_t p_end = std::lower_bound(A_IR + p_start, A_IR + A_nnzrows, end) - A_IR;
+        for(uint32_t p = p_start; p < p_end; p++) {
+            // A row holds at most B_ncols entries, grow geometrically if they may not fit
+            if((idx_nnz + B_ncols) > C_DCSR->nnz) {
+                C_DCSR->expand(std::max(2 * C_DCSR->nnz, idx_nnz + B_ncols), C_DCSR->nrows, C_DCSR->ncols);
+            }
+            spmm_accumulate<Activation>(s, C_DCSR, A_JA, A_A, A_SPMAT->pattern_value, A_IA[p], A_IA[p+1], B_IA, B_IA + 1, B_JA, B_A, B_SPMAT->pattern_value, B_ncols, b_A, off + A_IR[p], idx_nnz, tid);
+        }
+    }
     else {
         Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
         std::exit(Env::finalize());
@@ -259,14 +1321,75 @@ inline void spmm_real(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
 }
 
 
+/* c += x * a over a dense column, contiguous and unaliased so the compiler vectorizes it */
 template<typename Weight>
-inline void data_x_model_1_iter(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT, 
+inline void dense_axpy(Weight* __restrict__ c, const Weight* __restrict__ a, const Weight x, const uint32_t n) {
+    for(uint32_t i = 0; i < n; i++) {
+        c[i] += x * a[i];
+    }
+}
+
+/* Dense x CSC SpMM for dense activation tiles: column j of C is the sum of the A columns named by 
+   column j of B, accumulated straight into C without an SPA. As in populate_spa, only the nonzero 
+   sums get the bias and the activation. Returns the nonzeros of C[start, end). */
+template<typename Activation, typename Weight>
+inline uint64_t spmm_dense(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT,
+                           std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT,
+                           std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT,
+                           const std::shared_ptr<struct Data_Block<Weight>> b,
+                           const uint32_t start,
+                           const uint32_t end,
+                           const int32_t tid) {
+    const std::shared_ptr<struct Dense<Weight>> A_DENSE = std::static_pointer_cast<struct Dense<Weight>>(A_SPMAT);
+    const uint32_t A_nrows = A_DENSE->nrows;
+    const uint32_t A_ncols = A_DENSE->ncols;
+    const Weight*  A_A     = A_DENSE->A_blk->ptr;
+    
+    if(B_SPMAT->compression_type != COMPRESSED_FORMAT::_CSC_) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "%s x %s SpMM not implemented\n", COMPRESSED_FORMATS[A_SPMAT->compression_type], COMPRESSED_FORMATS[B_SPMAT->compression_type]);
+        std::exit(Env::finalize());
+    }
+    const std::shared_ptr<struct CSC<Weight>> B_CSC = std::static_pointer_cast<struct CSC<Weight>>(B_SPMAT);
+    const uint32_t  B_nrows = B_CSC->nrows;
+    const uint32_t  B_ncols = B_CSC->ncols;
+    const uint32_t* B_IA    = B_CSC->IA_blk->ptr;
+    const uint32_t* B_JA    = B_CSC->JA_blk->ptr;
+    const Weight*   B_A     = B_CSC->A_blk->ptr;
+    const Weight    B_c     = B_SPMAT->pattern_value;
+    
+    const std::shared_ptr<struct Dense<Weight>> C_DENSE = std::static_pointer_cast<struct Dense<Weight>>(C_SPMAT);
+    Weight* C_A = C_DENSE->A_blk->ptr;
+    const Weight* b_A = b->ptr;
+    
+    if((A_ncols != B_nrows) or (C_DENSE->nrows != A_nrows) or (C_DENSE->ncols != B_ncols)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "SpMM dimensions do not agree C[%d %d] != A[%d %d] B[%d %d]\n", C_DENSE->nrows, C_DENSE->ncols, A_nrows, A_ncols, B_nrows, B_ncols);
+        std::exit(1); 
+    }
+    
+    uint64_t nnz = 0;
+    for(uint32_t j = start; j < end; j++) {
+        Weight* c = C_A + ((uint64_t) j * A_nrows);
+        memset(c, 0, A_nrows * sizeof(Weight));
+        for(uint32_t k = B_JA[j]; k < B_JA[j+1]; k++) {
+            dense_axpy<Weight>(c, A_A + ((uint64_t) B_IA[k] * A_nrows), (B_A) ? B_A[k] : B_c, A_nrows);
+        }
+        for(uint32_t i = 0; i < A_nrows; i++) {
+            if(c[i]) {
+                c[i] = Activation::apply(c[i] + b_A[j]);
+                nnz += (c[i] != 0);
+            }
+        }
+    }
+    return(nnz);
+}
+
+template<typename Activation, typename Weight>
+inline void data_x_model_1_iter(std::shared_ptr<struct Compressed_Format<Weight>>& A_SPMAT, 
                                 std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT, 
-                                std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT, 
-                                std::shared_ptr<struct Data_Block<Weight>> s_spa,
+                                std::shared_ptr<struct Compressed_Format<Weight>>& C_SPMAT, 
+                                std::shared_ptr<struct Compressed_Format<Weight>> S_SPMAT, 
+                                std::shared_ptr<struct Accumulator<Weight>> s_acc,
                                 const std::shared_ptr<struct Data_Block<Weight>> b_bias,
-								Weight(*noop_function)(Weight),
-								Weight(*activation_function)(Weight),
                                 const uint32_t nrows,
                                 const uint32_t ncols,
                                 const uint32_t start,
@@ -275,15 +1398,49 @@ inline void data_x_model_1_iter(std::shared_ptr<struct Compressed_Format<Weight>
                                 const uint32_t sub_end,
                                 struct Env::thread_struct& thread_st,
 								const bool last_layer,
+                                const bool fused_spmm,
                                 const int32_t leader_tid, 
                                 const int32_t tid) {
     
     COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;   
-    if((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) {
+    const bool doubly_compressed = (compression_type == COMPRESSED_FORMAT::_DCSC_) or (compression_type == COMPRESSED_FORMAT::_DCSR_);
+    // Doubly compressed outputs are only ever appended to, so they always go through the per-thread segments
+    if((((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) and fused_spmm) or doubly_compressed) {
+        double start_time = 0;
+        start_time = Env::tic();
+            uint64_t seg_nnz = 0;
+            if(doubly_compressed) { S_SPMAT->reallocate(S_SPMAT->nnz, nrows, ncols, -1, tid); }
+            else { S_SPMAT->expand(S_SPMAT->nnz, nrows, ncols); }
+			if(not last_layer) { spmm_fused<Activation>(A_SPMAT, B_SPMAT, S_SPMAT, s_acc, b_bias, start, end, sub_start, seg_nnz, tid); }
+			else { spmm_fused<Noop<Weight>>(A_SPMAT, B_SPMAT, S_SPMAT, s_acc, b_bias, start, end, sub_start, seg_nnz, tid); }
+            thread_st.off_nnz = seg_nnz;
+            pthread_barrier_wait(&Env::thread_barrier);
+        Env::spmm_real_time[tid] += Env::toc(start_time);
+        
+        start_time = Env::tic();
+            uint64_t nnz = Env::adjust_nnz(leader_tid, tid);
+            C_SPMAT->reallocate(nnz, nrows, ncols, leader_tid, tid);
+        Env::memory_allocation_time[tid] += Env::toc(start_time);
+        
+        start_time = Env::tic();
+            pthread_barrier_wait(&Env::thread_barrier);
+            C_SPMAT->stitch(S_SPMAT, start, end, sub_start, thread_st.idx_nnz, tid);
+            pthread_barrier_wait(&Env::thread_barrier);
+            Env::adjust_displacement(tid);
+            C_SPMAT->adjust(leader_tid, tid);	
+        Env::spmm_real_time[tid] += Env::toc(start_time);
+        
+        start_time = Env::tic();
+            // The stitched segments leave no gaps, C becomes the next A as is
+            if(tid == leader_tid) A_SPMAT.swap(C_SPMAT);
+            pthread_barrier_wait(&Env::thread_barrier);
+        Env::memory_allocation_time[tid] += Env::toc(start_time);
+    }
+    else if((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) {
         double start_time = 0;
 		//printf("spmm_symb start tid=%d\n", tid);
         start_time = Env::tic(); 
-            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_spa, start, end, tid);
+            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_acc, start, end, tid);
             pthread_barrier_wait(&Env::thread_barrier);
         Env::spmm_symb_time[tid] += Env::toc(start_time);   
 		//printf("spmm_symb done tid=%d %lu\n", tid, thread_st.off_nnz);
@@ -298,16 +1455,18 @@ inline void data_x_model_1_iter(std::shared_ptr<struct Compressed_Format<Weight>
 		//std::exit(0);
         start_time = Env::tic();
             pthread_barrier_wait(&Env::thread_barrier);
-			if(not last_layer) { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, activation_function, start, end, sub_start, thread_st.idx_nnz, tid); }
-			else { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, start, end, sub_start, thread_st.idx_nnz, tid); }
+			if(not last_layer) { spmm_real<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, sub_start, thread_st.idx_nnz, tid); }
+			else { spmm_real<Noop<Weight>>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, sub_start, thread_st.idx_nnz, tid); }
             pthread_barrier_wait(&Env::thread_barrier);
             Env::adjust_displacement(tid);
             C_SPMAT->adjust(leader_tid, tid);	
         Env::spmm_real_time[tid] += Env::toc(start_time);
 		//printf("spmm is done %d\n", tid);
         start_time = Env::tic();
+            // Ping-pong instead of copying C back into A, the next layer reads C around the dis_nnz gaps
+            C_SPMAT->segment(leader_tid, tid);
+            if(tid == leader_tid) A_SPMAT.swap(C_SPMAT);
             pthread_barrier_wait(&Env::thread_barrier);
-            A_SPMAT->repopulate(C_SPMAT, thread_st.dis_nnz, leader_tid, tid);
         Env::memory_allocation_time[tid] += Env::toc(start_time);
         //A_SPMAT->walk_dxm(false, leader_tid, tid);
    }
@@ -315,16 +1474,15 @@ inline void data_x_model_1_iter(std::shared_ptr<struct Compressed_Format<Weight>
         Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
         std::exit(Env::finalize());
    }
+    s_acc->count_blocks();
 }
 
-template<typename Weight>
+template<typename Activation, typename Weight>
 inline void data_x_data_1_iter(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT, 
                                std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT, 
                                std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT, 
-                               std::shared_ptr<struct Data_Block<Weight>> s_spa,
+                               std::shared_ptr<struct Accumulator<Weight>> s_acc,
                                const std::shared_ptr<struct Data_Block<Weight>> b_bias,
-							   Weight(*noop_function)(Weight),
-							   Weight(*activation_function)(Weight),
                                const uint32_t nrows,
                                const uint32_t ncols,
                                const uint32_t start,
@@ -332,15 +1490,33 @@ inline void data_x_data_1_iter(std::shared_ptr<struct Compressed_Format<Weight>>
                                const uint32_t off,
                                struct Env::thread_struct& thread_st,
 							   const bool last_layer,
+                               const bool fused_spmm,
                                int32_t leader_tid, 
                                const int32_t tid) {
     
     COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;    
-    if((A_SPMAT->compression_type == COMPRESSED_FORMAT::_CSC_) or (A_SPMAT->compression_type == COMPRESSED_FORMAT::_CSR_)) {
+    const bool doubly_compressed = (compression_type == COMPRESSED_FORMAT::_DCSC_) or (compression_type == COMPRESSED_FORMAT::_DCSR_);
+    if(((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_) or doubly_compressed) and fused_spmm) {
+        double start_time = 0;
+        start_time = Env::tic();
+            leader_tid = -1;
+            // The previous activation is a good first guess, spmm_fused grows C if it is not
+            C_SPMAT->reallocate(A_SPMAT->nnz_i, nrows, ncols, leader_tid, tid);
+        Env::memory_allocation_time[tid] += Env::toc(start_time);
+        
+        start_time = Env::tic();
+            thread_st.idx_nnz = 0;
+			if(not last_layer) { spmm_fused<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
+			else { spmm_fused<Noop<Weight>>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
+            Env::adjust_displacement(tid);
+            C_SPMAT->adjust(tid);
+        Env::spmm_real_time[tid] += Env::toc(start_time);
+    }
+    else if((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_) or doubly_compressed) {
 		//printf("0.symb %d\n", tid);
         double start_time = 0;
         start_time = Env::tic();
-            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_spa, start, end, tid);
+            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_acc, start, end, tid);
         Env::spmm_symb_time[tid] += Env::toc(start_time);      
         
         start_time = Env::tic();
@@ -352,8 +1528,8 @@ inline void data_x_data_1_iter(std::shared_ptr<struct Compressed_Format<Weight>>
         //printf("tid=%d nnz=%lu\n", tid, nnz);
         start_time = Env::tic();
             thread_st.idx_nnz = 0;
-			if(not last_layer) { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, activation_function, start, end, off, thread_st.idx_nnz, tid); }
-			else { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, start, end, off, thread_st.idx_nnz, tid); }
+			if(not last_layer) { spmm_real<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
+			else { spmm_real<Noop<Weight>>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
             Env::adjust_displacement(tid);
             C_SPMAT->adjust(tid);
         Env::spmm_real_time[tid] += Env::toc(start_time);                              
@@ -361,17 +1537,43 @@ inline void data_x_data_1_iter(std::shared_ptr<struct Compressed_Format<Weight>>
         //leader_tid = 0;
         //C_SPMAT->walk_dxd(false, leader_tid, tid);
    }
+    s_acc->count_blocks();
 }
 
 
-template<typename Weight>
-inline void data_x_model_hybrid_1_iter(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT, 
+/* data_x_data_1_iter for a dense activation tile, C is dense as well */
+template<typename Activation, typename Weight>
+inline void data_x_data_dense_1_iter(std::shared_ptr<struct Compressed_Format<Weight>> A_SPMAT, 
+                                     std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT, 
+                                     std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT, 
+                                     const std::shared_ptr<struct Data_Block<Weight>> b_bias,
+                                     const uint32_t nrows,
+                                     const uint32_t ncols,
+                                     const uint32_t start,
+                                     const uint32_t end,
+                                     const bool last_layer,
+                                     const int32_t tid) {
+    double start_time = 0;
+    start_time = Env::tic();
+        C_SPMAT->reallocate(0, nrows, ncols, -1, tid);
+    Env::memory_allocation_time[tid] += Env::toc(start_time);
+    
+    start_time = Env::tic();
+        uint64_t nnz = 0;
+        if(not last_layer) { nnz = spmm_dense<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, b_bias, start, end, tid); }
+        else { nnz = spmm_dense<Noop<Weight>>(A_SPMAT, B_SPMAT, C_SPMAT, b_bias, start, end, tid); }
+        std::static_pointer_cast<struct Dense<Weight>>(C_SPMAT)->nnz_i = nnz;
+        C_SPMAT->nnz_i = nnz;
+    Env::spmm_real_time[tid] += Env::toc(start_time);
+}
+
+template<typename Activation, typename Weight>
+inline void data_x_model_hybrid_1_iter(std::shared_ptr<struct Compressed_Format<Weight>>& A_SPMAT, 
                                 std::shared_ptr<struct Compressed_Format<Weight>> B_SPMAT, 
-                                std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT, 
-                                std::shared_ptr<struct Data_Block<Weight>> s_spa,
+                                std::shared_ptr<struct Compressed_Format<Weight>>& C_SPMAT, 
+                                std::shared_ptr<struct Compressed_Format<Weight>> S_SPMAT, 
+                                std::shared_ptr<struct Accumulator<Weight>> s_acc,
                                 const std::shared_ptr<struct Data_Block<Weight>> b_bias,
-								Weight(*noop_function)(Weight),
-								Weight(*activation_function)(Weight),
                                 const uint32_t nrows,
                                 const uint32_t ncols,
                                 const uint32_t start,
@@ -380,15 +1582,50 @@ inline void data_x_model_hybrid_1_iter(std::shared_ptr<struct Compressed_Format<
                                 const std::deque<int32_t> my_threads,
                                 struct Env::thread_struct& thread_st,
 								const bool last_layer,
+                                const bool fused_spmm,
                                 const int32_t leader_tid, 
                                 const int32_t tid) {
 
     COMPRESSED_FORMAT compression_type = A_SPMAT->compression_type;    
-    if((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) {
+    const bool doubly_compressed = (compression_type == COMPRESSED_FORMAT::_DCSC_) or (compression_type == COMPRESSED_FORMAT::_DCSR_);
+    // Doubly compressed outputs are only ever appended to, so they always go through the per-thread segments
+    if((((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) and fused_spmm) or doubly_compressed) {
+        double start_time = 0;
+        
+        if(tid ==leader_tid) start_time = Env::tic();
+            uint64_t seg_nnz = 0;
+            if(doubly_compressed) { S_SPMAT->reallocate(S_SPMAT->nnz, nrows, ncols, -1, tid); }
+            else { S_SPMAT->expand(S_SPMAT->nnz, nrows, ncols); }
+			if(not last_layer) { spmm_fused<Activation>(A_SPMAT, B_SPMAT, S_SPMAT, s_acc, b_bias, start, end, off, seg_nnz, tid); }
+			else { spmm_fused<Noop<Weight>>(A_SPMAT, B_SPMAT, S_SPMAT, s_acc, b_bias, start, end, off, seg_nnz, tid); }
+            thread_st.off_nnz = seg_nnz;
+            pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+        if(tid ==leader_tid) Env::spmm_real_time[tid] += Env::toc(start_time);
+        
+        if(tid ==leader_tid) start_time = Env::tic();
+            uint64_t nnz = Env::adjust_nnz(my_threads, leader_tid, tid);
+            C_SPMAT->reallocate(nnz, nrows, ncols, leader_tid, tid);
+        if(tid ==leader_tid) Env::memory_allocation_time[tid] += Env::toc(start_time);
+        
+        if(tid ==leader_tid) start_time = Env::tic();
+            pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+            C_SPMAT->stitch(S_SPMAT, start, end, off, thread_st.idx_nnz, tid);
+            pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+            Env::adjust_displacement(my_threads, leader_tid, tid);
+            C_SPMAT->adjust(my_threads, leader_tid, tid);	
+        if(tid ==leader_tid) Env::spmm_real_time[tid] += Env::toc(start_time);
+        
+        if(tid ==leader_tid) start_time = Env::tic();
+            // The stitched segments leave no gaps, C becomes the next A as is
+            if(tid == leader_tid) A_SPMAT.swap(C_SPMAT);
+            pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
+        if(tid ==leader_tid) Env::memory_allocation_time[tid] += Env::toc(start_time);
+    }
+    else if((compression_type == COMPRESSED_FORMAT::_CSC_) or (compression_type == COMPRESSED_FORMAT::_CSR_)) {
         double start_time = 0;
 
         if(tid ==leader_tid) start_time = Env::tic(); 
-            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_spa, start, end, tid);
+            std::tie(thread_st.off_nnz, std::ignore, std::ignore) =  spmm_symb(A_SPMAT, B_SPMAT, s_acc, start, end, tid);
             pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
         if(tid ==leader_tid) Env::spmm_symb_time[tid] += Env::toc(start_time);   
 
@@ -400,16 +1637,18 @@ inline void data_x_model_hybrid_1_iter(std::shared_ptr<struct Compressed_Format<
 		//if(tid==leader_tid)printf("tid=%d nnz=%lu\n", tid ,nnz);
         if(tid ==leader_tid) start_time = Env::tic();
             pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
-			if(not last_layer) { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, activation_function, start, end, off, thread_st.idx_nnz, tid); }
-			else { spmm_real(A_SPMAT, B_SPMAT, C_SPMAT, s_spa, b_bias, noop_function, start, end, off, thread_st.idx_nnz, tid); }
+			if(not last_layer) { spmm_real<Activation>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
+			else { spmm_real<Noop<Weight>>(A_SPMAT, B_SPMAT, C_SPMAT, s_acc, b_bias, start, end, off, thread_st.idx_nnz, tid); }
             pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
             Env::adjust_displacement(my_threads, leader_tid, tid);
             C_SPMAT->adjust(my_threads, leader_tid, tid);	
         if(tid ==leader_tid) Env::spmm_real_time[tid] += Env::toc(start_time);
 		//if(tid==leader_tid)printf("tid=%d spmm done\n",tid);
         if(tid ==leader_tid) start_time = Env::tic();
+            // Ping-pong instead of copying C back into A, the next layer reads C around the dis_nnz gaps
+            C_SPMAT->segment(my_threads, leader_tid, tid);
+            if(tid == leader_tid) A_SPMAT.swap(C_SPMAT);
             pthread_barrier_wait(&Env::thread_barriers[leader_tid]);
-            A_SPMAT->repopulate(C_SPMAT, my_threads, leader_tid, tid);
         if(tid ==leader_tid) Env::memory_allocation_time[tid] += Env::toc(start_time);
 		//if(tid==leader_tid)printf("tid=%d layer done\n",tid);
 		
@@ -420,6 +1659,7 @@ inline void data_x_model_hybrid_1_iter(std::shared_ptr<struct Compressed_Format<
         Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
         std::exit(Env::finalize());
     }    
+    s_acc->count_blocks();
 }
 
 template<typename Weight>
@@ -515,6 +1755,89 @@ uint32_t infer(const std::shared_ptr<struct Compressed_Format<Weight>> C_SPMAT,
 			}
 		}
 	}
+	else if(compression_type == COMPRESSED_FORMAT::_DCSC_) {
+		const std::shared_ptr<struct DCSC<Weight>> C_DCSC = std::static_pointer_cast<struct DCSC<Weight>>(C_SPMAT);
+		C_nnz   = C_DCSC->nnz;
+		C_nrows = C_DCSC->nrows;
+		C_ncols = C_DCSC->ncols;
+		C_IA   = C_DCSC->IA_blk->ptr;
+		C_JA   = C_DCSC->JA_blk->ptr;
+		C_A   = C_DCSC->A_blk->ptr;
+		uint32_t* C_JC = C_DCSC->JC_blk->ptr;
+		uint32_t C_nnzcols = C_DCSC->nnzcols;
+		
+		all_categories.resize(C_nrows);
+		if(category_type == VALUE_TYPE::_NONZERO_INSTANCES_ONLY_) {
+			for(uint32_t p = 0; p < C_nnzcols; p++) {
+				for(uint32_t i = C_JA[p]; i < C_JA[p+1]; i++) {
+					all_categories[C_IA[i]] = 1;
+				}
+			}
+		}
+		else if(category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) {
+			if(classifier == "sigmoid") {
+				for(uint32_t p = 0; p < C_nnzcols; p++) {
+					for(uint32_t i = C_JA[p]; i < C_JA[p+1]; i++) {
+						all_categories[C_IA[i]]=sigmoid(C_A[i]) < 0.5 ? 0 : 1;
+					}
+				}
+			}
+			else if(classifier == "softmax") {	
+				std::vector<Weight> values(C_nrows);
+				for(uint32_t p = 0; p < C_nnzcols; p++) {
+					uint32_t j = C_JC[p];
+					for(uint32_t i = C_JA[p]; i < C_JA[p+1]; i++) {
+						if(values[C_IA[i]]) {
+							if(values[C_IA[i]]<C_A[i]) {
+								values[C_IA[i]] = C_A[i];
+								all_categories[C_IA[i]]=j;	
+							}
+						}
+						else {
+							values[C_IA[i]] = C_A[i];
+							all_categories[C_IA[i]]=j;
+						}
+					}
+				}
+			}
+		}
+	}
+	else if(compression_type == COMPRESSED_FORMAT::_DCSR_) {
+		const std::shared_ptr<struct DCSR<Weight>> C_DCSR = std::static_pointer_cast<struct DCSR<Weight>>(C_SPMAT);
+		C_nnz   = C_DCSR->nnz;
+		C_nrows = C_DCSR->nrows;
+		C_ncols = C_DCSR->ncols;
+		C_IA   = C_DCSR->IA_blk->ptr;
+		C_JA   = C_DCSR->JA_blk->ptr;
+		C_A    = C_DCSR->A_blk->ptr;
+		uint32_t* C_IR = C_DCSR->IR_blk->ptr;
+		uint32_t C_nnzrows = C_DCSR->nnzrows;
+		
+		// Rows that are not stored stay at category zero
+		all_categories.resize(C_nrows);
+		if(category_type == VALUE_TYPE::_NONZERO_INSTANCES_ONLY_) {
+			for(uint32_t p = 0; p < C_nnzrows; p++) all_categories[C_IR[p]] = C_IA[p+1]-C_IA[p] ? 1 : 0;
+		}
+		else if(category_type == VALUE_TYPE::_INSTANCE_AND_VALUE_PAIRS_) {
+			if(classifier == "sigmoid") {
+				for(uint32_t p = 0; p < C_nnzrows; p++) {
+					for(uint32_t j=C_IA[p]; j < C_IA[p+1]; j++) {
+						all_categories[C_IR[p]]=sigmoid(C_A[j]) < 0.5 ? 0 : 1;
+					}
+				}
+			}
+			else if(classifier == "softmax") {	
+				for(uint32_t p = 0; p < C_nnzrows; p++) {
+					int index = 0;
+					Weight value = 0;
+					for(uint32_t j=C_IA[p]; j < C_IA[p+1]; j++) {
+						if(C_A[j]>value) { value = C_A[j]; index = C_JA[j]; }
+					}
+					all_categories[C_IR[p]]= index;
+				}
+			}
+		}
+	}
 	else {
 		Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
 		std::exit(Env::finalize());
@@ -7,8 +7,32 @@
 #ifndef TILE_HPP
 #define TILE_HPP
 
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "triple.hpp"
 #include "spmat.hpp"
+#include "hashers.hpp"
+
+/* Header of a pre-compressed tile, followed by its arrays exactly as the CSC (CSR) holds them: 
+   the ncols+1 (nrows+1) offsets, the nnz indices and the nnz weights unless the tile is a pattern */
+struct Compressed_Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t compression_type;
+    uint32_t hashing_type;
+    uint32_t weight_size;
+    uint32_t nrows;
+    uint32_t ncols;
+    uint64_t nnz;
+    uint32_t pattern;
+    uint32_t padding;
+    double   pattern_value;
+};
+const char COMPRESSED_MAGIC[8] = "SPDNNCF";
+const uint32_t COMPRESSED_VERSION = 1;
 
 template<typename Weight>
 struct Tile{
@@ -17,6 +41,9 @@ struct Tile{
         ~Tile() {};
 
         void compress(const COMPRESSED_FORMAT compression_type_, const bool one_rank, const int32_t socket_id);
+        bool load(const std::string file, const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type, const int32_t socket_id);
+        bool load(const int fd, const uint64_t offset, const uint64_t nbytes, const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type, const int32_t socket_id, const bool mapped);
+        void store(const std::string file, const HASHING_TYPE hashing_type);
         std::vector<struct Triple<Weight>> triples;
         std::shared_ptr<struct Compressed_Format<Weight>> spmat = nullptr;
         COMPRESSED_FORMAT compression_type;
@@ -38,6 +65,8 @@ void Tile<Weight>::compress(const COMPRESSED_FORMAT compression_type_, const boo
 
     if(compression_type == COMPRESSED_FORMAT::_CSC_) spmat = std::make_shared<struct CSC<Weight>>(triples.size(), height, width, socket_id);
     else if(compression_type == COMPRESSED_FORMAT::_CSR_) spmat = std::make_shared<struct CSR<Weight>>(triples.size(), height, width, socket_id);
+    else if(compression_type == COMPRESSED_FORMAT::_DCSC_) spmat = std::make_shared<struct DCSC<Weight>>(triples.size(), height, width, socket_id);
+    else if(compression_type == COMPRESSED_FORMAT::_DCSR_) spmat = std::make_shared<struct DCSR<Weight>>(triples.size(), height, width, socket_id);
     else {
         Logging::print(Logging::LOG_LEVEL::ERROR, "%s compression not implemented\n", COMPRESSED_FORMATS[compression_type]);
         std::exit(Env::finalize());
@@ -50,4 +79,134 @@ void Tile<Weight>::compress(const COMPRESSED_FORMAT compression_type_, const boo
         triples.shrink_to_fit();
     }
 }
+
+/* Read a tile stored by store(), nothing is sorted or populated. Returns false when there is no file
+   or it was written for another format, hashing or dimensions, so the caller compresses the triples */
+template<typename Weight>
+bool Tile<Weight>::load(const std::string file, const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type, const int32_t socket_id) {
+    if((compression_type_ != COMPRESSED_FORMAT::_CSC_) and (compression_type_ != COMPRESSED_FORMAT::_CSR_)) return(false);
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd == -1) return(false);
+    struct stat st;
+    bool loaded = (not fstat(fd, &st)) and load(fd, 0, st.st_size, compression_type_, hashing_type, socket_id, false);
+    close(fd);
+    return(loaded);
+}
+
+/* The stored tile at [offset, offset + nbytes) of fd, copied into blocks on socket_id or, when mapped, 
+   left in read only file-backed blocks (a model bundle) */
+template<typename Weight>
+bool Tile<Weight>::load(const int fd, const uint64_t offset, const uint64_t nbytes, const COMPRESSED_FORMAT compression_type_, const HASHING_TYPE hashing_type, const int32_t socket_id, const bool mapped) {
+    struct Compressed_Header header = {};
+    if((pread(fd, &header, sizeof(struct Compressed_Header), offset) != sizeof(struct Compressed_Header)) or
+       memcmp(header.magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) or (header.version != COMPRESSED_VERSION) or 
+       (header.compression_type != compression_type_) or (header.hashing_type != hashing_type) or 
+       (header.weight_size != sizeof(Weight)) or (header.nrows != height) or (header.ncols != width)) return(false);
+    const uint64_t noffsets = ((compression_type_ == COMPRESSED_FORMAT::_CSC_) ? header.ncols : header.nrows) + 1;
+    const uint64_t nweights = (header.pattern) ? 0 : header.nnz;
+    if(nbytes != (sizeof(struct Compressed_Header) + ((noffsets + header.nnz) * sizeof(uint32_t)) + (nweights * sizeof(Weight)))) return(false);
+    
+    const uint64_t offsets_offset = offset + sizeof(struct Compressed_Header);
+    const uint64_t indices_offset = offsets_offset + (noffsets * sizeof(uint32_t));
+    const uint64_t weights_offset = indices_offset + (header.nnz * sizeof(uint32_t));
+    std::shared_ptr<struct Data_Block<uint32_t>> offsets_blk;
+    std::shared_ptr<struct Data_Block<uint32_t>> indices_blk;
+    std::shared_ptr<struct Data_Block<Weight>> A_blk;
+    if(mapped) {
+        offsets_blk = std::make_shared<struct Data_Block<uint32_t>>(fd, offsets_offset, noffsets);
+        indices_blk = std::make_shared<struct Data_Block<uint32_t>>(fd, indices_offset, header.nnz);
+        A_blk = std::make_shared<struct Data_Block<Weight>>(fd, weights_offset, nweights);
+    }
+    else {
+        offsets_blk = std::make_shared<struct Data_Block<uint32_t>>(noffsets, socket_id);
+        indices_blk = std::make_shared<struct Data_Block<uint32_t>>(header.nnz, socket_id);
+        A_blk = std::make_shared<struct Data_Block<Weight>>(nweights, socket_id);
+        auto read_all = [fd] (void* data, uint64_t size, uint64_t off) {
+            char* d = (char*) data;
+            while(size) {
+                ssize_t n = pread(fd, d, size, off);
+                if(n <= 0) return(false);
+                d += n; off += n; size -= n;
+            }
+            return(true);
+        };
+        if(not (read_all(offsets_blk->ptr, noffsets * sizeof(uint32_t), offsets_offset) and read_all(indices_blk->ptr, header.nnz * sizeof(uint32_t), indices_offset) and 
+                read_all(A_blk->ptr, nweights * sizeof(Weight), weights_offset))) {
+            Logging::print(Logging::LOG_LEVEL::ERROR, "Reading the stored tile\n");
+            std::exit(Env::finalize());
+        }
+    }
+    
+    compression_type = compression_type_;
+    if(compression_type == COMPRESSED_FORMAT::_CSC_) {
+        std::shared_ptr<struct CSC<Weight>> csc = std::make_shared<struct CSC<Weight>>(header.nnz, header.nrows, header.ncols, nullptr, nullptr, nullptr);
+        csc->JA_blk = offsets_blk;
+        csc->IA_blk = indices_blk;
+        csc->A_blk = A_blk;
+        spmat = csc;
+    }
+    else {
+        std::shared_ptr<struct CSR<Weight>> csr = std::make_shared<struct CSR<Weight>>(header.nnz, header.nrows, header.ncols, nullptr, nullptr, nullptr);
+        csr->IA_blk = offsets_blk;
+        csr->JA_blk = indices_blk;
+        csr->A_blk = A_blk;
+        spmat = csr;
+    }
+    spmat->pattern = header.pattern;
+    spmat->pattern_value = header.pattern_value;
+    nedges = header.nnz;
+    triples.clear();
+    triples.shrink_to_fit();
+    return(true);
+}
+
+/* Write the compressed tile with the hashing its triples were read with, for load() */
+template<typename Weight>
+void Tile<Weight>::store(const std::string file, const HASHING_TYPE hashing_type) {
+    struct Compressed_Header header = {};
+    memcpy(header.magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+    header.version = COMPRESSED_VERSION;
+    header.compression_type = compression_type;
+    header.hashing_type = hashing_type;
+    header.weight_size = sizeof(Weight);
+    header.nrows = spmat->nrows;
+    header.ncols = spmat->ncols;
+    header.nnz = spmat->nnz;
+    header.pattern = spmat->pattern;
+    header.pattern_value = spmat->pattern_value;
+    
+    uint64_t noffsets = 0;
+    const uint32_t* offsets = nullptr;
+    const uint32_t* indices = nullptr;
+    const Weight* A = nullptr;
+    if(compression_type == COMPRESSED_FORMAT::_CSC_) {
+        const std::shared_ptr<struct CSC<Weight>> csc = std::static_pointer_cast<struct CSC<Weight>>(spmat);
+        noffsets = csc->ncols + 1;
+        offsets = csc->JA_blk->ptr;
+        indices = csc->IA_blk->ptr;
+        A = csc->A_blk->ptr;
+    }
+    else if(compression_type == COMPRESSED_FORMAT::_CSR_) {
+        const std::shared_ptr<struct CSR<Weight>> csr = std::static_pointer_cast<struct CSR<Weight>>(spmat);
+        noffsets = csr->nrows + 1;
+        offsets = csr->IA_blk->ptr;
+        indices = csr->JA_blk->ptr;
+        A = csr->A_blk->ptr;
+    }
+    else {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "%s tiles cannot be stored\n", COMPRESSED_FORMATS[compression_type]);
+        std::exit(Env::finalize());
+    }
+    
+    FILE* fd = fopen(file.c_str(), "wb");
+    if(not fd) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Opening %s\n", file.c_str());
+        std::exit(Env::finalize());
+    }
+    if((fwrite(&header, sizeof(struct Compressed_Header), 1, fd) != 1) or (fwrite(offsets, sizeof(uint32_t), noffsets, fd) != noffsets) or 
+       (fwrite(indices, sizeof(uint32_t), header.nnz, fd) != header.nnz) or ((not header.pattern) and (fwrite(A, sizeof(Weight), header.nnz, fd) != header.nnz)) or fclose(fd)) {
+        Logging::print(Logging::LOG_LEVEL::ERROR, "Writing %s\n", file.c_str());
+        std::exit(Env::finalize());
+    }
+}
 #endif
\ No newline at end of file
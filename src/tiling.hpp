@@ -28,14 +28,14 @@ class Tiling {
         ~Tiling() {};
         
         Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const uint32_t ncolgrps_, const uint32_t nranks_, 
-               const uint64_t nnzs_, const uint32_t nrows_, const uint32_t ncols_, 
+               const uint32_t nrows_, const uint32_t ncols_, 
                const std::string input_file, const INPUT_TYPE input_type,
                const TILING_TYPE tiling_type_, const COMPRESSED_FORMAT compression_type, 
                std::shared_ptr<struct TwoDHasher> hasher);
 
         Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const uint32_t ncolgrps_, 
                const uint32_t nranks_, const uint32_t rank_nthreads_, const uint32_t nthreads_,
-               const uint64_t nnzs_, const uint32_t nrows_, const uint32_t ncols_, 
+               const uint32_t nrows_, const uint32_t ncols_, 
                const std::string input_file, const INPUT_TYPE input_type, 
                const TILING_TYPE tiling_type_, const COMPRESSED_FORMAT compression_type,
                std::shared_ptr<struct TwoDHasher> hasher);
@@ -69,6 +69,7 @@ class Tiling {
         std::vector<std::vector<struct Tile<Weight>>> tiles;
         
         bool one_rank = false;
+        bool stale_tile = false; /* The stored tile does not match (e.g. another padding), its triples were compressed instead */
         std::vector<uint32_t> set_thread_index();
         std::vector<std::deque<uint32_t>> set_threads_indices();
         std::deque<uint32_t> set_rank_indices();
@@ -84,6 +85,7 @@ class Tiling {
         bool assert_tiling();
         
         void exchange_triples();
+        void count_nnzs(const std::vector<struct Triple<Weight>>& triples);
         void insert_triples(std::vector<struct Triple<Weight>>& triples);
         void delete_triples(std::vector<struct Triple<Weight>>& triples);
         void compress_triples(const COMPRESSED_FORMAT compression_type);
@@ -95,14 +97,14 @@ class Tiling {
 /* Process-based tiling based on MPI ranks*/ 
 template<typename Weight>
 Tiling<Weight>::Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const uint32_t ncolgrps_, const uint32_t nranks_, 
-                       const uint64_t nnzs_, const uint32_t nrows_, const uint32_t ncols_,
+                       const uint32_t nrows_, const uint32_t ncols_,
                        const std::string input_file, const INPUT_TYPE input_type,
                        const TILING_TYPE tiling_type_, 
                        const COMPRESSED_FORMAT compression_type, std::shared_ptr<struct TwoDHasher> hasher)
         : ntiles(ntiles_) , nrowgrps(nrowgrps_), ncolgrps(ncolgrps_), nranks(nranks_), rank_ntiles(ntiles_/nranks_), 
-          nnzs(nnzs_), nrows(nrows_), ncols(ncols_), tiling_type(tiling_type_) {
+          nnzs(0), nrows(nrows_), ncols(ncols_), tiling_type(tiling_type_) {
     
-    one_rank = ((nranks == 1) and (nranks != (uint32_t) Env::nranks)) ? true : false;
+    one_rank = (nranks == 1); // Makes no MPI calls, so the layers can be loaded concurrently by threads
    
     if((rank_ntiles * nranks != ntiles) or (nrowgrps * ncolgrps != ntiles)) {
         Logging::print(Logging::LOG_LEVEL::ERROR, "Tiling failed\n");
@@ -199,9 +201,22 @@ Tiling<Weight>::Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const u
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: rank_nrowgrps x rank_ncolgrps = [%d x %d]\n", rank_nrowgrps, rank_ncolgrps);
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nrows         x ncols         = [%d x %d]\n", nrows, ncols);
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: tile_height   x tile_width    = [%d x %d]\n", tile_height, tile_width);
-    Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nnzs                           = [%d]\n", nnzs);
+    
+    /* A single tile layer that is already stored compressed (see src/apps/compress_layers.cpp) skips reading, sorting and populating the triples */
+    if((ntiles == 1) and (tiling_type == TILING_TYPE::_1D_COL_)) {
+        auto& tile = tiles[0][0];
+        std::string compressed_file = IO::compressed_file(input_file, compression_type);
+        if((not compressed_file.empty()) and tile.load(compressed_file, compression_type, hasher->hashing_type, Env::threads_socket_id[tile.thread])) {
+            nnzs = tile.nedges;
+            Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nnzs                           = [%d] (pre-compressed %s)\n", nnzs, compressed_file.c_str());
+            return;
+        }
+        stale_tile = (not compressed_file.empty()) and (not access(compressed_file.c_str(), F_OK)); // Layers are loaded silently, the caller warns
+    }
     
     std::vector<struct Triple<Weight>> triples = IO::read_file_ijw<Weight>(input_file, input_type, hasher, one_rank, nrows, ncols);
+    count_nnzs(triples);
+    Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nnzs                           = [%d]\n", nnzs);
 	Tiling<Weight>::insert_triples(triples);
     Tiling<Weight>::delete_triples(triples);
 
@@ -217,13 +232,13 @@ Tiling<Weight>::Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const u
 template<typename Weight>
 Tiling<Weight>::Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const uint32_t ncolgrps_,  const uint32_t nranks_, 
                        const uint32_t rank_nthreads_, const uint32_t nthreads_, 
-                       const uint64_t nnzs_, const uint32_t nrows_, const uint32_t ncols_,
+                       const uint32_t nrows_, const uint32_t ncols_,
                        const std::string input_file, const INPUT_TYPE input_type,
                        const TILING_TYPE tiling_type_, const COMPRESSED_FORMAT compression_type,
                        std::shared_ptr<struct TwoDHasher> hasher)
                      : ntiles(ntiles_) , nrowgrps(nrowgrps_), ncolgrps(ncolgrps_), nranks(nranks_), rank_ntiles(ntiles_/nranks_), 
                        rank_nthreads(rank_nthreads_), nthreads(nthreads_),
-                       nnzs(nnzs_), nrows(nrows_), ncols(ncols_), tiling_type(tiling_type_) {
+                       nnzs(0), nrows(nrows_), ncols(ncols_), tiling_type(tiling_type_) {
     
     one_rank = ((nranks == 1) and (nranks != (uint32_t) Env::nranks)) ? true : false;              
     
@@ -329,9 +344,10 @@ Tiling<Weight>::Tiling(const uint32_t ntiles_, const uint32_t nrowgrps_, const u
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling Information: thread_nrowgrps  x thread_ncolgrps  = [%d x %d]\n", thread_nrowgrps, thread_ncolgrps);
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nrows            x ncols            = [%d x %d]\n", nrows, ncols);
     Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: tile_height      x tile_width       = [%d x %d]\n", tile_height, tile_width);
-    Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nnzs                                 = [%d]\n", nnzs);
     
 	std::vector<struct Triple<Weight>> triples = IO::read_file_ijw<Weight>(input_file, input_type, hasher, one_rank, nrows, ncols);
+    count_nnzs(triples);
+    Logging::print(Logging::LOG_LEVEL::INFO, "Tiling information: nnzs                                 = [%d]\n", nnzs);
 	Tiling<Weight>::insert_triples(triples);
     Tiling<Weight>::delete_triples(triples);
 
@@ -712,7 +728,7 @@ void Tiling<Weight>::exchange_triples() {
 
 template<typename Weight>
 void Tiling<Weight>::tile_load(bool one_rank) {
-    Env::barrier();
+    if(not one_rank) Env::barrier(); // A one rank tiling is loaded by its rank alone, e.g. only the machine leaders load shared layers
     Logging::print(Logging::LOG_LEVEL::INFO, "Tile load: Start calculating load...\n");
 	if(one_rank) {
 		for (uint32_t i = 0; i < nrowgrps; i++) {
@@ -764,7 +780,14 @@ void Tiling<Weight>::tile_load(bool one_rank) {
 		}
 	}
     Logging::print(Logging::LOG_LEVEL::INFO, "Tile load: Done calculating load.\n");
-    Env::barrier();
+    if(not one_rank) Env::barrier();
+}
+
+/* The nonzeros come out of the one read of the file, the ranks of a distributed tiling each read a part */
+template<typename Weight>
+void Tiling<Weight>::count_nnzs(const std::vector<struct Triple<Weight>>& triples) {
+    nnzs = triples.size();
+    if(not one_rank) MPI_Allreduce(MPI_IN_PLACE, &nnzs, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
 }
 
 template<typename Weight>
@@ -835,7 +858,7 @@ void Tiling<Weight>::set_tile_info(const std::vector<std::vector<struct Tile<Wei
 
 template<typename Weight>
 void Tiling<Weight>::compress_triples(const COMPRESSED_FORMAT compression_type) {
-    Env::barrier();
+    if(not one_rank) Env::barrier();
     Logging::print(Logging::LOG_LEVEL::INFO, "Tile compression: Start compressing tile using %s\n", COMPRESSED_FORMATS[compression_type]);
 
     for (uint32_t i = 0; i < nrowgrps; i++) {
@@ -846,7 +869,7 @@ void Tiling<Weight>::compress_triples(const COMPRESSED_FORMAT compression_type)
     }    
 	
     Logging::print(Logging::LOG_LEVEL::INFO, "Tile compression: Done compressing tiles.\n");
-    Env::barrier();
+    if(not one_rank) Env::barrier();
 }
 
 #endif
\ No newline at end of file